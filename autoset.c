@@ -0,0 +1,332 @@
+#include <math.h>
+#include "rokscope.h"
+
+#define AUTOSET_LANES 8
+
+
+// Min, max and sum run on independent lanes without branches, which the
+// optimizer turns into vector instructions; only the edge search is
+// sequential.
+void autoset_measure(const sample_t *x, int n, uint64_t rate,
+		struct autoset_measure *m) {
+	sample_t lo[AUTOSET_LANES], hi[AUTOSET_LANES], sum[AUTOSET_LANES];
+	int i;
+
+	for (int k = 0; k < AUTOSET_LANES; k++) {
+		lo[k] = INFINITY;
+		hi[k] = -INFINITY;
+		sum[k] = 0;
+	}
+	for (i = 0; i + AUTOSET_LANES <= n; i += AUTOSET_LANES) {
+		for (int k = 0; k < AUTOSET_LANES; k++) {
+			sample_t v = x[i + k];
+			lo[k] = v < lo[k] ? v : lo[k];
+			hi[k] = v > hi[k] ? v : hi[k];
+			sum[k] += v;
+		}
+	}
+	for (; i < n; i++) {
+		lo[0] = x[i] < lo[0] ? x[i] : lo[0];
+		hi[0] = x[i] > hi[0] ? x[i] : hi[0];
+		sum[0] += x[i];
+	}
+
+	double total = 0;
+	m->min = lo[0];
+	m->max = hi[0];
+	for (int k = 0; k < AUTOSET_LANES; k++) {
+		m->min = lo[k] < m->min ? lo[k] : m->min;
+		m->max = hi[k] > m->max ? hi[k] : m->max;
+		total += sum[k];
+	}
+	m->mean = n > 0 ? (sample_t) (total / n) : 0;
+
+	// Rising crossings of the mean, rearmed 10% of the swing below it
+	sample_t mean = m->mean;
+	sample_t low = mean - (m->max - m->min) * .1f;
+	double first = 0, last = 0;
+	int armed = 0;
+	m->edges = 0;
+	for (i = 1; i < n; i++) {
+		if (x[i] < low) {
+			armed = 1;
+		} else if (armed && x[i - 1] < mean && x[i] >= mean) {
+			double t = i - 1 + (mean - x[i - 1]) / (x[i] - x[i - 1]);
+			if (m->edges == 0)
+				first = t;
+			last = t;
+			m->edges++;
+			armed = 0;
+		}
+	}
+	m->frequency = m->edges >= 2 && last > first
+			? (m->edges - 1) * (double) rate / (last - first) : 0;
+}
+
+
+// Highest listed sample rate not above rate, or the lowest listed one.
+// Devices without a list take the rate as it is.
+uint64_t autoset_pick_rate(struct state *s, double rate) {
+	struct device *d = s->devices[0];
+	GVariant *gvar = device_caps_list(d, NULL, SR_CONF_SAMPLERATE);
+	GVariant *rates = NULL;
+	uint64_t best = 0, lowest = UINT64_MAX;
+
+	if (gvar != NULL) {
+		GVariantDict *dict = g_variant_dict_new(gvar);
+		rates = g_variant_dict_lookup_value(dict, "samplerates",
+				G_VARIANT_TYPE("at"));
+		g_variant_dict_unref(dict);
+		g_variant_unref(gvar);
+	}
+	if (rates == NULL)
+		return rate < 1 ? 1 : (uint64_t) rate;
+
+	gsize n;
+	const guint64 *r = g_variant_get_fixed_array(rates, &n, sizeof(guint64));
+	for (gsize i = 0; i < n; i++) {
+		if (r[i] <= rate && r[i] > best)
+			best = r[i];
+		if (r[i] < lowest)
+			lowest = r[i];
+	}
+	g_variant_unref(rates);
+	if (best == 0)
+		best = lowest != UINT64_MAX ? lowest : s->sample_rate;
+	return best;
+}
+
+
+// Smallest listed volts/div whose range holds peak volts either side of
+// zero, the largest one if none does. FALSE if the group has no list.
+gboolean autoset_pick_vdiv(struct state *s, int g, double peak,
+		uint64_t vdiv[2]) {
+	struct device *d = s->chgroup_devices[g];
+	GVariant *vdivs = device_caps_list(d, s->chgroups[g], SR_CONF_VDIV);
+	double divs = s->num_vdivs != 0 ? s->num_vdivs : AUTOSET_DEFAULT_VDIVS;
+	double best = INFINITY, largest = 0;
+	uint64_t largest_vdiv[2] = { 0, 0 };
+
+	if (vdivs == NULL)
+		return FALSE;
+	if (!g_variant_is_of_type(vdivs, G_VARIANT_TYPE("a(tt)"))) {
+		g_variant_unref(vdivs);
+		return FALSE;
+	}
+	for (gsize i = 0; i < g_variant_n_children(vdivs); i++) {
+		guint64 p, q;
+		g_variant_get_child(vdivs, i, "(tt)", &p, &q);
+		if (q == 0)
+			continue;
+		double v = (double) p / q;
+		if (v * divs / 2 >= peak * AUTOSET_HEADROOM && v < best) {
+			best = v;
+			vdiv[0] = p;
+			vdiv[1] = q;
+		}
+		if (v > largest) {
+			largest = v;
+			largest_vdiv[0] = p;
+			largest_vdiv[1] = q;
+		}
+	}
+	g_variant_unref(vdivs);
+	if (largest == 0)
+		return FALSE;
+	if (isinf(best)) {
+		vdiv[0] = largest_vdiv[0];
+		vdiv[1] = largest_vdiv[1];
+	}
+	return TRUE;
+}
+
+
+int autoset_channel_group(struct state *s, int c) {
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		for (GSList *l = s->chgroups[g]->channels; l != NULL; l = l->next) {
+			if (l->data == s->channels[c])
+				return g;
+		}
+	}
+	return -1;
+}
+
+
+// Applies a step's settings in one batch, so the devices restart once, and
+// notes where their acquisitions stood: the step measures the first
+// acquisition that starts after this.
+void autoset_apply(struct state *s, uint64_t rate, uint64_t (*vdivs)[2]) {
+	struct autoset *a = &s->autoset;
+	gboolean running = s->running;
+
+	cmd_batch_begin(s);
+	cmd_set_samplerate(s, rate);
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		if (vdivs[g][1] != 0 && (vdivs[g][0] != s->volts_per_div[g][0]
+				|| vdivs[g][1] != s->volts_per_div[g][1]))
+			cmd_set_voltsperdiv(s, g, vdivs[g][0], vdivs[g][1]);
+	}
+	for (int i = 0; i < s->num_devices; i++) {
+		uint64_t written, oldest;
+		device_positions(s->devices[i], &written, &oldest,
+				&a->header_pos[i]);
+	}
+	cmd_batch_end(s);
+	if (!running)
+		cmd_set_running(s, TRUE);
+	a->step++;
+}
+
+
+// First step: free running, widest vertical range and a middle sample
+// rate, to see whatever is there.
+void autoset_start(struct state *s) {
+	struct autoset *a = &s->autoset;
+	uint64_t vdivs[s->num_channel_groups][2];
+
+	a->header_pos = notnull(realloc(a->header_pos,
+			s->num_devices * sizeof(*a->header_pos)));
+	a->measures = notnull(realloc(a->measures,
+			s->num_channels * sizeof(*a->measures)));
+	a->step = 0;
+	a->done = 0;
+
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		vdivs[g][0] = 0;
+		vdivs[g][1] = 0;
+		autoset_pick_vdiv(s, g, INFINITY, vdivs[g]);
+	}
+	cmd_set_triggermode(s, TRIGGER_NONE);
+	autoset_apply(s, autoset_pick_rate(s, AUTOSET_SEARCH_RATE), vdivs);
+}
+
+
+void autoset_finish(struct state *s, int c, uint64_t (*vdivs)[2]) {
+	struct autoset *a = &s->autoset;
+	struct autoset_measure *m = &a->measures[c];
+	int length = s->pretrigger + s->posttrigger;
+	uint64_t rate = s->sample_rate;
+
+	if (m->edges >= 2) {
+		double target = m->frequency * length / AUTOSET_PERIODS;
+		if (target < m->frequency * AUTOSET_MIN_SAMPLES_PER_PERIOD)
+			target = m->frequency * AUTOSET_MIN_SAMPLES_PER_PERIOD;
+		rate = autoset_pick_rate(s, target);
+	}
+
+	cmd_batch_begin(s);
+	cmd_set_samplerate(s, rate);
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		if (vdivs[g][1] != 0)
+			cmd_set_voltsperdiv(s, g, vdivs[g][0], vdivs[g][1]);
+	}
+	s->trigger_channel = c;
+	cmd_set_triggerlevel(s, m->mean);
+	cmd_set_triggermode(s, m->edges >= 2 ? TRIGGER_RISING : TRIGGER_NONE);
+	cmd_batch_end(s);
+	a->step = 0;
+	a->done = 1;
+	a->channel = c;
+	a->sample_rate = s->sample_rate;
+	a->result = *m;
+
+	// Runs from a capture update, with no client to answer: the result
+	// goes to stdout and stays for autoset stats
+	cmd_reply(s, "autoset channel %d frequency %g amplitude %g offset %g"
+			" samplerate %lu\n", c, m->frequency, m->max - m->min, m->mean,
+			s->sample_rate);
+}
+
+
+// Called on every capture update while autoset runs. Once every device
+// has a complete acquisition with the step's settings, the channels are
+// measured; the channel with the largest swing becomes the trigger source.
+// Another step follows if a range clipped or the period did not fit.
+void autoset_update(struct state *s) {
+	struct autoset *a = &s->autoset;
+	uint64_t length = s->samples_limit;
+	uint64_t start[s->num_devices];
+	sample_t *out[s->num_channels];
+
+	for (int i = 0; i < s->num_devices; i++) {
+		uint64_t written, oldest;
+		device_positions(s->devices[i], &written, &oldest, &start[i]);
+		if (start[i] == a->header_pos[i] || written < start[i] + length)
+			return;
+	}
+
+	a->samples = notnull(realloc(a->samples,
+			s->num_channels * length * sizeof(sample_t)));
+	for (int c = 0; c < s->num_channels; c++)
+		out[c] = a->samples + c * length;
+	for (int i = 0; i < s->num_devices; i++) {
+		struct device *d = s->devices[i];
+		device_copy(d, (int64_t) start[i], (int) length,
+				out + d->first_channel);
+	}
+
+	int trigger = 0;
+	for (int c = 0; c < s->num_channels; c++) {
+		struct autoset_measure *m = &a->measures[c];
+		autoset_measure(out[c], (int) length, s->sample_rate, m);
+		if (m->max - m->min > a->measures[trigger].max
+				- a->measures[trigger].min)
+			trigger = c;
+	}
+
+	// Vertical: clipped groups get at least twice the range, the others
+	// the smallest range that fits their peaks
+	uint64_t vdivs[s->num_channel_groups][2];
+	double divs = s->num_vdivs != 0 ? s->num_vdivs : AUTOSET_DEFAULT_VDIVS;
+	gboolean again = FALSE;
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		double current = s->volts_per_div[g][1] != 0
+				? (double) s->volts_per_div[g][0] / s->volts_per_div[g][1] : 0;
+		double peak = 0;
+		gboolean clipped = FALSE;
+		for (int c = 0; c < s->num_channels; c++) {
+			if (autoset_channel_group(s, c) != g)
+				continue;
+			struct autoset_measure *m = &a->measures[c];
+			double p = fmax(fabs(m->min), fabs(m->max));
+			peak = fmax(peak, p);
+			if (current > 0 && p >= current * divs / 2 * .98) {
+				clipped = TRUE;
+				peak = fmax(peak, current * divs / AUTOSET_HEADROOM);
+			}
+		}
+		vdivs[g][0] = 0;
+		vdivs[g][1] = 0;
+		if (!autoset_pick_vdiv(s, g, peak, vdivs[g]))
+			continue;
+		double picked = (double) vdivs[g][0] / vdivs[g][1];
+		if (clipped && picked > current * 1.01)
+			again = TRUE;
+		// A small signal seen on a much wider range is measured again
+		if (g == autoset_channel_group(s, trigger)
+				&& picked * AUTOSET_RATE_STEP < current)
+			again = TRUE;
+	}
+
+	// Horizontal: fewer than two periods or too few samples per period
+	// move the rate a large step and measure again. A swing under half a
+	// division is taken as no signal.
+	struct autoset_measure *m = &a->measures[trigger];
+	uint64_t rate = s->sample_rate;
+	if (m->max - m->min < channel_vdiv(s, trigger) / 2)
+		m->edges = 0;
+	else if (m->edges < 2)
+		rate = autoset_pick_rate(s, (double) s->sample_rate
+				/ AUTOSET_RATE_STEP);
+	else if (s->sample_rate < m->frequency * AUTOSET_MIN_SAMPLES_PER_PERIOD)
+		rate = autoset_pick_rate(s, (double) s->sample_rate
+				* AUTOSET_RATE_STEP);
+	if (rate != s->sample_rate)
+		again = TRUE;
+
+	if (again && a->step < AUTOSET_MAX_STEPS) {
+		autoset_apply(s, rate, vdivs);
+		return;
+	}
+	autoset_finish(s, trigger, vdivs);
+}
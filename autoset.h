@@ -0,0 +1,47 @@
+#ifndef AUTOSET_H
+#define AUTOSET_H
+
+#include <stdint.h>
+#include "gloscope.h"
+
+#define AUTOSET_MAX_STEPS 3
+#define AUTOSET_SEARCH_RATE 1000000
+#define AUTOSET_RATE_STEP 16
+#define AUTOSET_DEFAULT_VDIVS 8
+#define AUTOSET_HEADROOM 1.2
+#define AUTOSET_PERIODS 4
+#define AUTOSET_MIN_SAMPLES_PER_PERIOD 8
+
+struct state;
+
+// Amplitude, DC offset and fundamental frequency of one channel over one
+// acquisition; frequency is 0 with fewer than two rising edges.
+struct autoset_measure {
+	sample_t min;
+	sample_t max;
+	sample_t mean;
+	int edges;
+	double frequency;
+};
+
+// Automatic setup: each step reconfigures the devices, waits for one
+// complete acquisition started after that and measures it. Steps go on
+// while the vertical range clips or the signal period does not fit the
+// acquisition, up to AUTOSET_MAX_STEPS.
+struct autoset {
+	int step;
+	uint64_t *header_pos;
+	sample_t *samples;
+	struct autoset_measure *measures;
+	// Outcome of the last run, kept for autoset stats
+	int done;
+	int channel;
+	uint64_t sample_rate;
+	struct autoset_measure result;
+};
+
+void autoset_measure(const sample_t *, int, uint64_t, struct autoset_measure *);
+void autoset_start(struct state *);
+void autoset_update(struct state *);
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <string.h>
+#include "caps.h"
+
+
+void caps_init(struct caps *c) {
+	g_mutex_init(&c->lock);
+}
+
+
+void caps_load(struct caps *c) {
+	if (c->file != NULL)
+		return;
+	c->file = g_key_file_new();
+	c->path = g_build_filename(g_get_user_cache_dir(), CAPS_DIR, CAPS_FILE,
+			NULL);
+	// A missing or broken cache is simply refilled
+	g_key_file_load_from_file(c->file, c->path, G_KEY_FILE_NONE, NULL);
+}
+
+
+const char *str_or_empty(const char *str) {
+	return str != NULL ? str : "";
+}
+
+
+gchar *caps_group(struct sr_dev_driver *driver, struct sr_dev_inst *sdi) {
+	if (sdi == NULL)
+		return g_strdup(driver->name);
+	return g_strdup_printf("%s/%s/%s/%s", driver->name,
+			str_or_empty(sr_dev_inst_vendor_get(sdi)),
+			str_or_empty(sr_dev_inst_model_get(sdi)),
+			str_or_empty(sr_dev_inst_version_get(sdi)));
+}
+
+
+gchar *caps_key(struct sr_channel_group *chgroup, uint32_t option) {
+	return g_strdup_printf("%s/%u",
+			chgroup != NULL ? chgroup->name : "device", option);
+}
+
+
+// Cached list of the option, queried from the device (and cached) when
+// this model was never seen. NULL when the option has no list.
+GVariant *caps_list(struct caps *c, struct sr_dev_driver *driver,
+		struct sr_dev_inst *sdi, struct sr_channel_group *chgroup,
+		uint32_t option) {
+	GVariant *gvar = NULL;
+
+	g_mutex_lock(&c->lock);
+	caps_load(c);
+	gchar *group = caps_group(driver, sdi);
+	gchar *key = caps_key(chgroup, option);
+	gchar *value = g_key_file_get_string(c->file, group, key, NULL);
+	g_mutex_unlock(&c->lock);
+	g_free(group);
+	g_free(key);
+
+	if (value == NULL) {
+		if (sr_config_list(driver, sdi, chgroup, option, &gvar) != SR_OK)
+			gvar = NULL;
+		caps_store(c, driver, sdi, chgroup, option, gvar);
+		return gvar;
+	}
+
+	if (value[0] != 0)
+		gvar = g_variant_parse(NULL, value, NULL, NULL, NULL);
+	g_free(value);
+	return gvar;
+}
+
+
+void caps_store(struct caps *c, struct sr_dev_driver *driver,
+		struct sr_dev_inst *sdi, struct sr_channel_group *chgroup,
+		uint32_t option, GVariant *gvar) {
+	gchar *group = caps_group(driver, sdi);
+	gchar *key = caps_key(chgroup, option);
+	gchar *value = gvar != NULL ? g_variant_print(gvar, TRUE) : g_strdup("");
+
+	g_mutex_lock(&c->lock);
+	caps_load(c);
+	gchar *old = g_key_file_get_string(c->file, group, key, NULL);
+	if (old == NULL || strcmp(old, value) != 0) {
+		g_key_file_set_string(c->file, group, key, value);
+		c->dirty = TRUE;
+	}
+	g_mutex_unlock(&c->lock);
+	g_free(old);
+	g_free(value);
+	g_free(group);
+	g_free(key);
+}
+
+
+void caps_save(struct caps *c) {
+	GError *error = NULL;
+
+	g_mutex_lock(&c->lock);
+	if (c->file != NULL && c->dirty) {
+		gchar *dir = g_path_get_dirname(c->path);
+		g_mkdir_with_parents(dir, 0755);
+		g_free(dir);
+		if (g_key_file_save_to_file(c->file, c->path, &error)) {
+			c->dirty = FALSE;
+		} else {
+			fprintf(stderr, "Error saving %s: %s\n", c->path,
+					error->message);
+			g_error_free(error);
+		}
+	}
+	g_mutex_unlock(&c->lock);
+}
+
+
+void caps_free(struct caps *c) {
+	if (c->file != NULL)
+		g_key_file_free(c->file);
+	g_free(c->path);
+	c->file = NULL;
+	c->path = NULL;
+	g_mutex_clear(&c->lock);
+}
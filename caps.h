@@ -0,0 +1,32 @@
+#ifndef CAPS_H
+#define CAPS_H
+
+#include <glib.h>
+#include <libsigrok/libsigrok.h>
+
+#define CAPS_DIR "rokscope"
+#define CAPS_FILE "capabilities.ini"
+
+// Option lists (sr_config_list) of every device model seen, kept in the
+// user cache directory. A group per model, named after driver, vendor,
+// model and firmware version; a key per channel group and option, holding
+// the list in GVariant text form, empty when the option has no list.
+// The file is read on first use and written back by caps_save. The device
+// threads refresh it too, so every call takes lock.
+struct caps {
+	GMutex lock;
+	GKeyFile *file;
+	char *path;
+	gboolean dirty;
+};
+
+void caps_init(struct caps *);
+
+GVariant *caps_list(struct caps *, struct sr_dev_driver *,
+		struct sr_dev_inst *, struct sr_channel_group *, uint32_t);
+void caps_store(struct caps *, struct sr_dev_driver *, struct sr_dev_inst *,
+		struct sr_channel_group *, uint32_t, GVariant *);
+void caps_save(struct caps *);
+void caps_free(struct caps *);
+
+#endif
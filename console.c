@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <math.h>
 #include "rokscope.h"
 
 
@@ -5,49 +7,70 @@ gboolean save_running_state(struct state *s) {
 	gboolean running = s->running;
 	s->running = FALSE;
 	if (running) {
-		assert_sr(sr_session_stop(s->session), "stopping session");
-		assert_sr(sr_session_run(s->session), "running session");
+		for (int i = 0; i < s->num_devices; i++)
+			device_stop(s->devices[i]);
+	}
+	if (s->in_batch) {
+		s->batch_running |= running;
+		return FALSE;
 	}
 	return running;
 }
 
 
 void restore_running_state(struct state *s, gboolean running) {
+	if (s->in_batch)
+		return;
 	s->running = running;
-	if (running)
-		assert_sr(sr_session_start(s->session) , "starting session");
+	if (running) {
+		for (int i = 0; i < s->num_devices; i++)
+			device_start(s->devices[i]);
+	}
+}
+
+
+// Applies a device-wide setting to every device.
+void config_set_all(struct state *s, uint32_t key, GVariant *gvar,
+		const char *what) {
+	g_variant_ref_sink(gvar);
+	for (int i = 0; i < s->num_devices; i++)
+		device_config_set(s->devices[i], NULL, key, gvar, what);
+	g_variant_unref(gvar);
 }
 
 
 void cmd_set_samplerate(struct state *s, uint64_t samplerate) {
 	gboolean run = save_running_state(s);
 	GVariant *gvar = g_variant_new_uint64(samplerate);
-	int ret = sr_config_set(s->device, NULL, SR_CONF_SAMPLERATE, gvar);
-	assert_sr(ret, "setting samplerate");
+	config_set_all(s, SR_CONF_SAMPLERATE, gvar, "setting samplerate");
 	s->sample_rate = samplerate;
+	capture_reset(s);
+	ets_reset(&s->ets);
+	// Log rows are counted in samples
+	if (s->logger.active) {
+		fprintf(stderr, "Sample rate changed, log stopped\n");
+		logger_stop(&s->logger);
+	}
+	if (s->recorder.active) {
+		fprintf(stderr, "Sample rate changed, recording stopped\n");
+		recorder_stop(&s->recorder);
+	}
 	restore_running_state(s, run);
 }
 
 
 void cmd_set_sampleslimit(struct state *s, uint64_t sampleslimit) {
 	GVariant *gvar = g_variant_new_uint64(sampleslimit);
-	int ret = sr_config_set(s->device, NULL, SR_CONF_LIMIT_SAMPLES, gvar);
-	assert_sr(ret, "setting samples limit");
+	config_set_all(s, SR_CONF_LIMIT_SAMPLES, gvar, "setting samples limit");
 	s->samples_limit = sampleslimit;
-
-	for (int i = 0; i < s->num_channels; i++) {
-		if (s->buffers[i] != NULL)
-			free(s->buffers[i]);
-		s->buffers[i] = notnull(malloc(sampleslimit * sizeof(sample_t)));
-	}
+	capture_reset(s);
 }
 
 
 void cmd_set_vdivs(struct state *s, uint64_t num_vdivs) {
 	gboolean run = save_running_state(s);
 	GVariant *gvar = g_variant_new_uint64(num_vdivs);
-	int ret = sr_config_set(s->device, NULL, SR_CONF_NUM_VDIV, gvar);
-	assert_sr(ret, "setting vdivs count");
+	config_set_all(s, SR_CONF_NUM_VDIV, gvar, "setting vdivs count");
 	s->num_vdivs = num_vdivs;
 	restore_running_state(s, run);
 }
@@ -56,8 +79,8 @@ void cmd_set_vdivs(struct state *s, uint64_t num_vdivs) {
 void cmd_set_coupling(struct state *s, uint64_t chg, const char *coupling) {
 	gboolean run = save_running_state(s);
 	GVariant *gvar = g_variant_new_string(coupling);
-	int ret = sr_config_set(s->device, s->chgroups[chg], SR_CONF_NUM_VDIV, gvar);
-	assert_sr(ret, "setting vdivs count");
+	device_config_set(s->chgroup_devices[chg], s->chgroups[chg],
+			SR_CONF_NUM_VDIV, gvar, "setting vdivs count");
 	s->coupling = coupling;
 	restore_running_state(s, run);
 }
@@ -72,37 +95,496 @@ void cmd_set_voltsperdiv(struct state *s, uint64_t chg, uint64_t volts,
 	gvar_vals[1] = g_variant_new_uint64(div);
 	gvar = g_variant_new_tuple(gvar_vals, 2);
 	printf("%s\n", g_variant_print(gvar, TRUE));
-	int ret = sr_config_set(s->device, s->chgroups[chg], SR_CONF_VDIV, gvar);
-	assert_sr(ret, "setting volts/div");
-	s->volts_per_div[0] = volts;
-	s->volts_per_div[1] = div;
+	device_config_set(s->chgroup_devices[chg], s->chgroups[chg],
+			SR_CONF_VDIV, gvar, "setting volts/div");
+	s->volts_per_div[chg][0] = volts;
+	s->volts_per_div[chg][1] = div;
+	ets_reset(&s->ets);
 	restore_running_state(s, run);
 }
 
 
 void cmd_set_running(struct state *s, gboolean running) {
+	if (s->in_batch && s->batch_running) {
+		s->batch_running = running > 0;
+		return;
+	}
 	s->running = running > 0;
-	if (running) {
-		assert_sr( sr_session_start(s->session), "starting session");
-	} else {
-		assert_sr( sr_session_stop(s->session), "stopping session");
-		assert_sr( sr_session_run(s->session), "ending session");
+	for (int i = 0; i < s->num_devices; i++) {
+		if (running)
+			device_start(s->devices[i]);
+		else
+			device_stop(s->devices[i]);
 	}
 }
 
 
-void cmd_set_skip(struct state *s, int skip) {
-	s->skip = skip;
+// Commands received together share a single session restart: the first
+// command that needs one stops the session, the batch end restarts it.
+void cmd_batch_begin(struct state *s) {
+	s->in_batch = TRUE;
+	s->batch_running = FALSE;
+}
+
+
+void cmd_batch_end(struct state *s) {
+	s->in_batch = FALSE;
+	if (s->batch_running)
+		restore_running_state(s, TRUE);
+}
+
+
+void cmd_set_pretrigger(struct state *s, int pretrigger) {
+	s->pretrigger = pretrigger;
+	capture_reset(s);
+}
+
+
+void cmd_set_posttrigger(struct state *s, int posttrigger) {
+	s->posttrigger = posttrigger;
+	capture_reset(s);
+}
+
+
+// Sinc interpolation only changes how sparse plots are drawn.
+void cmd_set_interpolation(struct state *s, gboolean sinc) {
+	s->sinc = sinc;
 }
 
 
 void cmd_set_triggermode(struct state *s, int mode) {
 	s->trigger_mode = mode;
+	ets_reset(&s->ets);
 }
 
 
 void cmd_set_triggerlevel(struct state *s, sample_t level) {
 	s->trigger_level = level;
+	ets_reset(&s->ets);
+}
+
+
+void cmd_set_ets(struct state *s, int factor) {
+	ets_set_factor(&s->ets, factor);
+}
+
+
+// Output of query commands, sent back to the control client that issued
+// the command or printed when it came from stdin.
+void cmd_reply(struct state *s, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	if (s->reply != NULL) {
+		gchar *str = g_strdup_vprintf(fmt, args);
+		g_string_append(s->reply, str);
+		g_free(str);
+	} else {
+		vprintf(fmt, args);
+	}
+	va_end(args);
+}
+
+
+gboolean cmd_mask_load(struct state *s, int channel, const char *path) {
+	if (!mask_load(&s->mask, s->num_channels, channel, path))
+		return FALSE;
+	s->mask.enabled = 1;
+	return TRUE;
+}
+
+
+void cmd_mask_golden(struct state *s, int channel, sample_t tolerance) {
+	s->mask.channel = channel;
+	s->mask_golden_tolerance = tolerance;
+	s->mask_golden_pending = 1;
+}
+
+
+void cmd_mask_enable(struct state *s, gboolean enabled) {
+	s->mask.enabled = enabled && s->mask.num_samples > 0;
+}
+
+
+void cmd_mask_reset(struct state *s) {
+	mask_reset(&s->mask);
+}
+
+
+void cmd_mask_stats(struct state *s) {
+	struct mask *m = &s->mask;
+	cmd_reply(s, "mask %s channel %d samples %d tested %lu failed %lu"
+			" violations %lu\n", m->enabled ? "on" : "off", m->channel,
+			m->num_samples, m->tested, m->failed, m->violations);
+}
+
+
+gboolean cmd_mask_save(struct state *s, int idx, const char *path) {
+	return mask_save_segment(&s->mask, idx, path);
+}
+
+
+void cmd_eye_start(struct state *s, int channel, double bitrate,
+		sample_t threshold) {
+	spectrogram_stop(&s->spectrogram);
+	eye_start(&s->eye, channel, s->sample_rate / bitrate, threshold);
+	s->eye_pos = capture_stream_start(s, channel);
+}
+
+
+void cmd_eye_stop(struct state *s) {
+	eye_stop(&s->eye);
+}
+
+
+void cmd_eye_reset(struct state *s) {
+	if (s->eye.active)
+		eye_reset(&s->eye);
+}
+
+
+void cmd_eye_stats(struct state *s) {
+	double height, width;
+	if (!s->eye.active) {
+		cmd_reply(s, "eye off\n");
+		return;
+	}
+	eye_measure(&s->eye, &height, &width);
+	cmd_reply(s, "eye channel %d samples %lu edges %lu height %g width %g\n",
+			s->eye.channel, s->eye.samples, s->eye.edges, height, width);
+}
+
+
+void cmd_spectrogram_start(struct state *s, int channel) {
+	eye_stop(&s->eye);
+	spectrogram_start(&s->spectrogram, channel);
+	s->spectrogram_pos = capture_stream_start(s, channel);
+}
+
+
+void cmd_spectrogram_stop(struct state *s) {
+	spectrogram_stop(&s->spectrogram);
+}
+
+
+// Starts logging every channel, one row per interval of the given length.
+gboolean cmd_log_start(struct state *s, double interval, const char *path) {
+	uint64_t samples = (uint64_t) llround(interval * s->sample_rate);
+	if (samples == 0)
+		samples = 1;
+	logger_stop(&s->logger);
+	if (!logger_start(&s->logger, path, s->num_channels, samples,
+			s->sample_rate))
+		return FALSE;
+	// Rows pair up the channels, so they all start together
+	for (int c = 0; c < s->num_channels; c++)
+		s->log_pos[c] = capture_device_start(s, c);
+	return TRUE;
+}
+
+
+void cmd_log_stop(struct state *s) {
+	logger_stop(&s->logger);
+}
+
+
+void cmd_log_stats(struct state *s) {
+	struct logger *l = &s->logger;
+	if (!l->active) {
+		cmd_reply(s, "log off\n");
+		return;
+	}
+	g_mutex_lock(&l->lock);
+	cmd_reply(s, "log interval %lu samples %lu rows %lu bytes %lu\n",
+			l->interval, l->samples, l->rows, l->bytes);
+	g_mutex_unlock(&l->lock);
+}
+
+
+// Records every channel losslessly at the given resolution: samples are
+// stored as multiples of 1/2^bits of the channel's full scale.
+gboolean cmd_record_start(struct state *s, const char *path, int bits) {
+	float divs = s->num_vdivs ? (float) s->num_vdivs : 10;
+	float *steps = notnull(malloc(s->num_channels * sizeof(float)));
+	for (int c = 0; c < s->num_channels; c++) {
+		float vdiv = channel_vdiv(s, c);
+		steps[c] = (vdiv > 0 ? divs * vdiv : 1) / (float) (1 << bits);
+	}
+	recorder_stop(&s->recorder);
+	gboolean ok = recorder_start(&s->recorder, path, s->num_channels, steps,
+			s->sample_rate);
+	if (ok) {
+		for (int c = 0; c < s->num_channels; c++)
+			s->rec_pos[c] = capture_device_start(s, c);
+	}
+	free(steps);
+	return ok;
+}
+
+
+void cmd_record_stop(struct state *s) {
+	recorder_stop(&s->recorder);
+}
+
+
+void cmd_record_stats(struct state *s) {
+	struct recorder *r = &s->recorder;
+	if (!r->active) {
+		cmd_reply(s, "record off\n");
+		return;
+	}
+	g_mutex_lock(&r->lock);
+	double ratio = r->bytes ? (double) r->samples * sizeof(float) / r->bytes : 0;
+	double rate = r->encode_seconds > 0
+			? r->samples / r->encode_seconds / 1e6 : 0;
+	cmd_reply(s, "record samples %lu bytes %lu ratio %.2f dropped %lu "
+			"encode %.1f MS/s\n", r->samples, r->bytes, ratio, r->dropped,
+			rate);
+	g_mutex_unlock(&r->lock);
+}
+
+
+void cmd_autoset(struct state *s) {
+	autoset_start(s);
+}
+
+
+void cmd_autoset_stats(struct state *s) {
+	struct autoset *a = &s->autoset;
+	struct autoset_measure *m = &a->result;
+	if (a->step > 0) {
+		cmd_reply(s, "autoset step %d\n", a->step);
+		return;
+	}
+	if (!a->done) {
+		cmd_reply(s, "autoset none\n");
+		return;
+	}
+	cmd_reply(s, "autoset channel %d frequency %g amplitude %g offset %g"
+			" samplerate %lu\n", a->channel, m->frequency, m->max - m->min,
+			m->mean, a->sample_rate);
+}
+
+
+void cmd_counter_start(struct state *s, int channel, double gate,
+		sample_t level, sample_t hysteresis) {
+	counter_start(&s->counter, channel, level, hysteresis, gate,
+			s->sample_rate);
+}
+
+
+void cmd_counter_stop(struct state *s) {
+	counter_stop(&s->counter);
+}
+
+
+void cmd_counter_stats(struct state *s) {
+	struct counter_result r;
+	if (!s->counter.active) {
+		cmd_reply(s, "counter off\n");
+		return;
+	}
+	int gates = counter_get(&s->counter, &r);
+	cmd_reply(s, "counter channel %d gates %d periods %lu frequency %.12g"
+			" period %.12g jitter min %.6g max %.6g stddev %.6g\n",
+			s->counter.channel, gates, r.periods, r.frequency, r.period,
+			r.jitter_min, r.jitter_max, r.jitter_stddev);
+}
+
+
+void cmd_xcorr_start(struct state *s, int channel_a, int channel_b) {
+	xcorr_start(&s->xcorr, channel_a, channel_b);
+}
+
+
+void cmd_xcorr_stop(struct state *s) {
+	xcorr_stop(&s->xcorr);
+}
+
+
+void cmd_xcorr_stats(struct state *s) {
+	struct xcorr *x = &s->xcorr;
+	if (!x->active) {
+		cmd_reply(s, "xcorr off\n");
+		return;
+	}
+	g_mutex_lock(&x->lock);
+	cmd_reply(s, "xcorr channels %d %d frames %lu dropped %lu delay %.9g"
+			" phase %g frequency %g coherence %g correlation %g\n",
+			x->channel_a, x->channel_b, x->frames, x->dropped, x->delay,
+			x->phase, x->frequency, x->coherence, x->correlation);
+	g_mutex_unlock(&x->lock);
+}
+
+
+// The inputs must all come from one device, so that their samples line
+// up without resampling.
+gboolean cmd_decode_start(struct state *s, const char *decoder, float level,
+		float hysteresis, char **args, int nargs) {
+	struct decode *dc = &s->decode;
+	if (!decode_start(dc, decoder, level, hysteresis, args, nargs,
+			s->num_channels))
+		return FALSE;
+
+	struct device *d = channel_device(s, dc->inputs[0]);
+	dc->pos = UINT64_MAX;
+	for (int i = 0; i < dc->num_inputs; i++) {
+		if (channel_device(s, dc->inputs[i]) != d) {
+			fprintf(stderr, "decode: channels %d and %d are on different"
+					" devices\n", dc->inputs[0], dc->inputs[i]);
+			decode_stop(dc);
+			return FALSE;
+		}
+		uint64_t pos = capture_stream_start(s, dc->inputs[i]);
+		dc->pos = pos < dc->pos ? pos : dc->pos;
+	}
+	return TRUE;
+}
+
+
+void cmd_decode_stop(struct state *s) {
+	decode_stop(&s->decode);
+	if (s->decode_overlay != NULL)
+		gtk_widget_queue_draw(s->decode_overlay);
+}
+
+
+void cmd_decode_stats(struct state *s) {
+	struct decode *dc = &s->decode;
+	if (!dc->active) {
+		cmd_reply(s, "decode off\n");
+		return;
+	}
+	int queued = g_async_queue_length(dc->queue);
+	g_mutex_lock(&dc->lock);
+	uint64_t lag = dc->queued_end > dc->decoded_end
+			? dc->queued_end - dc->decoded_end : 0;
+	cmd_reply(s, "decode %s decoded %lu lag %lu samples %g s queue %d"
+			" dropped %lu restarts %lu errors %lu annotations %lu\n",
+			dc->decoder, dc->decoded_end, lag,
+			s->sample_rate ? (double) lag / s->sample_rate : 0., queued,
+			dc->dropped, dc->restarts, dc->errors, dc->num_annotations);
+	g_mutex_unlock(&dc->lock);
+}
+
+
+// Persistence is the time in seconds for a trace to fade to 1/e, 0 to
+// show only the latest frame.
+void cmd_xy_start(struct state *s, int channel_x, int channel_y,
+		double persistence) {
+	if (s->xy == NULL)
+		s->xy = gloscope_xy_alloc();
+	s->xy->persistence = (float) persistence;
+	s->xy->color.a = persistence > 0 ? .25f : 1.f;
+	s->xy->count = 0;
+	s->xy->num_segments = 0;
+	s->xy_channel_x = channel_x;
+	s->xy_channel_y = channel_y;
+	s->xy_active = TRUE;
+}
+
+
+void cmd_xy_stop(struct state *s) {
+	s->xy_active = FALSE;
+}
+
+
+// Starts over from empty bins; the counts buffer follows the bin count.
+void cmd_histogram_start(struct state *s, int bins) {
+	if (s->histogram == NULL)
+		s->histogram = gloscope_histogram_alloc(bins);
+	s->histogram->bins = bins;
+	s->histogram->clear = 1;
+	s->histogram_active = TRUE;
+}
+
+
+void cmd_histogram_stop(struct state *s) {
+	s->histogram_active = FALSE;
+}
+
+
+void cmd_histogram_clear(struct state *s) {
+	if (s->histogram != NULL)
+		s->histogram->clear = 1;
+}
+
+
+// Shows frame samples from start to before stop in a second view below
+// the plots.
+void cmd_zoom_start(struct state *s, int start, int stop) {
+	if (s->zoom == NULL)
+		s->zoom = gloscope_zoom_alloc(start, stop);
+	s->zoom->start = start;
+	s->zoom->stop = stop;
+	s->zoom_active = TRUE;
+	for (int i = 0; i < REF_SLOTS; i++)
+		s->refs[i].plot_stale = 1;
+}
+
+
+void cmd_zoom_stop(struct state *s) {
+	s->zoom_active = FALSE;
+	for (int i = 0; i < REF_SLOTS; i++)
+		s->refs[i].plot_stale = 1;
+}
+
+
+// Takes the last frame of channel as reference slot, and stores it in
+// path, or in the default file of the slot.
+gboolean cmd_ref_save(struct state *s, int slot, int channel,
+		const char *path) {
+	if (s->frame_count == 0 || s->pending_length < 2) {
+		fprintf(stderr, "ref: no frame of channel %d yet\n", channel);
+		return FALSE;
+	}
+	struct ref *r = &s->refs[slot];
+	ref_set(r, channel, s->frame[channel], s->pending_length, s->sample_rate);
+	gchar *default_path = ref_path(slot);
+	int ok = ref_save(r, path != NULL ? path : default_path);
+	g_free(default_path);
+	return ok;
+}
+
+
+// The reference goes back on the channel it was taken from; the slot is
+// left empty if that fails.
+gboolean cmd_ref_load(struct state *s, int slot, const char *path) {
+	struct ref *r = &s->refs[slot];
+	gchar *default_path = ref_path(slot);
+	int ok = ref_load(r, path != NULL ? path : default_path,
+			s->num_channels);
+	g_free(default_path);
+	if (!ok) {
+		ref_clear(r);
+		return FALSE;
+	}
+	if (r->sample_rate != s->sample_rate)
+		fprintf(stderr, "ref: reference %d was taken at %lu Sa/s\n", slot,
+				r->sample_rate);
+	return TRUE;
+}
+
+
+void cmd_ref_clear(struct state *s, int slot) {
+	ref_clear(&s->refs[slot]);
+}
+
+
+void cmd_ref_stats(struct state *s) {
+	int any = 0;
+	for (int i = 0; i < REF_SLOTS; i++) {
+		struct ref *r = &s->refs[i];
+		if (!r->active)
+			continue;
+		cmd_reply(s, "ref %d channel %d samples %d frames %lu rms %g"
+				" deviation %g correlation %g worst rms %g deviation %g"
+				" correlation %g\n", i, r->channel, r->num_samples,
+				r->frames, r->rms, r->max_deviation, r->correlation,
+				r->worst_rms, r->worst_deviation, r->worst_correlation);
+		any = 1;
+	}
+	if (!any)
+		cmd_reply(s, "ref off\n");
 }
 
 
@@ -212,10 +694,38 @@ gboolean execute_command(struct state *s, GArray* words) {
 			}
 		}
 
-		if (garray_streq("skip", words, 1)) {
+		if (garray_streq("ets", words, 1)) {
 			uint64_t arg;
 			if (garray_str_to_uint(words, 2, &arg)) {
-				cmd_set_skip(s, (int) arg);
+				cmd_set_ets(s, (int) arg);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("interpolation", words, 1)) {
+			if (garray_streq("sinc", words, 2)) {
+				cmd_set_interpolation(s, TRUE);
+				return TRUE;
+			}
+			if (garray_streq("linear", words, 2)) {
+				cmd_set_interpolation(s, FALSE);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("pretrigger", words, 1)) {
+			uint64_t arg;
+			if (garray_str_to_uint(words, 2, &arg) && arg <= INT_MAX / 8) {
+				cmd_set_pretrigger(s, (int) arg);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("posttrigger", words, 1)) {
+			uint64_t arg;
+			if (garray_str_to_uint(words, 2, &arg) && arg > 0
+					&& arg <= INT_MAX / 8) {
+				cmd_set_posttrigger(s, (int) arg);
 				return TRUE;
 			}
 		}
@@ -230,7 +740,8 @@ gboolean execute_command(struct state *s, GArray* words) {
 
 		if (garray_streq("coupling", words, 1)) {
 			uint64_t chg;
-			if (garray_str_to_uint(words, 2, &chg)) {
+			if (garray_str_to_uint(words, 2, &chg)
+					&& chg < (uint64_t) s->num_channel_groups) {
 				if (garray_streq("DC", words, 3)) {
 					cmd_set_coupling(s, chg, "DC");
 					return TRUE;
@@ -244,7 +755,8 @@ gboolean execute_command(struct state *s, GArray* words) {
 
 		if (garray_streq("voltsperdiv", words, 1)) {
 			uint64_t chg, arg3, arg4;
-			if (garray_str_to_uint(words, 2, &chg)) {
+			if (garray_str_to_uint(words, 2, &chg)
+					&& chg < (uint64_t) s->num_channel_groups) {
 				if (garray_str_to_uint(words, 3, &arg3)) {
 					if (garray_str_to_uint(words, 4, &arg4)) {
 						cmd_set_voltsperdiv(s, chg, arg3, arg4);
@@ -255,12 +767,340 @@ gboolean execute_command(struct state *s, GArray* words) {
 		}
 	}
 
+	if (garray_streq("mask", words, 0)) {
+		uint64_t arg;
+		double tol;
+
+		if (garray_streq("load", words, 1)) {
+			char *path = garray_getstr(words, 3);
+			if (garray_str_to_uint(words, 2, &arg) && path[0] != 0
+					&& arg < (uint64_t) s->num_channels) {
+				return cmd_mask_load(s, (int) arg, path);
+			}
+		}
+
+		if (garray_streq("golden", words, 1)) {
+			if (garray_str_to_uint(words, 2, &arg)
+					&& garray_str_to_float(words, 3, &tol)
+					&& arg < (uint64_t) s->num_channels) {
+				cmd_mask_golden(s, (int) arg, (sample_t) tol);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("enable", words, 1)) {
+			if (garray_str_to_uint(words, 2, &arg)) {
+				cmd_mask_enable(s, (gboolean) arg);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("reset", words, 1)) {
+			cmd_mask_reset(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_mask_stats(s);
+			return TRUE;
+		}
+
+		if (garray_streq("save", words, 1)) {
+			char *path = garray_getstr(words, 3);
+			if (garray_str_to_uint(words, 2, &arg) && path[0] != 0) {
+				return cmd_mask_save(s, (int) arg, path);
+			}
+		}
+	}
+
+	if (garray_streq("eye", words, 0)) {
+		uint64_t chan;
+		double bitrate, threshold;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &chan)
+					&& garray_str_to_float(words, 3, &bitrate)
+					&& chan < (uint64_t) s->num_channels && bitrate > 0
+					&& bitrate * 2 <= s->sample_rate) {
+				if (!garray_str_to_float(words, 4, &threshold))
+					threshold = NAN;
+				cmd_eye_start(s, (int) chan, bitrate, (sample_t) threshold);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_eye_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("reset", words, 1)) {
+			cmd_eye_reset(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_eye_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("spectrogram", words, 0)) {
+		uint64_t chan;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &chan)
+					&& chan < (uint64_t) s->num_channels) {
+				cmd_spectrogram_start(s, (int) chan);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_spectrogram_stop(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("autoset", words, 0)) {
+		if (garray_streq("stats", words, 1))
+			cmd_autoset_stats(s);
+		else
+			cmd_autoset(s);
+		return TRUE;
+	}
+
+	if (garray_streq("counter", words, 0)) {
+		uint64_t chan;
+		double gate, level, hysteresis;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &chan)
+					&& chan < (uint64_t) s->num_channels) {
+				if (!garray_str_to_float(words, 3, &gate) || gate <= 0)
+					gate = COUNTER_DEFAULT_GATE;
+				if (!garray_str_to_float(words, 4, &level))
+					level = s->trigger_level;
+				if (!garray_str_to_float(words, 5, &hysteresis))
+					hysteresis = COUNTER_DEFAULT_HYSTERESIS;
+				cmd_counter_start(s, (int) chan, gate, (sample_t) level,
+						(sample_t) hysteresis);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_counter_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_counter_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("xcorr", words, 0)) {
+		uint64_t a, b;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &a)
+					&& garray_str_to_uint(words, 3, &b)
+					&& a < (uint64_t) s->num_channels
+					&& b < (uint64_t) s->num_channels) {
+				cmd_xcorr_start(s, (int) a, (int) b);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_xcorr_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_xcorr_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("xy", words, 0)) {
+		uint64_t x, y;
+		double persistence;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &x)
+					&& garray_str_to_uint(words, 3, &y)
+					&& x < (uint64_t) s->num_channels
+					&& y < (uint64_t) s->num_channels) {
+				if (!garray_str_to_float(words, 4, &persistence)
+						|| persistence < 0)
+					persistence = 0;
+				cmd_xy_start(s, (int) x, (int) y, persistence);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_xy_stop(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("decode", words, 0)) {
+		double level, hysteresis;
+
+		if (garray_streq("start", words, 1)) {
+			if (words->len > 5
+					&& garray_str_to_float(words, 3, &level)
+					&& garray_str_to_float(words, 4, &hysteresis)
+					&& hysteresis >= 0) {
+				return cmd_decode_start(s, garray_getstr(words, 2),
+						(float) level, (float) hysteresis,
+						&g_array_index(words, char *, 5),
+						(int) words->len - 5);
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_decode_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_decode_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("histogram", words, 0)) {
+		uint64_t bins;
+
+		if (garray_streq("start", words, 1)) {
+			if (!garray_str_to_uint(words, 2, &bins))
+				bins = 256;
+			if (bins >= 2 && bins <= GLOSCOPE_HISTOGRAM_MAX_BINS) {
+				cmd_histogram_start(s, (int) bins);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_histogram_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("clear", words, 1)) {
+			cmd_histogram_clear(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("zoom", words, 0)) {
+		uint64_t start, stop;
+
+		if (garray_streq("start", words, 1)) {
+			if (garray_str_to_uint(words, 2, &start)
+					&& garray_str_to_uint(words, 3, &stop)
+					&& stop >= start + 2 && stop <= INT_MAX) {
+				cmd_zoom_start(s, (int) start, (int) stop);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_zoom_stop(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("ref", words, 0)) {
+		uint64_t slot, channel;
+		int has_slot = garray_str_to_uint(words, 2, &slot)
+				&& slot < REF_SLOTS;
+
+		if (garray_streq("save", words, 1)) {
+			if (has_slot && garray_str_to_uint(words, 3, &channel)
+					&& channel < (uint64_t) s->num_channels
+					&& words->len <= 5) {
+				char *path = garray_getstr(words, 4);
+				return cmd_ref_save(s, (int) slot, (int) channel,
+						path[0] != 0 ? path : NULL);
+			}
+		}
+
+		if (garray_streq("load", words, 1)) {
+			if (has_slot && words->len <= 4) {
+				char *path = garray_getstr(words, 3);
+				return cmd_ref_load(s, (int) slot,
+						path[0] != 0 ? path : NULL);
+			}
+		}
+
+		if (garray_streq("clear", words, 1)) {
+			if (has_slot) {
+				cmd_ref_clear(s, (int) slot);
+				return TRUE;
+			}
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_ref_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("log", words, 0)) {
+		double interval;
+
+		if (garray_streq("start", words, 1)) {
+			char *path = garray_getstr(words, 3);
+			if (garray_str_to_float(words, 2, &interval) && interval > 0
+					&& path[0] != 0) {
+				return cmd_log_start(s, interval, path);
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_log_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_log_stats(s);
+			return TRUE;
+		}
+	}
+
+	if (garray_streq("record", words, 0)) {
+		uint64_t bits;
+
+		if (garray_streq("start", words, 1)) {
+			char *path = garray_getstr(words, 2);
+			if (!garray_str_to_uint(words, 3, &bits))
+				bits = REC_DEFAULT_BITS;
+			if (path[0] != 0 && bits >= 1 && bits <= 24) {
+				return cmd_record_start(s, path, (int) bits);
+			}
+		}
+
+		if (garray_streq("stop", words, 1)) {
+			cmd_record_stop(s);
+			return TRUE;
+		}
+
+		if (garray_streq("stats", words, 1)) {
+			cmd_record_stats(s);
+			return TRUE;
+		}
+	}
+
 	fprintf(stderr, "Command not valid\n");
 	return FALSE;
 }
 
 
-void parse_command(struct state *s, char *cmd) {
+gboolean parse_command(struct state *s, char *cmd) {
 	char *word_start = cmd;
 	GArray *words = g_array_new(TRUE, TRUE, sizeof(char *));
 	g_array_append_val(words, word_start);
@@ -273,8 +1113,112 @@ void parse_command(struct state *s, char *cmd) {
 		}
 	}
 
-	execute_command(s, words);
+	gboolean ok = execute_command(s, words);
 	g_array_free(words, TRUE);
+	return ok;
+}
+
+
+gboolean execute_frame(struct state *s, const struct command_frame *f) {
+	switch (f->opcode) {
+		case COMMAND_OP_SAMPLERATE:
+			cmd_set_samplerate(s, f->arg.u);
+			return TRUE;
+		case COMMAND_OP_SAMPLESLIMIT:
+			cmd_set_sampleslimit(s, f->arg.u);
+			return TRUE;
+		case COMMAND_OP_RUNNING:
+			cmd_set_running(s, (gboolean) f->arg.u);
+			return TRUE;
+		case COMMAND_OP_TRIGGERMODE:
+			cmd_set_triggermode(s, (int) f->arg.u);
+			return TRUE;
+		case COMMAND_OP_TRIGGERLEVEL:
+			cmd_set_triggerlevel(s, (sample_t) f->arg.f);
+			return TRUE;
+		case COMMAND_OP_PRETRIGGER:
+			if (f->arg.u > INT_MAX / 8)
+				break;
+			cmd_set_pretrigger(s, (int) f->arg.u);
+			return TRUE;
+		case COMMAND_OP_POSTTRIGGER:
+			if (f->arg.u == 0 || f->arg.u > INT_MAX / 8)
+				break;
+			cmd_set_posttrigger(s, (int) f->arg.u);
+			return TRUE;
+		case COMMAND_OP_VDIVS:
+			cmd_set_vdivs(s, f->arg.u);
+			return TRUE;
+		case COMMAND_OP_VOLTSPERDIV:
+			if (f->channel >= (uint32_t) s->num_channel_groups)
+				break;
+			cmd_set_voltsperdiv(s, f->channel, f->arg.u, f->arg2);
+			return TRUE;
+		case COMMAND_OP_COUPLING:
+			if (f->channel >= (uint32_t) s->num_channel_groups)
+				break;
+			cmd_set_coupling(s, f->channel, f->arg.u ? "AC" : "DC");
+			return TRUE;
+	}
+
+	fprintf(stderr, "Frame not valid\n");
+	return FALSE;
+}
+
+
+// Executes every complete text line and binary frame in data, appending
+// one reply per command to reply (if not NULL). Returns the number of bytes
+// consumed; an incomplete trailing command is left for the next call.
+size_t process_commands(struct state *s, const guint8 *data, size_t len,
+		GString *reply) {
+	size_t pos = 0;
+
+	s->reply = reply;
+	cmd_batch_begin(s);
+	while (pos < len) {
+		if (data[pos] == COMMAND_FRAME_MAGIC) {
+			struct command_frame frame;
+			if (len - pos < sizeof(frame))
+				break;
+			memcpy(&frame, data + pos, sizeof(frame));
+			pos += sizeof(frame);
+
+			gboolean ok = execute_frame(s, &frame);
+			if (reply != NULL) {
+				struct command_reply r;
+				r.magic = COMMAND_FRAME_MAGIC;
+				r.opcode = frame.opcode;
+				r.tag = frame.tag;
+				r.status = ok ? 0 : -1;
+				g_string_append_len(reply, (const gchar *) &r, sizeof(r));
+			}
+			continue;
+		}
+
+		const guint8 *end = memchr(data + pos, '\n', len - pos);
+		if (end == NULL)
+			break;
+		size_t line_len = end - (data + pos);
+		char *line = notnull(malloc(line_len + 1));
+		memcpy(line, data + pos, line_len);
+		line[line_len] = 0;
+		if (line_len > 0 && line[line_len - 1] == '\r')
+			line[line_len - 1] = 0;
+		pos += line_len + 1;
+
+		if (line[0] == 0) {
+			free(line);
+			continue;
+		}
+		gboolean ok = parse_command(s, line);
+		free(line);
+		if (reply != NULL)
+			g_string_append(reply, ok ? "ok\n" : "error: command not valid\n");
+	}
+
+	cmd_batch_end(s);
+	s->reply = NULL;
+	return pos;
 }
 
 
@@ -0,0 +1,145 @@
+#include "rokscope.h"
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+
+struct control_client {
+	struct state *s;
+	GSocketConnection *connection;
+	GInputStream *input;
+	GOutputStream *output;
+	GByteArray *pending;
+	GString *replies;
+	GString *sending;
+	char buff[CONTROL_BUFF_SIZE];
+};
+
+
+void control_client_free(struct control_client *c) {
+	g_object_unref(c->connection);
+	g_byte_array_free(c->pending, TRUE);
+	g_string_free(c->replies, TRUE);
+	if (c->sending != NULL)
+		g_string_free(c->sending, TRUE);
+	free(c);
+}
+
+
+void control_flush(struct control_client *c);
+
+
+void on_control_written(GObject *src, GAsyncResult *res, void *data) {
+	struct control_client *c = data;
+	GError *error = NULL;
+
+	g_string_free(c->sending, TRUE);
+	c->sending = NULL;
+
+	if (!g_output_stream_write_all_finish((GOutputStream *) src, res, NULL,
+			&error)) {
+		fprintf(stderr, "Error writing to control client: %s\n",
+				error->message);
+		g_error_free(error);
+		if (c->input == NULL)
+			control_client_free(c);
+		return;
+	}
+
+	if (c->input == NULL && c->replies->len == 0) {
+		control_client_free(c);
+		return;
+	}
+	control_flush(c);
+}
+
+
+// Replies are queued while a write is in flight and sent as one chunk
+// when it completes, so a slow client never blocks command execution.
+void control_flush(struct control_client *c) {
+	if (c->sending != NULL || c->replies->len == 0)
+		return;
+
+	c->sending = c->replies;
+	c->replies = g_string_sized_new(CONTROL_BUFF_SIZE);
+	g_output_stream_write_all_async(c->output, c->sending->str,
+			c->sending->len, G_PRIORITY_DEFAULT, NULL, on_control_written, c);
+}
+
+
+void on_control_read(GObject *src, GAsyncResult *res, void *data) {
+	struct control_client *c = data;
+	GInputStream *input = (GInputStream *) src;
+	GError *error = NULL;
+	gssize bytes_read;
+
+	bytes_read = g_input_stream_read_finish(input, res, &error);
+	if (bytes_read <= 0) {
+		if (bytes_read < 0) {
+			fprintf(stderr, "Error reading from control client: %s\n",
+					error->message);
+			g_error_free(error);
+		}
+		c->input = NULL;
+		if (c->sending == NULL)
+			control_client_free(c);
+		return;
+	}
+
+	g_byte_array_append(c->pending, (guint8 *) c->buff, (guint) bytes_read);
+	size_t used = process_commands(c->s, c->pending->data, c->pending->len,
+			c->replies);
+	g_byte_array_remove_range(c->pending, 0, (guint) used);
+	control_flush(c);
+
+	g_input_stream_read_async(input, c->buff, CONTROL_BUFF_SIZE,
+			G_PRIORITY_DEFAULT, NULL, on_control_read, c);
+}
+
+
+gboolean on_control_incoming(GSocketService *service,
+		GSocketConnection *connection, GObject *source, gpointer data) {
+	UNUSED(service);
+	UNUSED(source);
+	struct control_client *c = zalloc(sizeof(*c));
+	c->s = data;
+	c->connection = g_object_ref(connection);
+	c->input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+	c->output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	c->pending = g_byte_array_new();
+	c->replies = g_string_sized_new(CONTROL_BUFF_SIZE);
+
+	g_input_stream_read_async(c->input, c->buff, CONTROL_BUFF_SIZE,
+			G_PRIORITY_DEFAULT, NULL, on_control_read, c);
+	return TRUE;
+}
+
+
+void control_listen(struct state *s, const char *path) {
+	GError *error = NULL;
+	GSocketAddress *address;
+
+	g_unlink(path);
+	address = g_unix_socket_address_new(path);
+	s->control = g_socket_service_new();
+	if (!g_socket_listener_add_address(G_SOCKET_LISTENER(s->control), address,
+			G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL,
+			&error)) {
+		fprintf(stderr, "Error listening on %s: %s\n", path, error->message);
+		exit(1);
+	}
+	g_object_unref(address);
+
+	g_signal_connect(s->control, "incoming",
+			G_CALLBACK(on_control_incoming), s);
+	g_socket_service_start(s->control);
+	printf("Control socket listening on %s\n", path);
+}
+
+
+void control_close(struct state *s) {
+	if (s->control == NULL)
+		return;
+	g_socket_service_stop(s->control);
+	g_object_unref(s->control);
+	s->control = NULL;
+}
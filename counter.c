@@ -0,0 +1,144 @@
+#include <math.h>
+#include <string.h>
+#include "counter.h"
+
+
+void counter_init(struct counter *c) {
+	memset(c, 0, sizeof(*c));
+	g_mutex_init(&c->lock);
+}
+
+
+void counter_gate_reset(struct counter *c) {
+	c->gate_samples = 0;
+	c->periods = 0;
+	c->sum = 0;
+	c->sum_sq = 0;
+	c->min = INFINITY;
+	c->max = -INFINITY;
+}
+
+
+void counter_start(struct counter *c, int channel, sample_t level,
+		sample_t hysteresis, double gate, uint64_t sample_rate) {
+	g_mutex_lock(&c->lock);
+	c->channel = channel;
+	c->level = level;
+	c->hysteresis = hysteresis;
+	c->gate = gate;
+	c->sample_rate = sample_rate;
+	c->pos = 0;
+	c->have_prev = 0;
+	c->armed = 0;
+	c->have_edge = 0;
+	c->gates = 0;
+	memset(&c->result, 0, sizeof(c->result));
+	counter_gate_reset(c);
+	c->active = 1;
+	g_mutex_unlock(&c->lock);
+}
+
+
+void counter_stop(struct counter *c) {
+	g_mutex_lock(&c->lock);
+	c->active = 0;
+	g_mutex_unlock(&c->lock);
+}
+
+
+// A new acquisition started: the samples before it are not contiguous
+// with the next ones, so the period in progress is dropped. A change of
+// sample rate also drops the gate in progress.
+void counter_restart(struct counter *c, uint64_t sample_rate) {
+	g_mutex_lock(&c->lock);
+	c->have_prev = 0;
+	c->armed = 0;
+	c->have_edge = 0;
+	if (sample_rate != c->sample_rate) {
+		c->sample_rate = sample_rate;
+		counter_gate_reset(c);
+	}
+	g_mutex_unlock(&c->lock);
+}
+
+
+// Periods are accumulated relative to the first one of the gate, which
+// keeps the variance accurate when the jitter is tiny next to the period.
+void counter_publish(struct counter *c) {
+	struct counter_result *r = &c->result;
+	double rate = (double) c->sample_rate;
+
+	memset(r, 0, sizeof(*r));
+	r->periods = c->periods;
+	if (c->periods > 0) {
+		double mean = c->sum / c->periods;
+		double var = c->sum_sq / c->periods - mean * mean;
+		mean += c->shift;
+		r->period = mean / rate;
+		r->frequency = rate / mean;
+		r->jitter_min = (c->min - mean) / rate;
+		r->jitter_max = (c->max - mean) / rate;
+		r->jitter_stddev = sqrt(var > 0 ? var : 0) / rate;
+	}
+	c->gates++;
+	counter_gate_reset(c);
+}
+
+
+void counter_process(struct counter *c, const sample_t *x, int n) {
+	g_mutex_lock(&c->lock);
+	if (!c->active || c->sample_rate == 0 || n <= 0) {
+		g_mutex_unlock(&c->lock);
+		return;
+	}
+
+	sample_t level = c->level;
+	sample_t low = level - c->hysteresis;
+	sample_t prev = c->have_prev ? c->prev : x[0];
+	int armed = c->armed || (!c->have_prev && x[0] < low);
+
+	for (int i = c->have_prev ? 0 : 1; i < n; i++) {
+		sample_t v = x[i];
+		if (v < low) {
+			armed = 1;
+		} else if (armed && prev < level && v >= level) {
+			// The edge lies between the samples at idx and idx + 1
+			uint64_t idx = c->pos + i - 1;
+			double frac = (double) (level - prev) / (v - prev);
+			if (c->have_edge) {
+				double p = (double) (idx - c->edge_idx) + (frac - c->edge_frac);
+				if (c->periods == 0)
+					c->shift = p;
+				c->sum += p - c->shift;
+				c->sum_sq += (p - c->shift) * (p - c->shift);
+				c->min = p < c->min ? p : c->min;
+				c->max = p > c->max ? p : c->max;
+				c->periods++;
+			}
+			c->edge_idx = idx;
+			c->edge_frac = frac;
+			c->have_edge = 1;
+			armed = 0;
+		}
+		prev = v;
+	}
+
+	c->prev = prev;
+	c->have_prev = 1;
+	c->armed = armed;
+	c->pos += n;
+	c->gate_samples += n;
+	if (c->gate_samples >= c->gate * c->sample_rate)
+		counter_publish(c);
+	g_mutex_unlock(&c->lock);
+}
+
+
+// Copies the result of the last gate; returns the number of gates done.
+int counter_get(struct counter *c, struct counter_result *r) {
+	g_mutex_lock(&c->lock);
+	*r = c->result;
+	int gates = (int) c->gates;
+	g_mutex_unlock(&c->lock);
+	return gates;
+}
@@ -0,0 +1,64 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "gloscope.h"
+
+#define COUNTER_DEFAULT_GATE 1.0
+#define COUNTER_DEFAULT_HYSTERESIS 0.01f
+
+// Results of one gate. Times are in seconds.
+struct counter_result {
+	uint64_t periods;
+	double frequency;
+	double period;
+	double jitter_min;
+	double jitter_max;
+	double jitter_stddev;
+};
+
+// Reciprocal frequency counter on one channel. It runs in the datafeed of
+// the channel's device, on every packet: each rising crossing of level
+// (rearmed hysteresis below it) is timestamped by linear interpolation
+// between the two samples around it, and the periods between consecutive
+// edges are summed over the gate. The frequency is the number of whole
+// periods over their total duration, so its resolution does not depend on
+// the gate length in samples. Periods are never measured across a gap.
+struct counter {
+	int active;
+	int channel;
+	sample_t level;
+	sample_t hysteresis;
+	double gate;
+	GMutex lock;
+	// Protected by lock, only touched by the datafeed while active
+	uint64_t sample_rate;
+	uint64_t gate_samples;
+	uint64_t pos;
+	sample_t prev;
+	int have_prev;
+	int armed;
+	int have_edge;
+	uint64_t edge_idx;
+	double edge_frac;
+	uint64_t periods;
+	double shift;
+	double sum;
+	double sum_sq;
+	double min;
+	double max;
+	// Last completed gate
+	uint64_t gates;
+	struct counter_result result;
+};
+
+void counter_init(struct counter *);
+void counter_start(struct counter *, int, sample_t, sample_t, double,
+		uint64_t);
+void counter_stop(struct counter *);
+void counter_restart(struct counter *, uint64_t);
+void counter_process(struct counter *, const sample_t *, int);
+int counter_get(struct counter *, struct counter_result *);
+
+#endif
@@ -0,0 +1,405 @@
+#include <string.h>
+#include "decode.h"
+
+
+// libsigrokdecode is set up on first use and kept until exit.
+int decode_library(void) {
+	static int ready = 0;
+	if (!ready) {
+		int ret = srd_init(NULL);
+		if (ret != SRD_OK) {
+			fprintf(stderr, "srd_init: %s\n", srd_strerror(ret));
+			return 0;
+		}
+		ready = 1;
+	}
+	return 1;
+}
+
+
+struct srd_channel *decode_find_channel(const struct srd_decoder *dec,
+		const char *id) {
+	GSList *lists[2] = { dec->channels, dec->opt_channels };
+	for (int i = 0; i < 2; i++) {
+		for (GSList *l = lists[i]; l != NULL; l = l->next) {
+			struct srd_channel *ch = l->data;
+			if (strcmp(ch->id, id) == 0)
+				return ch;
+		}
+	}
+	return NULL;
+}
+
+
+struct srd_decoder_option *decode_find_option(const struct srd_decoder *dec,
+		const char *id) {
+	for (GSList *l = dec->options; l != NULL; l = l->next) {
+		struct srd_decoder_option *o = l->data;
+		if (strcmp(o->id, id) == 0)
+			return o;
+	}
+	return NULL;
+}
+
+
+// Option values take the type of the option's default.
+GVariant *decode_option_value(const struct srd_decoder_option *o,
+		const char *value) {
+	char *end;
+	if (g_variant_is_of_type(o->def, G_VARIANT_TYPE_INT64)) {
+		long long v = strtoll(value, &end, 0);
+		return *end == 0 ? g_variant_new_int64(v) : NULL;
+	}
+	if (g_variant_is_of_type(o->def, G_VARIANT_TYPE_DOUBLE)) {
+		double v = strtod(value, &end);
+		return *end == 0 ? g_variant_new_double(v) : NULL;
+	}
+	if (g_variant_is_of_type(o->def, G_VARIANT_TYPE_STRING))
+		return g_variant_new_string(value);
+	return NULL;
+}
+
+
+// Each argument is NAME=VALUE: a decoder channel and the rokscope channel
+// feeding it, or a decoder option.
+int decode_parse(struct decode *d, const struct srd_decoder *dec,
+		char **args, int nargs, int num_channels) {
+	for (int i = 0; i < nargs; i++) {
+		if (args[i][0] == 0)
+			continue;
+		char *eq = strchr(args[i], '=');
+		if (eq == NULL) {
+			fprintf(stderr, "decode: expected NAME=VALUE, got %s\n", args[i]);
+			return 0;
+		}
+		char *key = g_strndup(args[i], (gsize) (eq - args[i]));
+		const char *value = eq + 1;
+		struct srd_decoder_option *o;
+
+		if (decode_find_channel(dec, key) != NULL) {
+			char *end;
+			long c = strtol(value, &end, 0);
+			if (*end != 0 || c < 0 || c >= num_channels
+					|| d->num_inputs == DECODE_MAX_CHANNELS) {
+				fprintf(stderr, "decode: bad channel %s for %s\n", value, key);
+				g_free(key);
+				return 0;
+			}
+			d->inputs[d->num_inputs] = (int) c;
+			g_hash_table_insert(d->channel_map, key, g_variant_ref_sink(
+					g_variant_new_int32(d->num_inputs)));
+			d->num_inputs++;
+		} else if ((o = decode_find_option(dec, key)) != NULL) {
+			GVariant *v = decode_option_value(o, value);
+			if (v == NULL) {
+				fprintf(stderr, "decode: bad value %s for %s\n", value, key);
+				g_free(key);
+				return 0;
+			}
+			g_hash_table_insert(d->options, key, g_variant_ref_sink(v));
+		} else {
+			fprintf(stderr, "decode: %s has no channel or option %s\n",
+					dec->id, key);
+			g_free(key);
+			return 0;
+		}
+	}
+
+	for (GSList *l = dec->channels; l != NULL; l = l->next) {
+		struct srd_channel *ch = l->data;
+		if (g_hash_table_lookup(d->channel_map, ch->id) == NULL) {
+			fprintf(stderr, "decode: %s needs channel %s\n", dec->id, ch->id);
+			return 0;
+		}
+	}
+	if (d->num_inputs == 0) {
+		fprintf(stderr, "decode: no channel given\n");
+		return 0;
+	}
+	return 1;
+}
+
+
+void decode_clear(struct decode *d) {
+	if (d->channel_map != NULL)
+		g_hash_table_destroy(d->channel_map);
+	if (d->options != NULL)
+		g_hash_table_destroy(d->options);
+	d->channel_map = NULL;
+	d->options = NULL;
+	g_free(d->decoder);
+	d->decoder = NULL;
+	d->num_inputs = 0;
+}
+
+
+void decode_annotation_cb(struct srd_proto_data *pdata, void *cb_data) {
+	struct decode *d = cb_data;
+	const struct srd_proto_data_annotation *ann = pdata->data;
+	struct decode_annotation a;
+
+	memset(&a, 0, sizeof(a));
+	a.start = d->session_start + pdata->start_sample;
+	a.end = d->session_start + pdata->end_sample;
+	a.ann_class = ann->ann_class;
+	// Texts go from the longest form to the shortest
+	char **text = ann->ann_text;
+	if (text != NULL && text[0] != NULL) {
+		int last = 0;
+		while (text[last + 1] != NULL)
+			last++;
+		g_strlcpy(a.text, text[0], sizeof(a.text));
+		g_strlcpy(a.short_text, text[last], sizeof(a.short_text));
+	}
+
+	g_mutex_lock(&d->lock);
+	d->annotations[d->num_annotations % DECODE_MAX_ANNOTATIONS] = a;
+	d->num_annotations++;
+	g_mutex_unlock(&d->lock);
+}
+
+
+void decode_session_end(struct decode *d) {
+	if (d->session == NULL)
+		return;
+	srd_session_destroy(d->session);
+	d->session = NULL;
+}
+
+
+void decode_error(struct decode *d, const char *what, int ret) {
+	g_mutex_lock(&d->lock);
+	if (d->errors++ == 0)
+		fprintf(stderr, "decode: %s: %s\n", what, srd_strerror(ret));
+	g_mutex_unlock(&d->lock);
+	decode_session_end(d);
+}
+
+
+// A session starts at the first chunk after a gap; sample numbers given
+// to the decoder count from there.
+int decode_session_begin(struct decode *d, uint64_t pos,
+		uint64_t sample_rate) {
+	struct srd_decoder_inst *di;
+	int ret;
+
+	if ((ret = srd_session_new(&d->session)) != SRD_OK) {
+		d->session = NULL;
+		decode_error(d, "srd_session_new", ret);
+		return 0;
+	}
+	di = srd_inst_new(d->session, d->decoder, d->options);
+	if (di == NULL) {
+		decode_error(d, "srd_inst_new", SRD_ERR);
+		return 0;
+	}
+	if ((ret = srd_inst_channel_set_all(di, d->channel_map)) != SRD_OK) {
+		decode_error(d, "srd_inst_channel_set_all", ret);
+		return 0;
+	}
+	srd_session_metadata_set(d->session, SRD_CONF_SAMPLERATE,
+			g_variant_new_uint64(sample_rate));
+	srd_pd_output_callback_add(d->session, SRD_OUTPUT_ANN,
+			decode_annotation_cb, d);
+	if ((ret = srd_session_start(d->session)) != SRD_OK) {
+		decode_error(d, "srd_session_start", ret);
+		return 0;
+	}
+
+	d->session_start = pos;
+	d->session_rate = sample_rate;
+	d->session_samples = 0;
+	g_mutex_lock(&d->lock);
+	d->restarts++;
+	g_mutex_unlock(&d->lock);
+	return 1;
+}
+
+
+void decode_process(struct decode *d, const struct decode_job *job) {
+	uint64_t n = (uint64_t) job->num_samples;
+
+	if (job->num_samples == 0) {
+		decode_session_end(d);
+		return;
+	}
+	if (d->session != NULL && (job->sample_rate != d->session_rate
+			|| job->pos != d->session_start + d->session_samples))
+		decode_session_end(d);
+	if (d->session == NULL
+			&& !decode_session_begin(d, job->pos, job->sample_rate))
+		return;
+
+	int ret = srd_session_send(d->session, d->session_samples,
+			d->session_samples + n, job->logic, n, 1);
+	if (ret != SRD_OK) {
+		decode_error(d, "srd_session_send", ret);
+		return;
+	}
+	d->session_samples += n;
+
+	g_mutex_lock(&d->lock);
+	d->decoded_end = job->pos + n;
+	g_mutex_unlock(&d->lock);
+}
+
+
+gpointer decode_worker(gpointer data) {
+	struct decode *d = data;
+
+	for (;;) {
+		struct decode_job *job = g_async_queue_pop(d->queue);
+		if (job->num_samples < 0) {
+			free(job);
+			break;
+		}
+		decode_process(d, job);
+		free(job);
+	}
+	decode_session_end(d);
+	return NULL;
+}
+
+
+int decode_start(struct decode *d, const char *decoder, sample_t level,
+		sample_t hysteresis, char **args, int nargs, int num_channels) {
+	decode_stop(d);
+	if (!decode_library())
+		return 0;
+	int ret = srd_decoder_load(decoder);
+	struct srd_decoder *dec = srd_decoder_get_by_id(decoder);
+	if (ret != SRD_OK || dec == NULL) {
+		fprintf(stderr, "decode: cannot load %s\n", decoder);
+		return 0;
+	}
+
+	decode_clear(d);
+	d->channel_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify) g_variant_unref);
+	d->options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify) g_variant_unref);
+	if (!decode_parse(d, dec, args, nargs, num_channels)) {
+		decode_clear(d);
+		return 0;
+	}
+
+	if (d->queue == NULL) {
+		g_mutex_init(&d->lock);
+		d->queue = g_async_queue_new();
+		d->annotations = zalloc(DECODE_MAX_ANNOTATIONS
+				* sizeof(*d->annotations));
+	}
+	d->decoder = g_strdup(decoder);
+	d->level = level;
+	d->hysteresis = hysteresis;
+	d->gap = 1;
+	g_mutex_lock(&d->lock);
+	d->queued_end = 0;
+	d->decoded_end = 0;
+	d->dropped = 0;
+	d->restarts = 0;
+	d->errors = 0;
+	d->num_annotations = 0;
+	g_mutex_unlock(&d->lock);
+
+	d->thread = g_thread_new("decode", decode_worker, d);
+	d->active = 1;
+	return 1;
+}
+
+
+void decode_stop(struct decode *d) {
+	if (!d->active)
+		return;
+	d->active = 0;
+	struct decode_job *job = zalloc(sizeof(*job));
+	job->num_samples = -1;
+	g_async_queue_push(d->queue, job);
+	g_thread_join(d->thread);
+	d->thread = NULL;
+}
+
+
+void decode_gap(struct decode *d) {
+	d->gap = 1;
+}
+
+
+// Thresholds n samples of every input from pos into logic levels, in
+// chunks of at most DECODE_CHUNK. A chunk that finds the queue full is
+// dropped and the decoder restarts after it.
+void decode_push(struct decode *d, uint64_t pos, const sample_t **x, int n,
+		uint64_t sample_rate) {
+	sample_t high = d->level + d->hysteresis / 2;
+	sample_t low = d->level - d->hysteresis / 2;
+
+	if (!d->active)
+		return;
+
+	for (int from = 0; from < n; from += DECODE_CHUNK) {
+		int count = n - from < DECODE_CHUNK ? n - from : DECODE_CHUNK;
+
+		if (g_async_queue_length(d->queue) >= DECODE_QUEUE_LENGTH) {
+			g_mutex_lock(&d->lock);
+			d->dropped += (uint64_t) count;
+			g_mutex_unlock(&d->lock);
+			d->gap = 1;
+			continue;
+		}
+
+		if (d->gap) {
+			struct decode_job *gap = zalloc(sizeof(*gap));
+			g_async_queue_push(d->queue, gap);
+			d->logic = 0;
+			for (int b = 0; b < d->num_inputs; b++)
+				d->logic |= (x[b][from] >= d->level) << b;
+			d->gap = 0;
+		}
+
+		struct decode_job *job = zalloc(sizeof(*job) + (size_t) count);
+		job->pos = pos + from;
+		job->sample_rate = sample_rate;
+		job->num_samples = count;
+		for (int b = 0; b < d->num_inputs; b++) {
+			const sample_t *v = x[b] + from;
+			uint8_t bit = (uint8_t) (1 << b);
+			uint8_t on = d->logic & bit;
+			for (int i = 0; i < count; i++) {
+				if (v[i] > high)
+					on = bit;
+				else if (v[i] < low)
+					on = 0;
+				job->logic[i] |= on;
+			}
+			d->logic = (uint8_t) ((d->logic & ~bit) | on);
+		}
+
+		g_mutex_lock(&d->lock);
+		d->queued_end = job->pos + count;
+		g_mutex_unlock(&d->lock);
+		g_async_queue_push(d->queue, job);
+	}
+}
+
+
+// Copies the annotations overlapping [from, to) to out, oldest first;
+// returns how many were copied.
+int decode_annotations(struct decode *d, uint64_t from, uint64_t to,
+		struct decode_annotation *out, int max) {
+	int count = 0;
+	if (d->queue == NULL)
+		return 0;
+
+	g_mutex_lock(&d->lock);
+	uint64_t total = d->num_annotations;
+	uint64_t first = total > DECODE_MAX_ANNOTATIONS
+			? total - DECODE_MAX_ANNOTATIONS : 0;
+	for (uint64_t i = first; i < total && count < max; i++) {
+		const struct decode_annotation *a =
+				&d->annotations[i % DECODE_MAX_ANNOTATIONS];
+		if (a->end >= from && a->start < to)
+			out[count++] = *a;
+	}
+	g_mutex_unlock(&d->lock);
+	return count;
+}
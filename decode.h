@@ -0,0 +1,81 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+#include <glib.h>
+#include <libsigrokdecode/libsigrokdecode.h>
+#include "gloscope.h"
+
+#define DECODE_MAX_CHANNELS 8
+#define DECODE_QUEUE_LENGTH 64
+#define DECODE_MAX_ANNOTATIONS 4096
+#define DECODE_TEXT 48
+#define DECODE_CHUNK 65536
+
+// Positions are absolute samples of the device of the decoded channels.
+struct decode_annotation {
+	uint64_t start;
+	uint64_t end;
+	int ann_class;
+	char text[DECODE_TEXT];
+	char short_text[DECODE_TEXT];
+};
+
+// Logic samples, bit i for input i. num_samples == 0 marks a gap and
+// num_samples < 0 stops the worker.
+struct decode_job {
+	uint64_t pos;
+	uint64_t sample_rate;
+	int num_samples;
+	uint8_t logic[];
+};
+
+// One libsigrokdecode decoder fed from analog channels of a device. The
+// main thread thresholds new samples into logic levels, with hysteresis
+// around level, and queues them to a worker thread that runs the decoder.
+// The queue is bounded: when the worker falls DECODE_QUEUE_LENGTH chunks
+// behind, new chunks are dropped and the decoder restarts after the gap,
+// so decoding never holds back the capture. Annotations are kept in a
+// ring of the last DECODE_MAX_ANNOTATIONS.
+struct decode {
+	int active;
+	char *decoder;
+	int num_inputs;
+	int inputs[DECODE_MAX_CHANNELS];
+	GHashTable *channel_map;
+	GHashTable *options;
+	sample_t level;
+	sample_t hysteresis;
+	GThread *thread;
+	GAsyncQueue *queue;
+	// Main thread only
+	uint64_t pos;
+	uint8_t logic;
+	int gap;
+	// Worker only
+	struct srd_session *session;
+	uint64_t session_start;
+	uint64_t session_rate;
+	uint64_t session_samples;
+	// Protected by lock
+	GMutex lock;
+	uint64_t queued_end;
+	uint64_t decoded_end;
+	uint64_t sample_rate;
+	uint64_t dropped;
+	uint64_t restarts;
+	uint64_t errors;
+	uint64_t num_annotations;
+	struct decode_annotation *annotations;
+};
+
+int decode_start(struct decode *, const char *, sample_t, sample_t,
+		char **, int, int);
+void decode_stop(struct decode *);
+void decode_push(struct decode *, uint64_t, const sample_t **, int,
+		uint64_t);
+void decode_gap(struct decode *);
+int decode_annotations(struct decode *, uint64_t, uint64_t,
+		struct decode_annotation *, int);
+
+#endif
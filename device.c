@@ -0,0 +1,318 @@
+#include "rokscope.h"
+
+
+gpointer device_thread(gpointer data) {
+	struct device *d = data;
+	g_main_context_push_thread_default(d->context);
+	g_main_loop_run(d->loop);
+	g_main_context_pop_thread_default(d->context);
+	return NULL;
+}
+
+
+// Index of the packet's channel among the device's analog channels, or
+// -1 for channels that are not captured.
+int get_datafeed_analog_channel(struct device *d,
+		const struct sr_datafeed_analog *payload) {
+	GSList *channels;
+	struct sr_channel *channel;
+
+	channels = payload->meaning->channels;
+	if (channels == NULL) {
+		fprintf(stderr, "Channels is null?\n");
+		exit(1);
+	}
+	if (channels->next != NULL) {
+		fprintf(stderr, "Channels is > 1?\n");
+		exit(1);
+	}
+	channel = channels->data;
+	for (int c = 0; c < d->num_channels; c++) {
+		if (d->channels[c] == channel)
+			return c;
+	}
+	return -1;
+}
+
+
+uint64_t device_written(struct device *d) {
+	uint64_t written = d->rings[0].written;
+	for (int c = 1; c < d->num_channels; c++) {
+		if (written > d->rings[c].written)
+			written = d->rings[c].written;
+	}
+	return written;
+}
+
+
+// Runs on the device thread, possibly on another device's thread when
+// the driver shares a USB event source.
+void on_device_datafeed(const struct sr_dev_inst *sdi,
+		const struct sr_datafeed_packet *packet, void *data) {
+	UNUSED(sdi);
+	struct device *d = data;
+	struct state *s = d->s;
+	uint16_t type = packet->type;
+
+	switch (type) {
+
+		case SR_DF_HEADER: {
+			g_mutex_lock(&d->lock);
+			d->header_pos = device_written(d);
+			d->base_time = g_get_monotonic_time();
+			d->sample_rate = s->sample_rate;
+			g_mutex_unlock(&d->lock);
+			if (s->counter.active && s->counter.channel >= d->first_channel
+					&& s->counter.channel < d->first_channel + d->num_channels)
+				counter_restart(&s->counter, d->sample_rate);
+		} break;
+
+		case SR_DF_ANALOG: {
+			const struct sr_datafeed_analog *payload = packet->payload;
+			int c = get_datafeed_analog_channel(d, payload);
+			if (c < 0)
+				break;
+
+			g_mutex_lock(&d->lock);
+			ring_write(&d->rings[c], payload->data, payload->num_samples);
+			g_mutex_unlock(&d->lock);
+
+			// Inline, so every sample is counted at the full rate
+			if (s->counter.active && s->counter.channel == d->first_channel + c)
+				counter_process(&s->counter, payload->data,
+						(int) payload->num_samples);
+
+			if (g_atomic_int_compare_and_exchange(&s->update_pending, 0, 1))
+				g_idle_add_full(G_PRIORITY_DEFAULT, on_capture_update, s, NULL);
+		} break;
+
+		case SR_DF_LOGIC: break; // Skip this, we only want analog
+		case SR_DF_END: break;
+
+		default:
+			printf("unknown datafeed type %d\n", type);
+
+	}
+}
+
+
+// Acquisitions end after the samples limit; restart them until stopped.
+// The restart happens under run_lock so device_stop cannot miss it.
+void on_device_stopped(void *data) {
+	struct device *d = data;
+	g_mutex_lock(&d->run_lock);
+	if (d->running) {
+		assert_sr(sr_session_start(d->session), "starting session");
+	} else {
+		d->active = FALSE;
+		g_cond_broadcast(&d->stopped);
+	}
+	g_mutex_unlock(&d->run_lock);
+}
+
+
+// sr_session_start binds the session to the calling thread's default
+// context, so it must run on the device thread.
+gboolean device_start_cb(gpointer data) {
+	struct device *d = data;
+	g_mutex_lock(&d->run_lock);
+	if (d->running && !d->active) {
+		d->active = TRUE;
+		assert_sr(sr_session_start(d->session), "starting session");
+	}
+	g_mutex_unlock(&d->run_lock);
+	return G_SOURCE_REMOVE;
+}
+
+
+void device_init(struct device *d, struct state *s) {
+	int ret;
+
+	d->s = s;
+	d->rings = zalloc(d->num_channels * sizeof(*d->rings));
+	g_mutex_init(&d->run_lock);
+	g_mutex_init(&d->lock);
+	g_mutex_init(&d->config_lock);
+	g_cond_init(&d->stopped);
+
+	assert_sr(sr_session_new(s->context, &d->session), "creating session");
+	assert_sr(sr_session_dev_add(d->session, d->sdi),
+			"adding device to session");
+
+	ret = sr_session_datafeed_callback_add(d->session, on_device_datafeed, d);
+	assert_sr(ret, "adding callback for session datafeed");
+
+	ret = sr_session_stopped_callback_set(d->session, on_device_stopped, d);
+	assert_sr(ret, "setting callback for session stopped");
+
+	d->context = g_main_context_new();
+	d->loop = g_main_loop_new(d->context, FALSE);
+	d->thread = g_thread_new(d->driver->name, device_thread, d);
+}
+
+
+void device_close(struct device *d) {
+	device_stop(d);
+	g_main_loop_quit(d->loop);
+	g_thread_join(d->thread);
+	g_main_loop_unref(d->loop);
+	g_main_context_unref(d->context);
+
+	assert_sr(sr_session_destroy(d->session), "destroying session");
+	assert_sr(sr_dev_close(d->sdi), "closing device");
+
+	for (int c = 0; c < d->num_channels; c++)
+		ring_free(&d->rings[c]);
+	free(d->rings);
+	free(d->channels);
+	free(d->chgroups);
+	g_mutex_clear(&d->run_lock);
+	g_mutex_clear(&d->lock);
+	g_mutex_clear(&d->config_lock);
+	g_cond_clear(&d->stopped);
+}
+
+
+void device_start(struct device *d) {
+	g_mutex_lock(&d->run_lock);
+	d->running = TRUE;
+	g_mutex_unlock(&d->run_lock);
+	g_main_context_invoke(d->context, device_start_cb, d);
+}
+
+
+// Returns once the acquisition has really ended, so the device can be
+// reconfigured.
+void device_stop(struct device *d) {
+	g_mutex_lock(&d->run_lock);
+	d->running = FALSE;
+	if (d->active)
+		assert_sr(sr_session_stop(d->session), "stopping session");
+	while (d->active)
+		g_cond_wait(&d->stopped, &d->run_lock);
+	g_mutex_unlock(&d->run_lock);
+}
+
+
+// Settings the device does not have are reported and skipped, so devices
+// of different models can share the instrument-wide commands.
+int device_config_set(struct device *d, struct sr_channel_group *chgroup,
+		uint32_t key, GVariant *gvar, const char *what) {
+	g_mutex_lock(&d->config_lock);
+	int ret = sr_config_set(d->sdi, chgroup, key, gvar);
+	g_mutex_unlock(&d->config_lock);
+	if (ret == SR_ERR_NA) {
+		fprintf(stderr, "%s: %s not supported\n", d->driver->name, what);
+		return ret;
+	}
+	assert_sr(ret, what);
+	return ret;
+}
+
+
+// The list comes from the cache when it has it, else from the driver.
+GVariant *device_caps_list(struct device *d, struct sr_channel_group *chgroup,
+		uint32_t key) {
+	g_mutex_lock(&d->config_lock);
+	GVariant *gvar = caps_list(&d->s->caps, d->driver, d->sdi, chgroup, key);
+	g_mutex_unlock(&d->config_lock);
+	return gvar;
+}
+
+
+void device_reserve(struct device *d, size_t capacity) {
+	g_mutex_lock(&d->lock);
+	for (int c = 0; c < d->num_channels; c++) {
+		if (d->rings[c].capacity < capacity) {
+			ring_free(&d->rings[c]);
+			ring_init(&d->rings[c], capacity);
+			d->header_pos = 0;
+		}
+	}
+	g_mutex_unlock(&d->lock);
+}
+
+
+// Samples received on every channel, oldest position still held by every
+// ring (channels arrive in separate packets, so the ring that is ahead
+// decides) and position of the last acquisition start.
+void device_positions(struct device *d, uint64_t *written, uint64_t *oldest,
+		uint64_t *header_pos) {
+	g_mutex_lock(&d->lock);
+	*written = device_written(d);
+	*oldest = ring_oldest(&d->rings[0]);
+	for (int c = 1; c < d->num_channels; c++) {
+		if (*oldest < ring_oldest(&d->rings[c]))
+			*oldest = ring_oldest(&d->rings[c]);
+	}
+	*header_pos = d->header_pos;
+	g_mutex_unlock(&d->lock);
+}
+
+
+void device_channel_positions(struct device *d, int c, uint64_t *written,
+		uint64_t *oldest, uint64_t *header_pos) {
+	g_mutex_lock(&d->lock);
+	*written = d->rings[c].written;
+	*oldest = ring_oldest(&d->rings[c]);
+	*header_pos = d->header_pos;
+	g_mutex_unlock(&d->lock);
+}
+
+
+// Monotonic time in microseconds of the sample at pos.
+gint64 device_time_at(struct device *d, int64_t pos) {
+	g_mutex_lock(&d->lock);
+	gint64 t = d->base_time;
+	if (d->sample_rate != 0)
+		t += (gint64) ((double) (pos - (int64_t) d->header_pos)
+				* G_USEC_PER_SEC / d->sample_rate);
+	g_mutex_unlock(&d->lock);
+	return t;
+}
+
+
+int64_t device_position_at(struct device *d, gint64 t) {
+	g_mutex_lock(&d->lock);
+	int64_t pos = (int64_t) d->header_pos + (int64_t) ((double)
+			(t - d->base_time) * d->sample_rate / G_USEC_PER_SEC);
+	g_mutex_unlock(&d->lock);
+	return pos;
+}
+
+
+// Copies one channel without holding the lock, so the datafeed is never
+// held up by a long copy. Samples overwritten meanwhile are those before
+// the oldest position read once the copy is done; they are zeroed, as are
+// the ones the ring does not have.
+void device_copy_channel(struct device *d, int c, int64_t start, int length,
+		sample_t *out) {
+	struct ring *r = &d->rings[c];
+	uint64_t written, oldest, header_pos;
+	int64_t end = start + length;
+
+	device_channel_positions(d, c, &written, &oldest, &header_pos);
+	int64_t to = end < (int64_t) written ? end : (int64_t) written;
+	to = to > start ? to : start;
+	int64_t from = start > (int64_t) oldest ? start : (int64_t) oldest;
+	from = from < to ? from : to;
+	if (from < to)
+		memcpy(out + (from - start), ring_at(r, (uint64_t) from),
+				(to - from) * sizeof(sample_t));
+
+	device_channel_positions(d, c, &written, &oldest, &header_pos);
+	if ((int64_t) oldest > from)
+		from = (int64_t) oldest < to ? (int64_t) oldest : to;
+	memset(out, 0, (from - start) * sizeof(sample_t));
+	memset(out + (to - start), 0, (end - to) * sizeof(sample_t));
+}
+
+
+// Copies length samples of every channel from position start; samples
+// the rings do not hold (not yet received or already overwritten) are
+// zeroed.
+void device_copy(struct device *d, int64_t start, int length,
+		sample_t **out) {
+	for (int c = 0; c < d->num_channels; c++)
+		device_copy_channel(d, c, start, length, out[c]);
+}
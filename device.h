@@ -0,0 +1,65 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <glib.h>
+#include <libsigrok/libsigrok.h>
+#include "gloscope.h"
+#include "ring.h"
+
+struct state;
+
+// One acquisition device. Its sigrok session runs on a thread of its own,
+// iterating a private main context; the datafeed only appends samples to
+// the device rings and wakes up the main thread, which builds the frames.
+//
+// Positions are mapped to time through the monotonic clock reading taken
+// when the device sent its last header, so frames of different devices
+// line up to within the latency of the acquisition start.
+struct device {
+	struct state *s;
+	struct sr_dev_driver *driver;
+	struct sr_dev_inst *sdi;
+	struct sr_session *session;
+	struct sr_channel **channels;
+	int num_channels;
+	int first_channel;
+	struct sr_channel_group **chgroups;
+	int num_channel_groups;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	// Serializes the driver config calls of the main and device threads
+	GMutex config_lock;
+	// Main thread only: position of the frame last shown
+	int64_t frame_start;
+	// Protected by run_lock
+	GMutex run_lock;
+	GCond stopped;
+	gboolean running;
+	gboolean active;
+	// Protected by lock
+	GMutex lock;
+	struct ring *rings;
+	uint64_t header_pos;
+	gint64 base_time;
+	uint64_t sample_rate;
+};
+
+void device_init(struct device *, struct state *);
+void device_close(struct device *);
+void device_start(struct device *);
+void device_stop(struct device *);
+int device_config_set(struct device *, struct sr_channel_group *, uint32_t,
+		GVariant *, const char *);
+GVariant *device_caps_list(struct device *, struct sr_channel_group *,
+		uint32_t);
+void device_reserve(struct device *, size_t);
+void device_positions(struct device *, uint64_t *, uint64_t *, uint64_t *);
+void device_channel_positions(struct device *, int, uint64_t *, uint64_t *,
+		uint64_t *);
+gint64 device_time_at(struct device *, int64_t);
+int64_t device_position_at(struct device *, gint64);
+void device_copy(struct device *, int64_t, int, sample_t **);
+void device_copy_channel(struct device *, int, int64_t, int, sample_t *);
+
+#endif
@@ -0,0 +1,91 @@
+#include <math.h>
+#include "ets.h"
+
+
+void ets_init(struct ets *e, int num_channels) {
+	e->num_channels = num_channels;
+	e->sum = zalloc((size_t) num_channels * ETS_BINS * sizeof(float));
+	e->count = zalloc((size_t) num_channels * ETS_BINS * sizeof(uint16_t));
+	e->factor = 0;
+	e->acquisitions = 0;
+}
+
+
+void ets_set_factor(struct ets *e, int factor) {
+	if (factor < 0)
+		factor = 0;
+	if (factor > ETS_MAX_FACTOR)
+		factor = ETS_MAX_FACTOR;
+	e->factor = factor;
+	ets_reset(e);
+}
+
+
+void ets_reset(struct ets *e) {
+	memset(e->sum, 0, (size_t) e->num_channels * ETS_BINS * sizeof(float));
+	memset(e->count, 0, (size_t) e->num_channels * ETS_BINS * sizeof(uint16_t));
+	e->acquisitions = 0;
+}
+
+
+// Adds one acquisition. frame holds per-channel pointers to count samples,
+// edge is the index in the trigger channel where the signal crosses level
+// between edge and edge+1. Returns 0 if there is no crossing there.
+int ets_accumulate(struct ets *e, sample_t **frame, int count,
+		int trigger_channel, int edge, sample_t level) {
+	if (e->factor < 2 || edge < 0 || edge + 1 >= count)
+		return 0;
+
+	const sample_t *trig = frame[trigger_channel];
+	sample_t a = trig[edge] - level;
+	sample_t b = trig[edge + 1] - level;
+	if ((a < 0) == (b < 0) || a == b)
+		return 0;
+
+	// Linear interpolation of the crossing: the trigger point lies phase
+	// samples after trig[edge].
+	float phase = a / (a - b);
+	float factor = (float) e->factor;
+	int window = ETS_BINS / e->factor;
+	if (edge + 1 + window > count)
+		window = count - edge - 1;
+
+	for (int c = 0; c < e->num_channels; c++) {
+		const sample_t *samples = frame[c] + edge + 1;
+		float *sum = e->sum + (size_t) c * ETS_BINS;
+		uint16_t *cnt = e->count + (size_t) c * ETS_BINS;
+		float offset = (1.f - phase) * factor;
+
+		for (int j = 0; j < window; j++) {
+			int bin = (int) lrintf(j * factor + offset);
+			if (bin >= ETS_BINS)
+				break;
+			// Halve old contributions so the average follows slow changes
+			if (cnt[bin] >= ETS_MAX_COUNT) {
+				sum[bin] *= .5f;
+				cnt[bin] /= 2;
+			}
+			sum[bin] += samples[j];
+			cnt[bin]++;
+		}
+	}
+	e->acquisitions++;
+	return 1;
+}
+
+
+// Writes up to n reconstructed samples of a channel, holding the last
+// value over bins that received no samples yet.
+void ets_render(const struct ets *e, int channel, sample_t *out, int n) {
+	const float *sum = e->sum + (size_t) channel * ETS_BINS;
+	const uint16_t *cnt = e->count + (size_t) channel * ETS_BINS;
+	sample_t last = 0;
+
+	if (n > ETS_BINS)
+		n = ETS_BINS;
+	for (int i = 0; i < n; i++) {
+		if (cnt[i] != 0)
+			last = sum[i] / cnt[i];
+		out[i] = last;
+	}
+}
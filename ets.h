@@ -0,0 +1,29 @@
+#ifndef ETS_H
+#define ETS_H
+
+#include <stdint.h>
+#include "gloscope.h"
+
+#define ETS_BINS 4096
+#define ETS_MAX_FACTOR 256
+#define ETS_MAX_COUNT 64
+
+// Equivalent-time reconstruction of a repetitive signal. Each bin covers
+// 1/factor of a sample period after the trigger point; samples from many
+// acquisitions land in different bins depending on the sub-sample phase of
+// their trigger edge. All buffers are allocated once by ets_init.
+struct ets {
+	int factor;
+	int num_channels;
+	uint64_t acquisitions;
+	float *sum;
+	uint16_t *count;
+};
+
+void ets_init(struct ets *, int);
+void ets_set_factor(struct ets *, int);
+void ets_reset(struct ets *);
+int ets_accumulate(struct ets *, sample_t **, int, int, int, sample_t);
+void ets_render(const struct ets *, int, sample_t *, int);
+
+#endif
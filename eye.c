@@ -0,0 +1,218 @@
+#include <math.h>
+#include "eye.h"
+
+
+void eye_set_range(struct eye *e, const sample_t *samples, int n) {
+	sample_t lo = samples[0], hi = samples[0];
+	for (int i = 1; i < n; i++) {
+		lo = samples[i] < lo ? samples[i] : lo;
+		hi = samples[i] > hi ? samples[i] : hi;
+	}
+	sample_t margin = (hi - lo) * .25f;
+	if (margin <= 0)
+		margin = 1e-3f;
+	e->vmin = lo - margin;
+	e->vmax = hi + margin;
+	if (isnan(e->threshold))
+		e->threshold = (lo + hi) / 2;
+	e->have_range = 1;
+}
+
+
+// Advances the recovered clock by one sample per input sample. A threshold
+// crossing pulls the phase and the frequency towards putting the edge on
+// a unit interval boundary. phase is kept in [0, 2), one eye is two UIs.
+// Samples only go into the histogram and the jitter once the clock has
+// locked, EYE_LOCK_EDGES after the start of the segment.
+void eye_process(struct eye *e, const sample_t *samples, int n) {
+	double nominal = 1.0 / e->samples_per_ui;
+	double scale_y = EYE_HEIGHT / (e->vmax - e->vmin);
+	sample_t thr = e->threshold;
+
+	for (int i = 0; i < n; i++) {
+		sample_t v = samples[i];
+		double phase = e->phase + e->step;
+
+		if (e->have_prev && (e->prev < thr) != (v < thr)) {
+			double f = (thr - e->prev) / (v - e->prev);
+			double edge = e->phase + f * e->step;
+			double err = edge - floor(edge + .5);
+			if (e->segment_edges >= EYE_LOCK_EDGES) {
+				e->jitter_min = err < e->jitter_min ? err : e->jitter_min;
+				e->jitter_max = err > e->jitter_max ? err : e->jitter_max;
+				e->locked_edges++;
+			}
+			phase -= EYE_KP * err;
+			e->step -= EYE_KI * err * nominal;
+			if (e->step < nominal * .95)
+				e->step = nominal * .95;
+			if (e->step > nominal * 1.05)
+				e->step = nominal * 1.05;
+			e->edges++;
+			e->segment_edges++;
+		}
+		phase -= 2 * floor(phase / 2);
+		e->phase = phase;
+		e->prev = v;
+		e->have_prev = 1;
+		if (e->segment_edges < EYE_LOCK_EDGES)
+			continue;
+
+		int x = (int) (fmod(phase + .5, 2.) * (EYE_WIDTH / 2));
+		int y = (int) ((v - e->vmin) * scale_y);
+		if (x >= 0 && x < EYE_WIDTH && y >= 0 && y < EYE_HEIGHT)
+			e->hist[y * EYE_WIDTH + x]++;
+	}
+	e->samples += n;
+}
+
+
+gpointer eye_worker(gpointer data) {
+	struct eye *e = data;
+
+	for (;;) {
+		struct eye_block *block = g_async_queue_pop(e->queue);
+		int n = block->num_samples;
+
+		if (n < 0) {
+			free(block);
+			break;
+		}
+		if (n == 0) {
+			e->have_prev = 0;
+			e->segment_edges = 0;
+		} else {
+			g_mutex_lock(&e->lock);
+			if (!e->have_range)
+				eye_set_range(e, block->samples, n);
+			eye_process(e, block->samples, n);
+			g_mutex_unlock(&e->lock);
+		}
+		free(block);
+	}
+	return NULL;
+}
+
+
+void eye_start(struct eye *e, int channel, double samples_per_ui,
+		sample_t threshold) {
+	eye_stop(e);
+	if (e->hist == NULL) {
+		g_mutex_init(&e->lock);
+		e->hist = zalloc(EYE_WIDTH * EYE_HEIGHT * sizeof(uint32_t));
+		e->image = gloscope_image_alloc(EYE_WIDTH, EYE_HEIGHT);
+		e->queue = g_async_queue_new();
+	}
+
+	e->channel = channel;
+	e->samples_per_ui = samples_per_ui;
+	e->user_threshold = threshold;
+	e->phase = 0;
+	e->step = 1.0 / samples_per_ui;
+	e->have_prev = 0;
+	e->segment_edges = 0;
+	eye_reset(e);
+
+	e->thread = g_thread_new("eye", eye_worker, e);
+	e->active = 1;
+}
+
+
+void eye_stop(struct eye *e) {
+	if (!e->active)
+		return;
+	e->active = 0;
+	struct eye_block *block = zalloc(sizeof(*block));
+	block->num_samples = -1;
+	g_async_queue_push(e->queue, block);
+	g_thread_join(e->thread);
+	e->thread = NULL;
+}
+
+
+// Without a threshold from the user, the next range sets it again.
+void eye_reset(struct eye *e) {
+	g_mutex_lock(&e->lock);
+	memset(e->hist, 0, EYE_WIDTH * EYE_HEIGHT * sizeof(uint32_t));
+	e->have_range = 0;
+	e->threshold = e->user_threshold;
+	e->samples = 0;
+	e->edges = 0;
+	e->locked_edges = 0;
+	e->jitter_min = 0;
+	e->jitter_max = 0;
+	g_mutex_unlock(&e->lock);
+}
+
+
+// Queues a copy of one datafeed packet, n == 0 marks a gap in the stream.
+// Never blocks: the queue grows if the worker falls behind.
+void eye_push(struct eye *e, const sample_t *samples, int n) {
+	if (!e->active)
+		return;
+	struct eye_block *block = notnull(malloc(sizeof(*block)
+			+ n * sizeof(sample_t)));
+	block->num_samples = n;
+	if (n > 0)
+		memcpy(block->samples, samples, n * sizeof(sample_t));
+	g_async_queue_push(e->queue, block);
+}
+
+
+// Converts the histogram to a log-scaled intensity image.
+void eye_render(struct eye *e) {
+	uint32_t max = 0;
+	g_mutex_lock(&e->lock);
+	for (int i = 0; i < EYE_WIDTH * EYE_HEIGHT; i++)
+		max = e->hist[i] > max ? e->hist[i] : max;
+	float scale = max > 0 ? 1.f / log1pf((float) max) : 0;
+	for (int i = 0; i < EYE_WIDTH * EYE_HEIGHT; i++)
+		e->image->data[i] = log1pf((float) e->hist[i]) * scale;
+	g_mutex_unlock(&e->lock);
+	e->image->dirty = 1;
+}
+
+
+int eye_hits(const struct eye *e, int x, int y) {
+	uint32_t hits = 0;
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			int xx = x + dx, yy = y + dy;
+			if (xx >= 0 && xx < EYE_WIDTH && yy >= 0 && yy < EYE_HEIGHT)
+				hits += e->hist[yy * EYE_WIDTH + xx];
+		}
+	}
+	return hits != 0;
+}
+
+
+// Eye height in volts at the center of the eye, measured on the histogram.
+// Eye width in unit intervals, from the peak-to-peak timing error of the
+// edges seen since the clock locked. Both are 0 for a closed eye.
+void eye_measure(struct eye *e, double *height, double *width) {
+	*height = 0;
+	*width = 0;
+	g_mutex_lock(&e->lock);
+	if (!e->have_range) {
+		g_mutex_unlock(&e->lock);
+		return;
+	}
+
+	int cx = EYE_WIDTH / 2;
+	int ty = (int) ((e->threshold - e->vmin) / (e->vmax - e->vmin)
+			* EYE_HEIGHT);
+	if (ty >= 0 && ty < EYE_HEIGHT && !eye_hits(e, cx, ty)) {
+		int top = ty, bottom = ty;
+		while (top < EYE_HEIGHT - 1 && !eye_hits(e, cx, top + 1))
+			top++;
+		while (bottom > 0 && !eye_hits(e, cx, bottom - 1))
+			bottom--;
+		*height = (top - bottom + 1) * (e->vmax - e->vmin) / EYE_HEIGHT;
+	}
+
+	if (e->locked_edges > 0) {
+		double open = 1 - (e->jitter_max - e->jitter_min);
+		*width = open > 0 ? open : 0;
+	}
+	g_mutex_unlock(&e->lock);
+}
@@ -0,0 +1,57 @@
+#ifndef EYE_H
+#define EYE_H
+
+#include <glib.h>
+#include "gloscope.h"
+
+#define EYE_WIDTH 256
+#define EYE_HEIGHT 256
+#define EYE_KP 0.05
+#define EYE_KI 0.002
+#define EYE_LOCK_EDGES 1000
+
+struct eye_block {
+	int num_samples;
+	sample_t samples[];
+};
+
+// Eye diagram of one channel. The datafeed callback queues every packet
+// of the channel; a worker thread recovers the symbol clock with an
+// edge-driven PLL and folds two unit intervals into a hit-count histogram.
+struct eye {
+	int active;
+	int channel;
+	double samples_per_ui;
+	sample_t threshold;
+	sample_t user_threshold;
+	GThread *thread;
+	GAsyncQueue *queue;
+	GMutex lock;
+	struct gloscope_image *image;
+	// Worker-only clock recovery state; the PLL locks again after every
+	// gap, counting segment_edges
+	double phase;
+	double step;
+	sample_t prev;
+	int have_prev;
+	uint64_t segment_edges;
+	// Protected by lock
+	int have_range;
+	sample_t vmin;
+	sample_t vmax;
+	uint32_t *hist;
+	uint64_t samples;
+	uint64_t edges;
+	uint64_t locked_edges;
+	double jitter_min;
+	double jitter_max;
+};
+
+void eye_start(struct eye *, int, double, sample_t);
+void eye_stop(struct eye *);
+void eye_reset(struct eye *);
+void eye_push(struct eye *, const sample_t *, int);
+void eye_render(struct eye *);
+void eye_measure(struct eye *, double *, double *);
+
+#endif
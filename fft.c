@@ -0,0 +1,90 @@
+#include <math.h>
+#include "fft.h"
+#include "gloscope.h"
+
+
+void fft_init(struct fft *f, int n) {
+	int bits = 0;
+	while ((1 << bits) < n)
+		bits++;
+	if ((1 << bits) != n) {
+		fprintf(stderr, "FFT size %d is not a power of two\n", n);
+		exit(1);
+	}
+
+	f->n = n;
+	f->cos_table = zalloc((n / 2) * sizeof(float));
+	f->sin_table = zalloc((n / 2) * sizeof(float));
+	f->bitrev = zalloc(n * sizeof(uint32_t));
+	for (int i = 0; i < n / 2; i++) {
+		f->cos_table[i] = (float) cos(2 * M_PI * i / n);
+		f->sin_table[i] = (float) -sin(2 * M_PI * i / n);
+	}
+	for (int i = 0; i < n; i++) {
+		uint32_t r = 0;
+		for (int b = 0; b < bits; b++)
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		f->bitrev[i] = r;
+	}
+}
+
+
+void fft_free(struct fft *f) {
+	free(f->cos_table);
+	free(f->sin_table);
+	free(f->bitrev);
+	memset(f, 0, sizeof(*f));
+}
+
+
+void fft_transform(const struct fft *f, float *re, float *im, float sign) {
+	int n = f->n;
+
+	for (int i = 0; i < n; i++) {
+		uint32_t j = f->bitrev[i];
+		if (j > (uint32_t) i) {
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	for (int len = 2; len <= n; len <<= 1) {
+		int half = len / 2;
+		int stride = n / len;
+		for (int i = 0; i < n; i += len) {
+			for (int k = 0; k < half; k++) {
+				float wr = f->cos_table[k * stride];
+				float wi = sign * f->sin_table[k * stride];
+				int a = i + k, b = i + k + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+
+void fft_forward(const struct fft *f, float *re, float *im) {
+	fft_transform(f, re, im, 1.f);
+}
+
+
+// Inverse transform, scaled by 1/n.
+void fft_inverse(const struct fft *f, float *re, float *im) {
+	fft_transform(f, re, im, -1.f);
+	float scale = 1.f / f->n;
+	for (int i = 0; i < f->n; i++) {
+		re[i] *= scale;
+		im[i] *= scale;
+	}
+}
+
+
+void fft_hann(float *window, int n) {
+	for (int i = 0; i < n; i++)
+		window[i] = (float) (.5 - .5 * cos(2 * M_PI * i / n));
+}
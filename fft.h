@@ -0,0 +1,21 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdint.h>
+
+// Precomputed tables for an in-place radix-2 complex FFT of size n, with
+// real and imaginary parts in separate arrays.
+struct fft {
+	int n;
+	float *cos_table;
+	float *sin_table;
+	uint32_t *bitrev;
+};
+
+void fft_init(struct fft *, int);
+void fft_free(struct fft *);
+void fft_forward(const struct fft *, float *, float *);
+void fft_inverse(const struct fft *, float *, float *);
+void fft_hann(float *, int);
+
+#endif
@@ -1,12 +1,15 @@
+#include <math.h>
+#include <time.h>
 #include "gloscope.h"
 
 const char *VertexShaderCode = "#version 440 core\n"
-		"layout(location =   0) in      float a_hpos;\n"
 		"layout(location =   1) in      float a_vpos;\n"
 		"layout(location =  10) out     vec2  v_pos;\n"
 		"layout(location = 201) uniform mat4 u_tform = mat4(1);\n"
+		"layout(location = 204) uniform float u_x_step = 0;\n"
+		"layout(location = 205) uniform int u_x_shift = 0;\n"
 		"void main() {\n"
-		"  v_pos = vec2(a_hpos, a_vpos);\n"
+		"  v_pos = vec2(float(gl_VertexID >> u_x_shift) * u_x_step, a_vpos);\n"
 		"  gl_Position = u_tform * vec4(v_pos.x * 2 - 1, v_pos.y, 0, 1);\n"
 		"}\n";
 
@@ -20,6 +23,141 @@ const char *FragmentShaderCode = "#version 440 core\n"
 		"}\n";
 
 
+const char *ImageVertexShaderCode = "#version 440 core\n"
+		"layout(location =  10) out     vec2 v_uv;\n"
+		"layout(location = 201) uniform mat4 u_tform = mat4(1);\n"
+		"void main() {\n"
+		"  v_uv = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+		"  gl_Position = u_tform * vec4(v_uv * 2 - 1, 0, 1);\n"
+		"}\n";
+
+
+const char *ImageFragmentShaderCode = "#version 440 core\n"
+		"layout(location =  10) in      vec2 v_uv;\n"
+		"layout(location = 202) uniform float u_row_offset = 0;\n"
+		"layout(location = 203) uniform float u_row_dir = 1;\n"
+		"layout(binding = 0)    uniform sampler2D u_image;\n"
+		"out vec3 color;\n"
+		"void main() {\n"
+		"  vec2 uv = vec2(v_uv.x, u_row_offset + u_row_dir * v_uv.y);\n"
+		"  float x = clamp(texture(u_image, uv).r, 0, 1);\n"
+		"  vec3 c = clamp(min(4 * x - vec3(1.5, .5, -.5),\n"
+		"      -4 * x + vec3(4.5, 3.5, 2.5)), 0, 1);\n"
+		"  color = c * step(1e-6, x);\n"
+		"}\n";
+
+
+const char *XYVertexShaderCode = "#version 440 core\n"
+		"layout(location =   1) in      float a_x;\n"
+		"layout(location =   2) in      float a_y;\n"
+		"layout(location =  10) out     vec2  v_pos;\n"
+		"layout(location = 201) uniform mat4 u_tform = mat4(1);\n"
+		"void main() {\n"
+		"  v_pos = vec2(a_x, a_y);\n"
+		"  gl_Position = u_tform * vec4(v_pos, 0, 1);\n"
+		"}\n";
+
+
+const char *CopyFragmentShaderCode = "#version 440 core\n"
+		"layout(location =  10) in      vec2 v_uv;\n"
+		"layout(binding = 0)    uniform sampler2D u_image;\n"
+		"out vec3 color;\n"
+		"void main() {\n"
+		"  color = texture(u_image, v_uv).rgb;\n"
+		"}\n";
+
+
+// One work group per 4096 samples at most, each binning into shared
+// memory first so the global atomics are one per bin and group.
+const char *BinComputeShaderCode = "#version 440 core\n"
+		"layout(local_size_x = 256) in;\n"
+		"layout(std430, binding = 0) readonly buffer Samples { float s[]; };\n"
+		"layout(std430, binding = 1) buffer Counts { uint h[]; };\n"
+		"layout(location = 201) uniform mat4 u_tform = mat4(1);\n"
+		"layout(location = 206) uniform uint u_first;\n"
+		"layout(location = 207) uniform uint u_count;\n"
+		"layout(location = 208) uniform uint u_channel;\n"
+		"layout(location = 209) uniform uint u_bins;\n"
+		"layout(location = 210) uniform uint u_peaks;\n"
+		"shared uint local_h[1024];\n"
+		"void main() {\n"
+		"  uint id = gl_LocalInvocationID.x;\n"
+		"  for (uint i = id; i < u_bins; i += 256)\n"
+		"    local_h[i] = 0;\n"
+		"  barrier();\n"
+		"  uint stride = gl_NumWorkGroups.x * 256;\n"
+		"  for (uint i = gl_GlobalInvocationID.x; i < u_count; i += stride) {\n"
+		"    vec4 p = u_tform * vec4(0, s[u_first + i], 0, 1);\n"
+		"    float y = (p.y / p.w + 1) * .5;\n"
+		"    if (y >= 0 && y < 1)\n"
+		"      atomicAdd(local_h[min(uint(y * u_bins), u_bins - 1)], 1u);\n"
+		"  }\n"
+		"  barrier();\n"
+		"  for (uint i = id; i < u_bins; i += 256) {\n"
+		"    uint n = local_h[i];\n"
+		"    if (n == 0)\n"
+		"      continue;\n"
+		"    n += atomicAdd(h[u_channel * u_bins + i], n);\n"
+		"    atomicMax(h[u_peaks + u_channel], n);\n"
+		"  }\n"
+		"}\n";
+
+
+// Bars grow from the left of the panel, log scaled to the fullest bin of
+// their channel, and add up where channels overlap.
+const char *HistogramFragmentShaderCode = "#version 440 core\n"
+		"layout(location =  10) in      vec2 v_uv;\n"
+		"layout(std430, binding = 1) readonly buffer Counts { uint h[]; };\n"
+		"layout(location = 209) uniform uint u_bins;\n"
+		"layout(location = 210) uniform uint u_peaks;\n"
+		"layout(location = 211) uniform int u_channels;\n"
+		"layout(location = 212) uniform vec4 u_colors[16];\n"
+		"out vec3 color;\n"
+		"void main() {\n"
+		"  uint bin = min(uint(v_uv.y * u_bins), u_bins - 1);\n"
+		"  vec3 c = vec3(.05);\n"
+		"  for (int i = 0; i < u_channels; i++) {\n"
+		"    float n = float(h[i * u_bins + bin]);\n"
+		"    float peak = float(h[u_peaks + i]);\n"
+		"    float len = n > 0 ? log(1 + n) / log(1 + peak) : -1;\n"
+		"    c += u_colors[i].rgb * u_colors[i].a * .75 * step(v_uv.x, len);\n"
+		"  }\n"
+		"  color = c;\n"
+		"}\n";
+
+
+// Output vertex i sits at sample position t, from u_from to u_to in out
+// even steps; it is the sum of the samples within 8 of t weighted by a Blackman
+// windowed sinc, normalized so a constant comes out unchanged. Samples
+// past the ends repeat the first and last ones.
+const char *SincComputeShaderCode = "#version 440 core\n"
+		"layout(local_size_x = 64) in;\n"
+		"layout(std430, binding = 0) readonly buffer Samples { float s[]; };\n"
+		"layout(std430, binding = 2) writeonly buffer Out { float o[]; };\n"
+		"layout(location = 206) uniform int u_count;\n"
+		"layout(location = 207) uniform int u_out;\n"
+		"layout(location = 208) uniform float u_from;\n"
+		"layout(location = 209) uniform float u_to;\n"
+		"const int R = 8;\n"
+		"const float PI = 3.14159265;\n"
+		"void main() {\n"
+		"  int i = int(gl_GlobalInvocationID.x);\n"
+		"  if (i >= u_out)\n"
+		"    return;\n"
+		"  float t = u_from + float(i) * (u_to - u_from) / float(u_out - 1);\n"
+		"  int k0 = int(floor(t));\n"
+		"  float acc = 0, norm = 0;\n"
+		"  for (int k = k0 - R + 1; k <= k0 + R; k++) {\n"
+		"    float x = t - float(k);\n"
+		"    float w = abs(x) < 1e-6 ? 1 : sin(PI * x) / (PI * x);\n"
+		"    w *= .42 + .5 * cos(PI * x / R) + .08 * cos(2 * PI * x / R);\n"
+		"    acc += w * s[clamp(k, 0, u_count - 1)];\n"
+		"    norm += w;\n"
+		"  }\n"
+		"  o[i] = acc / norm;\n"
+		"}\n";
+
+
 void handleGlError() {
 	GLenum err = glGetError();
 	if (err != GL_NO_ERROR) {
@@ -100,7 +238,7 @@ int CheckProgram(GLuint ProgramID) {
 }
 
 
-GLuint LoadShaders() {
+GLuint LoadShaders(const char *VertexCode, const char *FragmentCode) {
 	GLuint VertexShaderID;
 	GLuint FragmentShaderID;
 	GLuint ProgramID;
@@ -111,13 +249,13 @@ GLuint LoadShaders() {
 
 	// Compile Vertex Shader
 	printf("Compiling shader\n");
-	glShaderSource(VertexShaderID, 1, &VertexShaderCode , NULL);
+	glShaderSource(VertexShaderID, 1, &VertexCode, NULL);
 	glCompileShader(VertexShaderID);
 	CheckShader(VertexShaderID);
 
 	// Compile Fragment Shader
 	printf("Compiling shader\n");
-	glShaderSource(FragmentShaderID, 1, &FragmentShaderCode, NULL);
+	glShaderSource(FragmentShaderID, 1, &FragmentCode, NULL);
 	glCompileShader(FragmentShaderID);
 	CheckShader(FragmentShaderID);
 
@@ -139,12 +277,34 @@ GLuint LoadShaders() {
 }
 
 
-struct gloscope_plot *gloscope_plot_alloc(GLuint num_samples) {
+GLuint LoadComputeShader(const char *ComputeCode) {
+	GLuint ShaderID;
+	GLuint ProgramID;
+
+	printf("Compiling shader\n");
+	ShaderID = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(ShaderID, 1, &ComputeCode, NULL);
+	glCompileShader(ShaderID);
+	CheckShader(ShaderID);
+
+	printf("Linking program\n");
+	ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, ShaderID);
+	glLinkProgram(ProgramID);
+	CheckProgram(ProgramID);
+
+	glDetachShader(ProgramID, ShaderID);
+	glDeleteShader(ShaderID);
+
+	return ProgramID;
+}
+
+
+struct gloscope_plot *gloscope_plot_alloc(GLuint capacity) {
 	struct gloscope_plot *res;
 	res = zalloc(sizeof(*res));
-	res->vert_data = zalloc(num_samples * sizeof(sample_t));
-	res->horz_data = zalloc(num_samples * sizeof(sample_t));
-	res->num_samples = num_samples;
+	res->vert_data = zalloc(capacity * sizeof(sample_t));
+	res->capacity = capacity;
 	res->color.a = 1;
 	res->color.r = 1;
 	res->color.g = 1;
@@ -157,15 +317,166 @@ struct gloscope_plot *gloscope_plot_alloc(GLuint num_samples) {
 }
 
 
+struct gloscope_image *gloscope_image_alloc(int width, int height) {
+	struct gloscope_image *res;
+	res = zalloc(sizeof(*res));
+	res->data = zalloc((size_t) width * height * sizeof(float));
+	res->width = width;
+	res->height = height;
+	res->dirty = 1;
+	res->tform[0] = 1.f;
+	res->tform[5] = 1.f;
+	res->tform[10] = 1.f;
+	res->tform[15] = 1.f;
+	return res;
+}
+
+
+void gloscope_image_push_row(struct gloscope_image *image, const float *row) {
+	memcpy(image->data + (size_t) image->head * image->width, row,
+			image->width * sizeof(float));
+	image->head = (image->head + 1) % image->height;
+	if (image->pending < image->height)
+		image->pending++;
+}
+
+
+struct gloscope_xy *gloscope_xy_alloc(void) {
+	struct gloscope_xy *res;
+	res = zalloc(sizeof(*res));
+	res->color.r = 1;
+	res->color.g = 1;
+	res->color.b = 1;
+	res->color.a = 1;
+	res->tform[0] = 1.f;
+	res->tform[5] = 1.f;
+	res->tform[10] = 1.f;
+	res->tform[15] = 1.f;
+	return res;
+}
+
+
+// Adds count samples of both channels as a new segment. Segments that
+// would take the buffers past GLOSCOPE_XY_MAX_SAMPLES before the next
+// frame are dropped.
+void gloscope_xy_push(struct gloscope_xy *xy, const sample_t *x,
+		const sample_t *y, int count) {
+	if (xy->persistence <= 0) {
+		xy->count = 0;
+		xy->num_segments = 0;
+	}
+	if (count < 2)
+		return;
+	if (xy->count + count > GLOSCOPE_XY_MAX_SAMPLES) {
+		xy->dropped++;
+		return;
+	}
+
+	if (xy->count + count > xy->capacity) {
+		xy->capacity = 2 * (xy->count + count);
+		xy->x_data = notnull(realloc(xy->x_data,
+				xy->capacity * sizeof(sample_t)));
+		xy->y_data = notnull(realloc(xy->y_data,
+				xy->capacity * sizeof(sample_t)));
+	}
+	if (xy->num_segments == xy->max_segments) {
+		xy->max_segments = xy->max_segments ? 2 * xy->max_segments : 16;
+		xy->first = notnull(realloc(xy->first,
+				xy->max_segments * sizeof(*xy->first)));
+		xy->counts = notnull(realloc(xy->counts,
+				xy->max_segments * sizeof(*xy->counts)));
+	}
+
+	memcpy(xy->x_data + xy->count, x, count * sizeof(sample_t));
+	memcpy(xy->y_data + xy->count, y, count * sizeof(sample_t));
+	xy->first[xy->num_segments] = (GLint) xy->count;
+	xy->counts[xy->num_segments] = count;
+	xy->num_segments++;
+	xy->count += count;
+	xy->dirty = 1;
+}
+
+
+struct gloscope_histogram *gloscope_histogram_alloc(int bins) {
+	struct gloscope_histogram *res;
+	res = zalloc(sizeof(*res));
+	res->bins = bins;
+	res->width = .2f;
+	res->clear = 1;
+	return res;
+}
+
+
+// Queues count samples of a channel for binning at the next frame. Past
+// GLOSCOPE_HISTOGRAM_MAX_SAMPLES pending samples they are dropped.
+void gloscope_histogram_push(struct gloscope_histogram *h, int channel,
+		const sample_t *samples, int count) {
+	if (count <= 0)
+		return;
+	if (h->count + count > GLOSCOPE_HISTOGRAM_MAX_SAMPLES) {
+		h->dropped++;
+		return;
+	}
+
+	if (h->count + count > h->capacity) {
+		h->capacity = 2 * (h->count + count);
+		h->data = notnull(realloc(h->data, h->capacity * sizeof(sample_t)));
+	}
+	if (h->num_segments == h->max_segments) {
+		h->max_segments = h->max_segments ? 2 * h->max_segments : 16;
+		h->seg_first = notnull(realloc(h->seg_first,
+				h->max_segments * sizeof(int)));
+		h->seg_count = notnull(realloc(h->seg_count,
+				h->max_segments * sizeof(int)));
+		h->seg_channel = notnull(realloc(h->seg_channel,
+				h->max_segments * sizeof(int)));
+	}
+
+	memcpy(h->data + h->count, samples, count * sizeof(sample_t));
+	h->seg_first[h->num_segments] = (int) h->count;
+	h->seg_count[h->num_segments] = count;
+	h->seg_channel[h->num_segments] = channel;
+	h->num_segments++;
+	h->count += count;
+}
+
+
+struct gloscope_zoom *gloscope_zoom_alloc(int start, int stop) {
+	struct gloscope_zoom *zoom = zalloc(sizeof(*zoom));
+	zoom->start = start;
+	zoom->stop = stop;
+	zoom->height = .5f;
+	zoom->band = (struct gloscope_color) { 1, 1, 1, .15f };
+	return zoom;
+}
+
+
+// The part of a frame of count samples the zoom covers, 0 if none.
+int zoom_range(const struct gloscope_zoom *zoom, int count, int *start,
+		int *stop) {
+	if (zoom == NULL)
+		return 0;
+	*start = zoom->start < 0 ? 0 : zoom->start < count ? zoom->start : count;
+	*stop = zoom->stop < 0 ? 0 : zoom->stop < count ? zoom->stop : count;
+	return *stop - *start >= 2;
+}
+
+
 void gloscope_plot_free(struct gloscope_plot *plot) {
+	if (plot->vbo != 0)
+		glDeleteBuffers(1, &plot->vbo);
+	if (plot->sinc_vbo != 0)
+		glDeleteBuffers(1, &plot->sinc_vbo);
+	if (plot->zoom_vbo != 0)
+		glDeleteBuffers(1, &plot->zoom_vbo);
 	free(plot->vert_data);
-	free(plot->horz_data);
 	free(plot);
 }
 
 
+// Plots get room for a min/max vertex pair per column.
 void gloscope_reshape(struct gloscope_context *ctx, int num_channels
-		, GLuint num_samples) {
+		, GLuint columns) {
 	struct gloscope_color default_colors[16] = {
 			{1,1,0,1},{0,.5,1,1},{1,0,0,1},{0,1,0,1},
 			{0,0,1,1},{1,0,1,1},{0,1,1,1},{1,.5,0,1},
@@ -174,38 +485,99 @@ void gloscope_reshape(struct gloscope_context *ctx, int num_channels
 	};
 
 	if (ctx->num_channels != 0) {
-		for (int i = 0; i < num_channels; i++) {
+		for (int i = 0; i < ctx->num_channels; i++) {
 			gloscope_plot_free(ctx->plots[i]);
 		}
 		free(ctx->plots);
 	}
 
 	ctx->num_channels = num_channels;
+	ctx->columns = columns < 2 ? 2 : columns;
 
 	if (num_channels != 0) {
 		ctx->plots = zalloc(num_channels * sizeof(*ctx->plots));
 		for (int i = 0; i < num_channels; i++) {
 			struct gloscope_plot *plot;
-			plot = gloscope_plot_alloc(num_samples);
+			plot = gloscope_plot_alloc(2 * ctx->columns);
 			ctx->plots[i] = plot;
-
-			GLfloat horzScale = 1.f / (num_samples-1);
 			plot->color = default_colors[i % 16];
-			for (unsigned int j = 0; j < num_samples; j++) {
-				plot->horz_data[j] = j * horzScale;
+		}
+	}
+}
+
+
+// Follows the framebuffer width. Plot buffers only ever grow; the data
+// already set keeps its own layout until the next gloscope_plot_set.
+void gloscope_resize(struct gloscope_context *ctx, int columns) {
+	ctx->columns = columns < 2 ? 2 : columns;
+	GLuint capacity = 2 * ctx->columns;
+
+	for (int i = 0; i < ctx->num_channels; i++) {
+		struct gloscope_plot *plot = ctx->plots[i];
+		if (plot->capacity >= capacity)
+			continue;
+		plot->vert_data = notnull(realloc(plot->vert_data,
+				capacity * sizeof(sample_t)));
+		plot->capacity = capacity;
+	}
+}
+
+
+// Count samples spanning the whole view. Up to one sample per column they
+// are drawn as they are, beyond that each column gets the minimum and the
+// maximum of its samples, so the vertex count never exceeds twice the
+// column count and no peak is lost. With a zoom, the columns are those of
+// the whole frame at the zoomed scale.
+void gloscope_plot_set(struct gloscope_context *ctx,
+		struct gloscope_plot *plot, const sample_t *samples, int count) {
+	int columns = ctx->columns;
+	int start, stop;
+
+	if (zoom_range(ctx->zoom, count, &start, &stop)) {
+		int64_t zoomed = (int64_t) columns * count / (stop - start) + 1;
+		if (zoomed > columns)
+			columns = zoomed < count ? (int) zoomed : count;
+	}
+	GLuint needed = (GLuint) (count <= columns ? count : 2 * columns);
+	if (plot->capacity < needed) {
+		plot->vert_data = notnull(realloc(plot->vert_data,
+				needed * sizeof(sample_t)));
+		plot->capacity = needed;
+	}
+
+	plot->frame_samples = count;
+	if (count <= columns) {
+		memcpy(plot->vert_data, samples, count * sizeof(sample_t));
+		plot->num_samples = count;
+		plot->x_step = count > 1 ? 1.f / (count - 1) : 0;
+		plot->x_shift = 0;
+	} else {
+		sample_t *out = plot->vert_data;
+		for (int i = 0; i < columns; i++) {
+			int from = (int) ((int64_t) i * count / columns);
+			int to = (int) ((int64_t) (i + 1) * count / columns);
+			sample_t lo = samples[from];
+			sample_t hi = samples[from];
+			for (int j = from + 1; j < to; j++) {
+				lo = samples[j] < lo ? samples[j] : lo;
+				hi = samples[j] > hi ? samples[j] : hi;
 			}
+			out[2 * i] = lo;
+			out[2 * i + 1] = hi;
 		}
+		plot->num_samples = 2 * columns;
+		plot->x_step = 1.f / (columns - 1);
+		plot->x_shift = 1;
 	}
+	plot->dirty = 1;
 }
 
 
 int gloscope_init(struct gloscope_context *ctx,
-		int num_channels, GLuint num_samples) {
+		int num_channels, GLuint columns) {
 	memset(ctx, 0, sizeof(*ctx));
-	GLuint vertVboID;
-	GLuint horzVboID;
 
-	gloscope_reshape(ctx, num_channels, num_samples);
+	gloscope_reshape(ctx, num_channels, columns);
 
 	// Initialize GLEW
 	if (glewInit() != GLEW_OK) {
@@ -213,66 +585,523 @@ int gloscope_init(struct gloscope_context *ctx,
 		//return -1;
 	}
 
-	glGenVertexArrays(1, &horzVboID);
-	glBindVertexArray(horzVboID);
-	glGenBuffers(1, &ctx->_p.horz_vbo);
-
-	glGenVertexArrays(1, &vertVboID);
-	glBindVertexArray(vertVboID);
-	glGenBuffers(1, &ctx->_p.vert_vbo);
+	glGenVertexArrays(1, &ctx->_p.vao);
+	glBindVertexArray(ctx->_p.vao);
 
 	handleGlError();
 
 	// Create shader program
-	ctx->_p.programID = LoadShaders();
+	ctx->_p.programID = LoadShaders(VertexShaderCode, FragmentShaderCode);
+	ctx->_p.imageProgramID = LoadShaders(ImageVertexShaderCode,
+			ImageFragmentShaderCode);
+	ctx->_p.xyProgramID = LoadShaders(XYVertexShaderCode, FragmentShaderCode);
+	ctx->_p.fillProgramID = LoadShaders(ImageVertexShaderCode,
+			FragmentShaderCode);
+	ctx->_p.copyProgramID = LoadShaders(ImageVertexShaderCode,
+			CopyFragmentShaderCode);
+	ctx->_p.binProgramID = LoadComputeShader(BinComputeShaderCode);
+	ctx->_p.histogramProgramID = LoadShaders(ImageVertexShaderCode,
+			HistogramFragmentShaderCode);
+	ctx->_p.sincProgramID = LoadComputeShader(SincComputeShaderCode);
 	ctx->ready = 1;
 
 	return 1;
 }
 
 
-void render_plot(struct gloscope_private *p, const struct gloscope_plot *plot
-		, unsigned int start_idx, unsigned int stop_idx) {
-	if (stop_idx >= plot->num_samples)
-			stop_idx = plot->num_samples-1;
-	int num_samples = 1 + stop_idx - start_idx;
-	GLsizeiptr size = num_samples * sizeof(sample_t);
-	GLsizeiptr offset = start_idx * sizeof(sample_t);
+// Upsamples the raw samples already in the plot's buffer, from sample
+// position from to position to, into columns vertices in *out, which
+// grows with *capacity.
+void sinc_upsample(struct gloscope_private *p, struct gloscope_plot *plot,
+		GLuint *out, GLuint *capacity, float from, float to, int columns) {
+	if (*out == 0)
+		glGenBuffers(1, out);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, *out);
+	if (*capacity < (GLuint) columns) {
+		glBufferData(GL_SHADER_STORAGE_BUFFER, columns * sizeof(sample_t),
+				NULL, GL_DYNAMIC_COPY);
+		*capacity = (GLuint) columns;
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, plot->vbo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, *out);
+
+	glUseProgram(p->sincProgramID);
+	glUniform1i(206, (GLint) plot->num_samples);
+	glUniform1i(207, columns);
+	glUniform1f(208, from);
+	glUniform1f(209, to);
+	glDispatchCompute((GLuint) (columns + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	glUseProgram(p->programID);
+}
+
+
+// Upsamples the whole plot to one vertex per column; returns the buffer
+// to draw from.
+GLuint plot_sinc(struct gloscope_private *p, struct gloscope_plot *plot,
+		int columns, int changed) {
+	if (changed || plot->sinc_vbo == 0 || plot->sinc_columns != columns) {
+		sinc_upsample(p, plot, &plot->sinc_vbo, &plot->sinc_capacity, 0,
+				(float) (plot->num_samples - 1), columns);
+		plot->sinc_columns = columns;
+	}
+	return plot->sinc_vbo;
+}
+
+
+// Uploads the plot only when it changed since the last frame.
+void render_plot(struct gloscope_context *ctx, struct gloscope_plot *plot) {
+	if (plot->num_samples < 2)
+		return;
+
+	int changed = plot->dirty;
+	if (plot->vbo == 0)
+		glGenBuffers(1, &plot->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, plot->vbo);
+	if (plot->dirty) {
+		GLsizeiptr size = plot->num_samples * sizeof(sample_t);
+		if (plot->vbo_capacity < plot->capacity) {
+			glBufferData(GL_ARRAY_BUFFER, plot->capacity * sizeof(sample_t),
+					NULL, GL_STREAM_DRAW);
+			plot->vbo_capacity = plot->capacity;
+		}
+		glBufferSubData(GL_ARRAY_BUFFER, 0, size, plot->vert_data);
+		plot->dirty = 0;
+	}
+
+	GLsizei count = (GLsizei) plot->num_samples;
+	float x_step = plot->x_step;
+	int x_shift = plot->x_shift;
+	if (ctx->sinc && x_shift == 0 && (int) plot->num_samples
+			* GLOSCOPE_SINC_MIN_RATIO <= ctx->columns) {
+		GLuint vbo = plot_sinc(&ctx->_p, plot, ctx->columns, changed);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		count = ctx->columns;
+		x_step = 1.f / (ctx->columns - 1);
+	}
 
 	const struct gloscope_color *color = &plot->color;
 	glUniform4f(200, color->r, color->g, color->b, color->a);
 	glUniformMatrix4fv(201, 1, 0, plot->tform);
+	glUniform1f(204, x_step);
+	glUniform1i(205, x_shift);
+
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	glDrawArrays(GL_LINE_STRIP, 0, count);
+
+	glDisableVertexAttribArray(1);
+}
+
 
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, (*p).horz_vbo);
-	glBufferData(GL_ARRAY_BUFFER, size,
-				plot->horz_data + offset, GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+// Draws the zoomed range of a plot already uploaded by render_plot,
+// stretched over the view: only the vertices in the range, with a margin
+// of one on each side so the trace reaches the edges. A sparse range of
+// raw samples is upsampled like the main view, every frame since the
+// range and the samples change independently.
+void render_zoom(struct gloscope_context *ctx, struct gloscope_plot *plot) {
+	int start, stop;
+	if (plot->num_samples < 2 || plot->vbo == 0
+			|| !zoom_range(ctx->zoom, plot->frame_samples, &start, &stop))
+		return;
 
+	const struct gloscope_color *color = &plot->color;
+	if (ctx->sinc && plot->x_shift == 0
+			&& (stop - start) * GLOSCOPE_SINC_MIN_RATIO <= ctx->columns) {
+		sinc_upsample(&ctx->_p, plot, &plot->zoom_vbo, &plot->zoom_capacity,
+				(float) start, (float) (stop - 1), ctx->columns);
+		glUniform4f(200, color->r, color->g, color->b, color->a);
+		glUniformMatrix4fv(201, 1, 0, plot->tform);
+		glUniform1f(204, 1.f / (ctx->columns - 1));
+		glUniform1i(205, 0);
+
+		glBindBuffer(GL_ARRAY_BUFFER, plot->zoom_vbo);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+		glDrawArrays(GL_LINE_STRIP, 0, ctx->columns);
+		glDisableVertexAttribArray(1);
+		return;
+	}
+
+	// Vertex positions, in columns when decimated
+	float scale = plot->x_shift ? (float) (plot->num_samples >> 1)
+			/ plot->frame_samples : 1;
+	float from = start * scale;
+	float to = (stop - 1) * scale;
+	int first = (int) from > 0 ? ((int) from - 1) << plot->x_shift : 0;
+	int last = ((int) ceilf(to) + 2) << plot->x_shift;
+	last = last < (int) plot->num_samples ? last : (int) plot->num_samples;
+
+	// Maps the range onto [-1, 1] after the plot's own tform
+	float a = 2 * from * plot->x_step - 1;
+	float b = 2 * to * plot->x_step - 1;
+	float k = 2 / (b - a);
+	float tform[16];
+	for (int c = 0; c < 4; c++) {
+		const float *col = plot->tform + 4 * c;
+		tform[4 * c] = k * col[0] - (1 + a * k) * col[3];
+		tform[4 * c + 1] = col[1];
+		tform[4 * c + 2] = col[2];
+		tform[4 * c + 3] = col[3];
+	}
+
+	glUniform4f(200, color->r, color->g, color->b, color->a);
+	glUniformMatrix4fv(201, 1, 0, tform);
+	glUniform1f(204, plot->x_step);
+	glUniform1i(205, plot->x_shift);
+
+	glBindBuffer(GL_ARRAY_BUFFER, plot->vbo);
 	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, (*p).vert_vbo);
-	glBufferData(GL_ARRAY_BUFFER, size,
-				plot->vert_data + offset, GL_STATIC_DRAW);
 	glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glDrawArrays(GL_LINE_STRIP, first, last - first);
+	glDisableVertexAttribArray(1);
+}
+
+
+// Shades the zoomed range of the first plot's frame in the main view.
+void render_zoom_band(struct gloscope_context *ctx) {
+	int start, stop;
+	int count = ctx->plots[0]->frame_samples;
+	if (count < 2 || !zoom_range(ctx->zoom, count, &start, &stop))
+		return;
+
+	float a = 2.f * start / (count - 1) - 1;
+	float b = 2.f * (stop - 1) / (count - 1) - 1;
+	float tform[16] = {
+		(b - a) / 2, 0, 0, 0,
+		0, 1, 0, 0,
+		0, 0, 1, 0,
+		(a + b) / 2, 0, 0, 1,
+	};
+	float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	const struct gloscope_color *color = &ctx->zoom->band;
+
+	glUseProgram(ctx->_p.fillProgramID);
+	glUniform4f(200, color->r, color->g, color->b, color->a);
+	glUniformMatrix4fv(201, 1, 0, tform);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDisable(GL_BLEND);
+	// The XY fade draws with the defaults
+	glUniform4f(200, 1, 1, 1, 1);
+	glUniformMatrix4fv(201, 1, 0, identity);
+}
+
+
+void render_image(struct gloscope_private *p, struct gloscope_image *image) {
+	glActiveTexture(GL_TEXTURE0);
+	if (image->texture == 0) {
+		glGenTextures(1, &image->texture);
+		glBindTexture(GL_TEXTURE_2D, image->texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+				image->ring ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, image->width, image->height,
+				0, GL_RED, GL_FLOAT, image->data);
+		image->dirty = 0;
+		image->pending = 0;
+	}
+	glBindTexture(GL_TEXTURE_2D, image->texture);
+	if (image->dirty) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->width, image->height,
+				GL_RED, GL_FLOAT, image->data);
+		image->dirty = 0;
+	}
+	for (; image->pending > 0; image->pending--) {
+		int row = (image->head - image->pending + image->height)
+				% image->height;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, image->width, 1,
+				GL_RED, GL_FLOAT, image->data + (size_t) row * image->width);
+	}
+
+	glUseProgram(p->imageProgramID);
+	glUniformMatrix4fv(201, 1, 0, image->tform);
+	// A ring spans the row centres from the oldest, at head, at the bottom
+	// up to the newest at the top, so filtering never blends the two
+	// across the seam
+	if (image->ring) {
+		glUniform1f(202, (image->head + .5f) / image->height);
+		glUniform1f(203, (GLfloat) (image->height - 1) / image->height);
+	} else {
+		glUniform1f(202, 0.f);
+		glUniform1f(203, 1.f);
+	}
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
 
-	glDrawArrays(GL_LINE_STRIP, 0, plot->num_samples);
+void draw_xy(struct gloscope_private *p, struct gloscope_xy *xy) {
+	const struct gloscope_color *color = &xy->color;
 
-	glDisableVertexAttribArray(0);
+	glUseProgram(p->xyProgramID);
+	glUniform4f(200, color->r, color->g, color->b, color->a);
+	glUniformMatrix4fv(201, 1, 0, xy->tform);
+
+	for (int i = 0; i < 2; i++) {
+		glBindBuffer(GL_ARRAY_BUFFER, xy->vbo[i]);
+		glEnableVertexAttribArray(1 + i);
+		glVertexAttribPointer(1 + i, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	}
+	glMultiDrawArrays(GL_LINE_STRIP, xy->first, xy->counts,
+			xy->num_segments);
 	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(2);
+}
+
+
+// Makes the persistence buffer the size of the viewport, cleared.
+void xy_framebuffer(struct gloscope_xy *xy, int width, int height) {
+	if (xy->fbo != 0 && xy->width == width && xy->height == height)
+		return;
+
+	if (xy->fbo == 0) {
+		glGenFramebuffers(1, &xy->fbo);
+		glGenTextures(1, &xy->texture);
+	}
+	glBindTexture(GL_TEXTURE_2D, xy->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
+			GL_FLOAT, NULL);
+	glBindFramebuffer(GL_FRAMEBUFFER, xy->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, xy->texture, 0);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	xy->width = width;
+	xy->height = height;
+}
+
+
+double monotonic_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Without persistence the segments are drawn as they are. With it, the
+// offscreen buffer is faded by the time since the last frame, the new
+// segments are added on top and the result is copied to the screen.
+void render_xy(struct gloscope_private *p, struct gloscope_xy *xy) {
+	if (xy->vbo[0] == 0)
+		glGenBuffers(2, xy->vbo);
+	if (xy->dirty) {
+		const sample_t *data[2] = { xy->x_data, xy->y_data };
+		for (int i = 0; i < 2; i++) {
+			glBindBuffer(GL_ARRAY_BUFFER, xy->vbo[i]);
+			if (xy->vbo_capacity < xy->capacity)
+				glBufferData(GL_ARRAY_BUFFER, xy->capacity * sizeof(sample_t),
+						NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, xy->count * sizeof(sample_t),
+					data[i]);
+		}
+		if (xy->vbo_capacity < xy->capacity)
+			xy->vbo_capacity = xy->capacity;
+		xy->dirty = 0;
+	}
+
+	if (xy->persistence <= 0) {
+		draw_xy(p, xy);
+		return;
+	}
+
+	GLint viewport[4], screen;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &screen);
+	xy_framebuffer(xy, viewport[2], viewport[3]);
+	glBindFramebuffer(GL_FRAMEBUFFER, xy->fbo);
+	glViewport(0, 0, xy->width, xy->height);
+
+	double now = monotonic_seconds();
+	double dt = xy->last_render > 0 ? now - xy->last_render : 0;
+	float decay = (float) exp(-(dt < 1 ? dt : 1) / xy->persistence);
+	xy->last_render = now;
+
+	glEnable(GL_BLEND);
+	glBlendColor(decay, decay, decay, decay);
+	glBlendFunc(GL_ZERO, GL_CONSTANT_COLOR);
+	glUseProgram(p->fillProgramID);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBlendFunc(GL_ONE, GL_ONE);
+	if (xy->num_segments > 0)
+		draw_xy(p, xy);
+	glDisable(GL_BLEND);
+	xy->count = 0;
+	xy->num_segments = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, (GLuint) screen);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glUseProgram(p->copyProgramID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, xy->texture);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+
+// Sizes the counts buffer for the channels and clears it when asked to,
+// or when a plot moved so the bins no longer match the view.
+void histogram_prepare(struct gloscope_histogram *h,
+		struct gloscope_context *ctx) {
+	int channels = ctx->num_channels;
+	GLuint size = (GLuint) ((h->bins + 1) * channels) * sizeof(GLuint);
+
+	if (h->num_channels != channels) {
+		h->tforms = notnull(realloc(h->tforms,
+				(channels ? channels : 1) * 16 * sizeof(float)));
+		h->num_channels = channels;
+		h->clear = 1;
+	}
+	for (int c = 0; c < channels; c++) {
+		float *tform = h->tforms + 16 * c;
+		if (memcmp(tform, ctx->plots[c]->tform, 16 * sizeof(float)) != 0) {
+			memcpy(tform, ctx->plots[c]->tform, 16 * sizeof(float));
+			h->clear = 1;
+		}
+	}
+
+	if (h->counts_buffer == 0)
+		glGenBuffers(1, &h->counts_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, h->counts_buffer);
+	if (h->counts_size != size) {
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+		h->counts_size = size;
+		h->clear = 1;
+	}
+	if (h->clear) {
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+				GL_UNSIGNED_INT, NULL);
+		h->clear = 0;
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, h->counts_buffer);
+}
+
+
+// Uploads the samples pushed since the last frame in one go and bins each
+// segment with the tform of its plot.
+void histogram_bin(struct gloscope_private *p, struct gloscope_histogram *h,
+		struct gloscope_context *ctx) {
+	if (h->num_segments == 0)
+		return;
+
+	if (h->samples_buffer == 0)
+		glGenBuffers(1, &h->samples_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, h->samples_buffer);
+	if (h->samples_capacity < h->capacity) {
+		glBufferData(GL_SHADER_STORAGE_BUFFER,
+				h->capacity * sizeof(sample_t), NULL, GL_STREAM_DRAW);
+		h->samples_capacity = h->capacity;
+	}
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, h->count * sizeof(sample_t),
+			h->data);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, h->samples_buffer);
+
+	glUseProgram(p->binProgramID);
+	glUniform1ui(209, (GLuint) h->bins);
+	glUniform1ui(210, (GLuint) (h->bins * h->num_channels));
+	for (int i = 0; i < h->num_segments; i++) {
+		int c = h->seg_channel[i];
+		if (c >= h->num_channels)
+			continue;
+		GLuint count = (GLuint) h->seg_count[i];
+		GLuint groups = (count + 4095) / 4096;
+		glUniformMatrix4fv(201, 1, 0, ctx->plots[c]->tform);
+		glUniform1ui(206, (GLuint) h->seg_first[i]);
+		glUniform1ui(207, count);
+		glUniform1ui(208, (GLuint) c);
+		glDispatchCompute(groups < 64 ? groups : 64, 1, 1);
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	h->count = 0;
+	h->num_segments = 0;
+}
+
+
+void render_histogram(struct gloscope_private *p,
+		struct gloscope_histogram *h, struct gloscope_context *ctx) {
+	histogram_prepare(h, ctx);
+	histogram_bin(p, h, ctx);
+
+	int channels = h->num_channels < 16 ? h->num_channels : 16;
+	GLfloat colors[16 * 4];
+	for (int c = 0; c < channels; c++)
+		memcpy(colors + 4 * c, &ctx->plots[c]->color, 4 * sizeof(GLfloat));
+
+	glUseProgram(p->histogramProgramID);
+	glUniform1ui(209, (GLuint) h->bins);
+	glUniform1ui(210, (GLuint) (h->bins * h->num_channels));
+	glUniform1i(211, channels);
+	if (channels > 0)
+		glUniform4fv(212, channels, colors);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
 
 void gloscope_render(struct gloscope_context *ctx) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	if (ctx->xy != NULL) {
+		render_xy(&ctx->_p, ctx->xy);
+		handleGlError();
+		return;
+	}
+
+	// The histogram panel takes the right of the view
+	GLint viewport[4];
+	int panel = 0;
+	if (ctx->histogram != NULL && ctx->num_channels > 0) {
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		panel = (int) (viewport[2] * ctx->histogram->width);
+		glViewport(viewport[0], viewport[1], viewport[2] - panel,
+				viewport[3]);
+	}
+
+	// The zoom takes the bottom of the plot area
+	GLint area[4];
+	int zoom = 0;
+	glGetIntegerv(GL_VIEWPORT, area);
+	if (ctx->zoom != NULL && !ctx->hide_plots && ctx->num_channels > 0) {
+		zoom = (int) (area[3] * ctx->zoom->height);
+		glViewport(area[0], area[1] + zoom, area[2], area[3] - zoom);
+	}
+
+	if (ctx->image != NULL)
+		render_image(&ctx->_p, ctx->image);
+
+	if (zoom > 0)
+		render_zoom_band(ctx);
+
+	// Reference plots, uploaded once, go under the live ones
 	glUseProgram(ctx->_p.programID);
+	if (!ctx->hide_plots) {
+		for (int r = 0; r < ctx->num_refs; r++) {
+			if (ctx->refs[r] != NULL)
+				render_plot(ctx, ctx->refs[r]);
+		}
+		for (int c = 0; c < ctx->num_channels; c++)
+			render_plot(ctx, ctx->plots[c]);
+	}
 
-	for (int c = 0; c < ctx->num_channels; c++) {
-		struct gloscope_plot *plot;
-		plot = ctx->plots[c];
-		int start_idx = ctx->start_idx;
-		int stop_idx = ctx->stop_idx;
+	if (zoom > 0) {
+		glViewport(area[0], area[1], area[2], zoom);
+		for (int r = 0; r < ctx->num_refs; r++) {
+			if (ctx->refs[r] != NULL)
+				render_zoom(ctx, ctx->refs[r]);
+		}
+		for (int c = 0; c < ctx->num_channels; c++)
+			render_zoom(ctx, ctx->plots[c]);
+		glViewport(area[0], area[1], area[2], area[3]);
+	}
 
-		render_plot(&ctx->_p, plot, start_idx, stop_idx);
+	if (panel > 0) {
+		glViewport(viewport[0] + viewport[2] - panel, viewport[1], panel,
+				viewport[3]);
+		render_histogram(&ctx->_p, ctx->histogram, ctx);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 	}
 	handleGlError();
 }
@@ -1,3 +1,6 @@
+#ifndef GLOSCOPE_H
+#define GLOSCOPE_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
@@ -5,6 +8,10 @@
 #include <GL/glew.h>
 
 #define UNUSED(x) (void)(x)
+#define GLOSCOPE_XY_MAX_SAMPLES (1 << 22)
+#define GLOSCOPE_HISTOGRAM_MAX_SAMPLES (1 << 23)
+#define GLOSCOPE_HISTOGRAM_MAX_BINS 1024
+#define GLOSCOPE_SINC_MIN_RATIO 2
 typedef GLfloat sample_t;
 
 struct gloscope_color {
@@ -14,32 +21,167 @@ struct gloscope_color {
 	GLfloat a;
 };
 
+// vert_data holds num_samples vertices, spread evenly across the view,
+// for a frame of frame_samples samples. Set through gloscope_plot_set,
+// which keeps at most two vertices per pixel column; the buffer is
+// uploaded to vbo only when dirty. With sinc
+// interpolation, a plot of raw samples at least GLOSCOPE_SINC_MIN_RATIO
+// columns apart is upsampled on the GPU into sinc_vbo, one vertex per
+// column, and drawn from there; zoom_vbo does the same for the zoomed
+// range when that is as sparse.
 struct gloscope_plot {
 	GLuint num_samples;
+	GLuint capacity;
 	struct gloscope_color color;
 	sample_t *vert_data;
-	sample_t *horz_data;
+	int frame_samples;
+	float x_step;
+	int x_shift;
+	int dirty;
+	GLuint vbo;
+	GLuint vbo_capacity;
+	GLuint sinc_vbo;
+	GLuint sinc_capacity;
+	int sinc_columns;
+	GLuint zoom_vbo;
+	GLuint zoom_capacity;
+	float tform[16];
+};
+
+// Intensity image drawn behind the plots through a colormap. Values are
+// expected in [0, 1]; set dirty after changing data. A ring image is
+// filled with gloscope_image_push_row instead: only the rows pushed since
+// the last frame are uploaded, and the newest row is drawn at the top.
+struct gloscope_image {
+	int width;
+	int height;
+	float *data;
+	int dirty;
+	int ring;
+	int head;
+	int pending;
 	float tform[16];
+	GLuint texture;
+};
+
+// XY display: x_data drives the horizontal position and y_data the
+// vertical one, from two buffers bound as two vertex attributes. Each
+// gloscope_xy_push adds one segment, drawn as its own line strip. Without
+// persistence a push replaces what was there; with persistence (seconds
+// to fade to 1/e) the segments pushed since the last frame are added into
+// a fading offscreen buffer, so every frame gets drawn even when they
+// arrive faster than the display refreshes.
+struct gloscope_xy {
+	float persistence;
+	struct gloscope_color color;
+	sample_t *x_data;
+	sample_t *y_data;
+	GLuint capacity;
+	GLuint count;
+	GLint *first;
+	GLsizei *counts;
+	int num_segments;
+	int max_segments;
+	int dirty;
+	uint64_t dropped;
+	float tform[16];
+	GLuint vbo[2];
+	GLuint vbo_capacity;
+	GLuint fbo;
+	GLuint texture;
+	int width;
+	int height;
+	double last_render;
+};
+
+// Amplitude histogram of every channel, drawn as a panel taking width of
+// the view at the right of the plots. Pushed frames are only copied; at
+// render they are uploaded once and binned by a compute shader, with
+// atomic adds into a counts buffer that stays on the GPU and accumulates
+// across frames. The bins span the height of the view through the tform
+// of each plot, so they line up with the traces; a tform change clears
+// them, as does setting clear.
+struct gloscope_histogram {
+	int bins;
+	float width;
+	int clear;
+	sample_t *data;
+	GLuint capacity;
+	GLuint count;
+	int *seg_first;
+	int *seg_count;
+	int *seg_channel;
+	int num_segments;
+	int max_segments;
+	uint64_t dropped;
+	int num_channels;
+	float *tforms;
+	GLuint samples_buffer;
+	GLuint samples_capacity;
+	GLuint counts_buffer;
+	GLuint counts_size;
+};
+
+// Second timebase: the frame samples from start to stop, drawn below the
+// main view and taking height of it, with the range marked by band in the
+// main view. It draws from the plot buffers uploaded for the main view,
+// one draw call per plot. While it is set, gloscope_plot_set keeps enough
+// vertices for the zoomed range to still have a pair per column, up to
+// the raw samples, so a narrow range makes the one upload larger.
+struct gloscope_zoom {
+	int start;
+	int stop;
+	float height;
+	struct gloscope_color band;
 };
 
 struct gloscope_private {
 	GLuint programID;
-	GLuint horz_vbo;
-	GLuint vert_vbo;
+	GLuint imageProgramID;
+	GLuint xyProgramID;
+	GLuint fillProgramID;
+	GLuint copyProgramID;
+	GLuint binProgramID;
+	GLuint histogramProgramID;
+	GLuint sincProgramID;
+	GLuint vao;
 };
 
 struct gloscope_context {
 	struct gloscope_private _p;
 	int num_channels;
-	int start_idx;
-	int stop_idx;
+	int columns;
 	int ready;
+	int hide_plots;
+	int sinc;
 	struct gloscope_plot **plots;
+	struct gloscope_image *image;
+	struct gloscope_xy *xy;
+	struct gloscope_histogram *histogram;
+	struct gloscope_zoom *zoom;
+	// Drawn under the plots, and in the zoom; NULL entries are skipped
+	struct gloscope_plot **refs;
+	int num_refs;
 };
 
 int gloscope_init(struct gloscope_context *, int, GLuint);
 void gloscope_render(struct gloscope_context *);
 void gloscope_reshape(struct gloscope_context *, int, GLuint);
+void gloscope_resize(struct gloscope_context *, int);
+void gloscope_plot_set(struct gloscope_context *, struct gloscope_plot *,
+		const sample_t *, int);
+struct gloscope_plot *gloscope_plot_alloc(GLuint);
+void gloscope_plot_free(struct gloscope_plot *);
+struct gloscope_image *gloscope_image_alloc(int, int);
+void gloscope_image_push_row(struct gloscope_image *, const float *);
+struct gloscope_xy *gloscope_xy_alloc(void);
+void gloscope_xy_push(struct gloscope_xy *, const sample_t *, const sample_t *,
+		int);
+struct gloscope_histogram *gloscope_histogram_alloc(int);
+struct gloscope_zoom *gloscope_zoom_alloc(int, int);
+void gloscope_histogram_push(struct gloscope_histogram *, int,
+		const sample_t *, int);
 void *notnull(void *);
 void *zalloc(size_t);
 
+#endif
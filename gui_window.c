@@ -11,7 +11,10 @@ void gl_area_realize(GtkWidget *widget, gpointer user_data) {
 		fprintf(stderr, "gl area error\n");
 		return;
 	}
-	gloscope_init(s->gloscope, s->num_channels, 1024);
+	// One plot column per framebuffer pixel
+	gloscope_init(s->gloscope, s->num_channels,
+			gtk_widget_get_allocated_width(widget)
+			* gtk_widget_get_scale_factor(widget));
 }
 
 
@@ -37,16 +40,80 @@ gboolean gl_area_render(GtkGLArea *area, GdkGLContext *ctx, gpointer user_data)
 
 
 void gl_area_resize(GtkGLArea *area, gint width, gint height, gpointer user_data) {
-	UNUSED(user_data);
+	state_t *s = user_data;
 	gtk_gl_area_make_current(area);
 	glViewport(0, 0, width, height);
+	if (s->gloscope != NULL && s->gloscope->ready)
+		gloscope_resize(s->gloscope, width);
+}
+
+
+#define DECODE_ROWS 4
+#define DECODE_ROW_HEIGHT 16
+
+
+// Annotations of the frame on screen, in bands at the bottom of the plot;
+// each annotation class gets a band and a colour. The longest text that
+// fits the box is shown.
+gboolean decode_overlay_draw(GtkWidget *widget, cairo_t *cr,
+		gpointer user_data) {
+	const double colors[6][3] = {
+			{1,1,0},{0,.5,1},{1,.3,.3},{0,1,0},{1,0,1},{0,1,1},
+	};
+	state_t *s = user_data;
+	struct decode *dc = &s->decode;
+	if (!dc->active || s->decode_frame_length <= 0)
+		return FALSE;
+
+	uint64_t from = (uint64_t) s->decode_frame_start;
+	uint64_t to = from + (uint64_t) s->decode_frame_length;
+	struct decode_annotation *ann = notnull(malloc(DECODE_MAX_ANNOTATIONS
+			* sizeof(*ann)));
+	int count = decode_annotations(dc, from, to, ann,
+			DECODE_MAX_ANNOTATIONS);
+	double width = gtk_widget_get_allocated_width(widget);
+	double height = gtk_widget_get_allocated_height(widget);
+	double scale = width / s->decode_frame_length;
+
+	cairo_set_font_size(cr, DECODE_ROW_HEIGHT - 5);
+	for (int i = 0; i < count; i++) {
+		const struct decode_annotation *a = &ann[i];
+		int row = a->ann_class % DECODE_ROWS;
+		double x0 = ((double) a->start - (double) from) * scale;
+		double x1 = ((double) a->end - (double) from) * scale;
+		double y = height - (row + 1) * DECODE_ROW_HEIGHT;
+		x0 = x0 < 0 ? 0 : x0;
+		x1 = x1 > width ? width : x1;
+		if (x1 - x0 < 1)
+			x1 = x0 + 1;
+
+		const double *color = colors[a->ann_class % 6];
+		cairo_set_source_rgba(cr, color[0], color[1], color[2], .6);
+		cairo_rectangle(cr, x0, y + 1, x1 - x0, DECODE_ROW_HEIGHT - 2);
+		cairo_fill(cr);
+
+		const char *texts[2] = { a->text, a->short_text };
+		for (int t = 0; t < 2; t++) {
+			cairo_text_extents_t extents;
+			cairo_text_extents(cr, texts[t], &extents);
+			if (extents.x_advance + 4 > x1 - x0)
+				continue;
+			cairo_set_source_rgb(cr, 0, 0, 0);
+			cairo_move_to(cr, x0 + (x1 - x0 - extents.x_advance) / 2,
+					y + DECODE_ROW_HEIGHT - 4);
+			cairo_show_text(cr, texts[t]);
+			break;
+		}
+	}
+	free(ann);
+	return FALSE;
 }
 
 
-void scale_skip_value_changed(GtkRange *range, gpointer user_data) {
+void scale_pretrigger_value_changed(GtkRange *range, gpointer user_data) {
 	state_t *s = user_data;
 	gdouble value = gtk_range_get_value(range);
-	cmd_set_skip(s, (int) value);
+	cmd_set_pretrigger(s, (int) value);
 }
 
 
@@ -58,29 +125,31 @@ void combo_samplerate_changed(GtkComboBoxText *widget, gpointer user_data) {
 }
 
 GtkWidget *make_sample_rate_control(struct state *s) {
-	GVariant *gvar;
 	GtkWidget *combo_samplerate = gtk_combo_box_text_new();
-	int res = sr_config_list(s->driver, s->device, NULL, SR_CONF_SAMPLERATE, &gvar);
-	if (res == SR_OK) {
+	GVariant *gvar = device_caps_list(s->devices[0], NULL, SR_CONF_SAMPLERATE);
+	if (gvar != NULL) {
 		GVariantDict *dict = g_variant_dict_new(gvar);
 		GVariant *samplerates = g_variant_dict_lookup_value(dict, "samplerates", G_VARIANT_TYPE_ARRAY);
 		g_variant_dict_unref(dict);
-		gsize num_samplerates = g_variant_n_children(samplerates);
+		// Drivers with a continuous range (e.g. demo) only list steps
+		gsize num_samplerates = samplerates != NULL ? g_variant_n_children(samplerates) : 0;
 		for (gsize i = 0; i < num_samplerates; i++) {
 			GVariant *rate_var = g_variant_get_child_value(samplerates, i);
 			gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo_samplerate), g_variant_print(rate_var, FALSE));
 		}
+		g_variant_unref(gvar);
 	}
 	g_signal_connect(combo_samplerate, "changed", G_CALLBACK(combo_samplerate_changed), s);
 	return combo_samplerate;
 }
 
 
-GtkWidget *make_skip_control(struct state *s) {
-	GtkWidget *scale_skip = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 2048, 1);
-	gtk_widget_set_size_request(scale_skip, 300, 1);
-	g_signal_connect(scale_skip, "value-changed", G_CALLBACK(scale_skip_value_changed), s);
-	return scale_skip;
+GtkWidget *make_pretrigger_control(struct state *s) {
+	GtkWidget *scale_pretrigger = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 2048, 1);
+	gtk_widget_set_size_request(scale_pretrigger, 300, 1);
+	gtk_range_set_value(GTK_RANGE(scale_pretrigger), s->pretrigger);
+	g_signal_connect(scale_pretrigger, "value-changed", G_CALLBACK(scale_pretrigger_value_changed), s);
+	return scale_pretrigger;
 }
 
 GtkWindow *gui_create(struct state *s) {
@@ -103,7 +172,17 @@ GtkWindow *gui_create(struct state *s) {
 	g_signal_connect(gl_area, "resize", G_CALLBACK(gl_area_resize), s);
 	gtk_widget_set_hexpand(gl_area, TRUE);
 	gtk_widget_set_vexpand(gl_area, TRUE);
-	gtk_container_add(GTK_CONTAINER(box), gl_area);
+
+	// Protocol annotations are drawn over the plot
+	GtkWidget *overlay = gtk_overlay_new();
+	gtk_container_add(GTK_CONTAINER(overlay), gl_area);
+	GtkWidget *decode_area = gtk_drawing_area_new();
+	g_signal_connect(decode_area, "draw", G_CALLBACK(decode_overlay_draw), s);
+	gtk_overlay_add_overlay(GTK_OVERLAY(overlay), decode_area);
+	gtk_overlay_set_overlay_pass_through(GTK_OVERLAY(overlay), decode_area,
+			TRUE);
+	s->decode_overlay = decode_area;
+	gtk_container_add(GTK_CONTAINER(box), overlay);
 
 
 	GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
@@ -117,9 +196,9 @@ GtkWindow *gui_create(struct state *s) {
 	gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Running"), 0, 0, 1, 1);
 
 
-	gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Skip"), 0, 1, 1, 1);
-	GtkWidget *scale_skip = make_skip_control(s);
-	gtk_grid_attach(GTK_GRID(grid), scale_skip, 1, 1, 1, 1);
+	gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Pre-trigger"), 0, 1, 1, 1);
+	GtkWidget *scale_pretrigger = make_pretrigger_control(s);
+	gtk_grid_attach(GTK_GRID(grid), scale_pretrigger, 1, 1, 1, 1);
 
 
 	gtk_grid_attach(GTK_GRID(grid), gtk_label_new("Sample rate"), 0, 2, 1, 1);
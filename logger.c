@@ -0,0 +1,432 @@
+#define _FILE_OFFSET_BITS 64
+#include <math.h>
+#include <string.h>
+#include "logger.h"
+
+// A completed interval of one channel waiting for the other channels,
+// with the time of its last sample.
+struct log_pending {
+	struct log_row row;
+	int64_t end_ns;
+};
+
+
+void log_write(struct logger *l, const void *data, size_t size) {
+	if (fwrite(data, 1, size, l->file) != size) {
+		perror("Error writing log");
+		exit(1);
+	}
+}
+
+
+void logger_write_header(struct logger *l) {
+	fseeko(l->file, 0, SEEK_SET);
+	log_write(l, &l->header, sizeof(l->header));
+	fseeko(l->file, 0, SEEK_END);
+	fflush(l->file);
+
+	g_mutex_lock(&l->lock);
+	l->bytes = (uint64_t) ftello(l->file);
+	g_mutex_unlock(&l->lock);
+}
+
+
+// The header is rewritten after every index block, so a log that was not
+// closed properly is still indexed up to there.
+void logger_write_index(struct logger *l) {
+	struct log_index_header index = {
+		LOG_INDEX_MAGIC, (uint32_t) l->index_fill, l->header.last_index
+	};
+	uint64_t offset = (uint64_t) ftello(l->file);
+
+	log_write(l, &index, sizeof(index));
+	log_write(l, l->index, l->index_fill * sizeof(*l->index));
+	l->header.last_index = offset;
+	l->index_fill = 0;
+	logger_write_header(l);
+}
+
+
+void logger_flush_block(struct logger *l) {
+	if (l->block_fill == 0)
+		return;
+
+	struct log_block_header block = {
+		LOG_BLOCK_MAGIC, (uint32_t) l->block_fill, l->header.rows,
+		l->block_time_ns
+	};
+	uint64_t offset = (uint64_t) ftello(l->file);
+
+	log_write(l, &block, sizeof(block));
+	for (int i = 0; i < l->num_channels * LOG_COLUMNS; i++)
+		log_write(l, l->columns + (size_t) i * LOG_BLOCK_ROWS,
+				l->block_fill * sizeof(float));
+
+	l->index[l->index_fill].first_row = l->header.rows;
+	l->index[l->index_fill].offset = offset;
+	l->index_fill++;
+	l->header.rows += l->block_fill;
+	l->block_fill = 0;
+
+	if (l->index_fill == LOG_INDEX_BLOCKS) {
+		logger_write_index(l);
+	} else {
+		g_mutex_lock(&l->lock);
+		l->bytes = (uint64_t) ftello(l->file);
+		g_mutex_unlock(&l->lock);
+	}
+}
+
+
+void log_acc_reset(struct log_acc *a) {
+	a->min = INFINITY;
+	a->max = -INFINITY;
+	a->sum = 0;
+	a->sum_sq = 0;
+	a->count = 0;
+}
+
+
+// Appends a row once every channel has completed the interval.
+void logger_emit(struct logger *l) {
+	int64_t interval_ns = (int64_t) ((double) l->interval * 1e9
+			/ l->header.sample_rate);
+
+	for (;;) {
+		for (int c = 0; c < l->num_channels; c++) {
+			if (l->acc[c].done->len == 0)
+				return;
+		}
+
+		if (l->block_fill == 0) {
+			struct log_pending *first = &g_array_index(l->acc[0].done,
+					struct log_pending, 0);
+			l->block_time_ns = first->end_ns - interval_ns;
+		}
+		for (int c = 0; c < l->num_channels; c++) {
+			struct log_pending *p = &g_array_index(l->acc[c].done,
+					struct log_pending, 0);
+			float *col = l->columns + (size_t) c * LOG_COLUMNS * LOG_BLOCK_ROWS
+					+ l->block_fill;
+			col[0] = p->row.min;
+			col[LOG_BLOCK_ROWS] = p->row.max;
+			col[2 * LOG_BLOCK_ROWS] = p->row.mean;
+			col[3 * LOG_BLOCK_ROWS] = p->row.rms;
+			g_array_remove_index(l->acc[c].done, 0);
+		}
+		l->block_fill++;
+
+		g_mutex_lock(&l->lock);
+		l->rows++;
+		g_mutex_unlock(&l->lock);
+
+		if (l->block_fill == LOG_BLOCK_ROWS)
+			logger_flush_block(l);
+	}
+}
+
+
+void logger_process(struct logger *l, const struct log_chunk *chunk) {
+	struct log_acc *a = &l->acc[chunk->channel];
+	int n = chunk->num_samples;
+
+	for (int i = 0; i < n; i++) {
+		sample_t v = chunk->samples[i];
+		a->min = v < a->min ? v : a->min;
+		a->max = v > a->max ? v : a->max;
+		a->sum += v;
+		a->sum_sq += (double) v * v;
+		if (++a->count < l->interval)
+			continue;
+
+		struct log_pending p;
+		p.row.min = a->min;
+		p.row.max = a->max;
+		p.row.mean = (float) (a->sum / a->count);
+		p.row.rms = (float) sqrt(a->sum_sq / a->count);
+		p.end_ns = chunk->time_ns - (int64_t) ((double) (n - 1 - i) * 1e9
+				/ l->header.sample_rate);
+		g_array_append_val(a->done, p);
+		log_acc_reset(a);
+	}
+}
+
+
+gpointer logger_worker(gpointer data) {
+	struct logger *l = data;
+
+	for (;;) {
+		struct log_chunk *chunk = g_async_queue_pop(l->queue);
+		int n = chunk->num_samples;
+
+		if (n < 0) {
+			free(chunk);
+			break;
+		}
+		if (n == 0) {
+			// Intervals go on across acquisition restarts, only lost
+			// samples start them over. Rows after the gap get a new block
+			// so their time comes from the restarted clock.
+			logger_flush_block(l);
+			if (chunk->lost)
+				log_acc_reset(&l->acc[chunk->channel]);
+		} else {
+			logger_process(l, chunk);
+			logger_emit(l);
+			g_mutex_lock(&l->lock);
+			l->samples += n;
+			g_mutex_unlock(&l->lock);
+		}
+		free(chunk);
+	}
+
+	logger_flush_block(l);
+	if (l->index_fill > 0)
+		logger_write_index(l);
+	else
+		logger_write_header(l);
+	return NULL;
+}
+
+
+int logger_start(struct logger *l, const char *path, int num_channels,
+		uint64_t interval, uint64_t sample_rate) {
+	logger_stop(l);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+	if (l->queue == NULL) {
+		g_mutex_init(&l->lock);
+		l->queue = g_async_queue_new();
+	}
+
+	l->file = file;
+	l->num_channels = num_channels;
+	l->interval = interval;
+	memset(&l->header, 0, sizeof(l->header));
+	memcpy(l->header.magic, LOG_MAGIC, sizeof(l->header.magic));
+	l->header.num_channels = (uint32_t) num_channels;
+	l->header.block_rows = LOG_BLOCK_ROWS;
+	l->header.interval = interval;
+	l->header.sample_rate = sample_rate;
+	l->header.start_time_ns = g_get_real_time() * 1000;
+
+	l->acc = zalloc(num_channels * sizeof(*l->acc));
+	for (int c = 0; c < num_channels; c++) {
+		log_acc_reset(&l->acc[c]);
+		l->acc[c].done = g_array_new(FALSE, FALSE, sizeof(struct log_pending));
+	}
+	l->columns = zalloc((size_t) num_channels * LOG_COLUMNS * LOG_BLOCK_ROWS
+			* sizeof(float));
+	l->block_fill = 0;
+	l->index_fill = 0;
+	l->samples = 0;
+	l->rows = 0;
+	logger_write_header(l);
+
+	l->thread = g_thread_new("logger", logger_worker, l);
+	l->active = 1;
+	return 1;
+}
+
+
+void logger_stop(struct logger *l) {
+	if (!l->active)
+		return;
+	l->active = 0;
+	struct log_chunk *chunk = zalloc(sizeof(*chunk));
+	chunk->num_samples = -1;
+	g_async_queue_push(l->queue, chunk);
+	g_thread_join(l->thread);
+	l->thread = NULL;
+
+	fclose(l->file);
+	l->file = NULL;
+	for (int c = 0; c < l->num_channels; c++)
+		g_array_free(l->acc[c].done, TRUE);
+	free(l->acc);
+	free(l->columns);
+	l->acc = NULL;
+	l->columns = NULL;
+}
+
+
+// Queues a copy of the samples of channel c, stamped with the current
+// time for the last one; n == 0 marks a gap in the stream, where samples
+// were lost if samples is NULL.
+void logger_push(struct logger *l, int c, const sample_t *samples, int n) {
+	if (!l->active)
+		return;
+	struct log_chunk *chunk = notnull(malloc(sizeof(*chunk)
+			+ n * sizeof(sample_t)));
+	chunk->channel = c;
+	chunk->num_samples = n;
+	chunk->lost = samples == NULL;
+	chunk->time_ns = g_get_real_time() * 1000;
+	if (n > 0)
+		memcpy(chunk->samples, samples, n * sizeof(sample_t));
+	g_async_queue_push(l->queue, chunk);
+}
+
+
+int log_read_at(FILE *file, uint64_t offset, void *data, size_t size) {
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0
+			&& fread(data, 1, size, file) == size;
+}
+
+
+uint64_t log_block_size(const struct log_file *f, uint32_t rows) {
+	return sizeof(struct log_block_header) + (uint64_t) f->header.num_channels
+			* LOG_COLUMNS * rows * sizeof(float);
+}
+
+
+// Blocks must follow each other without missing rows.
+int log_add_block(struct log_file *f, uint64_t offset) {
+	struct log_block_header block;
+	if (!log_read_at(f->file, offset, &block, sizeof(block))
+			|| block.magic != LOG_BLOCK_MAGIC || block.first_row != f->rows
+			|| block.rows == 0 || block.rows > f->header.block_rows)
+		return 0;
+
+	// Grows to the next power of two
+	if ((f->num_blocks & (f->num_blocks - 1)) == 0)
+		f->blocks = notnull(realloc(f->blocks, (f->num_blocks ? 2 * f->num_blocks
+				: 1) * sizeof(*f->blocks)));
+	struct log_block_info *b = &f->blocks[f->num_blocks++];
+	b->first_row = block.first_row;
+	b->offset = offset;
+	b->rows = block.rows;
+	b->time_ns = block.time_ns;
+	f->rows += block.rows;
+	return 1;
+}
+
+
+// Loads the block table from the index blocks, then scans whatever was
+// written after the last one (all of the file if the index is damaged).
+int log_open(struct log_file *f, const char *path) {
+	memset(f, 0, sizeof(*f));
+	f->file = fopen(path, "rb");
+	if (f->file == NULL) {
+		perror(path);
+		return 0;
+	}
+	if (!log_read_at(f->file, 0, &f->header, sizeof(f->header))
+			|| memcmp(f->header.magic, LOG_MAGIC, sizeof(f->header.magic))
+			|| f->header.num_channels == 0 || f->header.interval == 0
+			|| f->header.sample_rate == 0 || f->header.block_rows == 0) {
+		fprintf(stderr, "%s: not a rokscope log\n", path);
+		fclose(f->file);
+		f->file = NULL;
+		return 0;
+	}
+
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(struct log_index_entry));
+	uint64_t offset = f->header.last_index;
+	while (offset != 0) {
+		struct log_index_header index;
+		struct log_index_entry e[LOG_INDEX_BLOCKS];
+		if (!log_read_at(f->file, offset, &index, sizeof(index))
+				|| index.magic != LOG_INDEX_MAGIC
+				|| index.count > LOG_INDEX_BLOCKS
+				|| fread(e, sizeof(*e), index.count, f->file) != index.count
+				|| index.prev_index >= offset) {
+			g_array_set_size(entries, 0);
+			break;
+		}
+		g_array_prepend_vals(entries, e, index.count);
+		offset = index.prev_index;
+	}
+
+	offset = sizeof(f->header);
+	for (guint i = 0; i < entries->len; i++) {
+		struct log_index_entry *e = &g_array_index(entries,
+				struct log_index_entry, i);
+		if (!log_add_block(f, e->offset))
+			break;
+		offset = e->offset + log_block_size(f, f->blocks[f->num_blocks - 1].rows);
+	}
+	g_array_free(entries, TRUE);
+
+	for (;;) {
+		struct log_index_header index;
+		if (log_add_block(f, offset)) {
+			offset += log_block_size(f, f->blocks[f->num_blocks - 1].rows);
+		} else if (log_read_at(f->file, offset, &index, sizeof(index))
+				&& index.magic == LOG_INDEX_MAGIC) {
+			offset += sizeof(index) + index.count
+					* sizeof(struct log_index_entry);
+		} else {
+			break;
+		}
+	}
+	return 1;
+}
+
+
+void log_close(struct log_file *f) {
+	if (f->file != NULL)
+		fclose(f->file);
+	free(f->blocks);
+	memset(f, 0, sizeof(*f));
+}
+
+
+int log_find_block(const struct log_file *f, uint64_t row) {
+	int lo = 0, hi = f->num_blocks - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (f->blocks[mid].first_row <= row)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+
+// Reads count rows of channel c starting at row first; returns the
+// number of rows read.
+int log_read(struct log_file *f, int c, uint64_t first, uint64_t count,
+		struct log_row *out) {
+	float column[LOG_BLOCK_ROWS];
+	int n = 0;
+
+	while (count > 0 && first < f->rows) {
+		const struct log_block_info *b = &f->blocks[log_find_block(f, first)];
+		uint32_t i = (uint32_t) (first - b->first_row);
+		uint32_t m = b->rows - i;
+		if (m > count)
+			m = (uint32_t) count;
+		if (m > LOG_BLOCK_ROWS)
+			m = LOG_BLOCK_ROWS;
+
+		for (int k = 0; k < LOG_COLUMNS; k++) {
+			uint64_t offset = b->offset + sizeof(struct log_block_header)
+					+ (((uint64_t) c * LOG_COLUMNS + k) * b->rows + i)
+					* sizeof(float);
+			if (!log_read_at(f->file, offset, column, m * sizeof(float)))
+				return n;
+			for (uint32_t j = 0; j < m; j++)
+				((float *) &out[n + j])[k] = column[j];
+		}
+		n += m;
+		first += m;
+		count -= m;
+	}
+	return n;
+}
+
+
+// Start time of a row. Rows are evenly spaced within a block; the block
+// timestamps show the time lost to gaps in the capture.
+int64_t log_row_time(const struct log_file *f, uint64_t row) {
+	if (f->num_blocks == 0)
+		return f->header.start_time_ns;
+	const struct log_block_info *b = &f->blocks[log_find_block(f, row)];
+	return b->time_ns + (int64_t) ((double) (row - b->first_row)
+			* f->header.interval * 1e9 / f->header.sample_rate);
+}
@@ -0,0 +1,131 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <glib.h>
+#include "gloscope.h"
+
+/*
+ * Long-term log: every channel reduced to min/max/mean/RMS over intervals
+ * of a fixed number of samples, one row per interval.
+ *
+ * The file starts with a struct log_header, followed by data blocks of up
+ * to LOG_BLOCK_ROWS rows. A data block is a struct log_block_header and
+ * then, for every channel, the min, max, mean and RMS columns of its rows
+ * (rows floats each). After every LOG_INDEX_BLOCKS data blocks, and when
+ * the log is closed, an index block lists the first row and offset of the
+ * data blocks written since the previous one; index blocks are chained
+ * backwards from header.last_index.
+ */
+
+#define LOG_MAGIC "ROKLOG1"
+#define LOG_BLOCK_MAGIC 0x4b424c52
+#define LOG_INDEX_MAGIC 0x58494c52
+#define LOG_BLOCK_ROWS 1024
+#define LOG_INDEX_BLOCKS 64
+#define LOG_COLUMNS 4
+
+struct log_header {
+	char magic[8];
+	uint32_t num_channels;
+	uint32_t block_rows;
+	uint64_t interval;
+	uint64_t sample_rate;
+	int64_t start_time_ns;
+	uint64_t last_index;
+	uint64_t rows;
+};
+
+struct log_block_header {
+	uint32_t magic;
+	uint32_t rows;
+	uint64_t first_row;
+	int64_t time_ns;
+};
+
+struct log_index_header {
+	uint32_t magic;
+	uint32_t count;
+	uint64_t prev_index;
+};
+
+struct log_index_entry {
+	uint64_t first_row;
+	uint64_t offset;
+};
+
+struct log_row {
+	float min;
+	float max;
+	float mean;
+	float rms;
+};
+
+struct log_acc {
+	float min;
+	float max;
+	double sum;
+	double sum_sq;
+	uint64_t count;
+	GArray *done;
+};
+
+struct log_chunk {
+	int channel;
+	int num_samples;
+	int lost;
+	int64_t time_ns;
+	sample_t samples[];
+};
+
+// Writer. The capture side queues the stream of every channel, a worker
+// thread reduces it and appends the rows.
+struct logger {
+	int active;
+	int num_channels;
+	uint64_t interval;
+	GThread *thread;
+	GAsyncQueue *queue;
+	FILE *file;
+	struct log_header header;
+	// Worker only
+	struct log_acc *acc;
+	float *columns;
+	int block_fill;
+	int64_t block_time_ns;
+	struct log_index_entry index[LOG_INDEX_BLOCKS];
+	int index_fill;
+	// Protected by lock
+	GMutex lock;
+	uint64_t samples;
+	uint64_t rows;
+	uint64_t bytes;
+};
+
+int logger_start(struct logger *, const char *, int, uint64_t, uint64_t);
+void logger_stop(struct logger *);
+void logger_push(struct logger *, int, const sample_t *, int);
+
+// Reader
+struct log_block_info {
+	uint64_t first_row;
+	uint64_t offset;
+	uint32_t rows;
+	int64_t time_ns;
+};
+
+struct log_file {
+	FILE *file;
+	struct log_header header;
+	struct log_block_info *blocks;
+	int num_blocks;
+	uint64_t rows;
+};
+
+int log_open(struct log_file *, const char *);
+void log_close(struct log_file *);
+int log_read(struct log_file *, int, uint64_t, uint64_t, struct log_row *);
+int64_t log_row_time(const struct log_file *, uint64_t);
+
+#endif
@@ -0,0 +1,365 @@
+#include <math.h>
+#include "rokscope.h"
+
+#define LOGVIEW_LOD_FACTOR 16
+#define LOGVIEW_AXIS_HEIGHT 20
+#define LOGVIEW_MIN_ROWS_PER_PIXEL (1. / 16)
+
+/*
+ * Viewer for logs written by the logger. Zoomed out, the plot is drawn
+ * from a pyramid of reduced rows kept in memory, each level merging
+ * LOGVIEW_LOD_FACTOR rows of the level below; once there are fewer rows
+ * than that per pixel, the visible rows are read from the file through
+ * the block index.
+ */
+struct logview {
+	struct log_file log;
+	int num_levels;
+	uint64_t *level_scale;
+	uint64_t *level_rows;
+	struct log_row **levels;
+	float (*range)[2];
+	struct log_row *buffer;
+	uint64_t buffer_size;
+	double first;
+	double rows_per_pixel;
+	gboolean dragging;
+	double drag_x;
+	double drag_first;
+};
+
+struct logview_acc {
+	float min;
+	float max;
+	double sum;
+	double sum_sq;
+	int count;
+};
+
+
+void logview_acc_reset(struct logview_acc *a) {
+	a->min = INFINITY;
+	a->max = -INFINITY;
+	a->sum = 0;
+	a->sum_sq = 0;
+	a->count = 0;
+}
+
+
+// Rows cover equal intervals, so the mean of the means is the mean and
+// the RMS is the root of the mean of the squared RMS values.
+void logview_acc_add(struct logview_acc *a, const struct log_row *r) {
+	a->min = r->min < a->min ? r->min : a->min;
+	a->max = r->max > a->max ? r->max : a->max;
+	a->sum += r->mean;
+	a->sum_sq += (double) r->rms * r->rms;
+	a->count++;
+}
+
+
+void logview_acc_get(const struct logview_acc *a, struct log_row *r) {
+	r->min = a->min;
+	r->max = a->max;
+	r->mean = (float) (a->sum / a->count);
+	r->rms = (float) sqrt(a->sum_sq / a->count);
+}
+
+
+void logview_reduce(const struct log_row *in, uint64_t n, struct log_row *out) {
+	for (uint64_t i = 0; i < n; i += LOGVIEW_LOD_FACTOR) {
+		struct logview_acc a;
+		logview_acc_reset(&a);
+		for (uint64_t j = i; j < n && j < i + LOGVIEW_LOD_FACTOR; j++)
+			logview_acc_add(&a, &in[j]);
+		logview_acc_get(&a, &out[i / LOGVIEW_LOD_FACTOR]);
+	}
+}
+
+
+// Reads the file once, channel by channel, into the first level, then
+// reduces each level into the next one down to a single row.
+void logview_build(struct logview *v) {
+	int num_channels = (int) v->log.header.num_channels;
+	uint64_t rows = v->log.rows;
+	uint64_t chunk = LOG_BLOCK_ROWS * LOGVIEW_LOD_FACTOR;
+	struct log_row *in = notnull(malloc(chunk * sizeof(*in)));
+
+	v->num_levels = 0;
+	for (uint64_t n = rows; n > 1; n = (n + LOGVIEW_LOD_FACTOR - 1)
+			/ LOGVIEW_LOD_FACTOR)
+		v->num_levels++;
+	if (v->num_levels == 0)
+		v->num_levels = 1;
+	v->level_scale = zalloc(v->num_levels * sizeof(*v->level_scale));
+	v->level_rows = zalloc(v->num_levels * sizeof(*v->level_rows));
+	v->levels = zalloc(v->num_levels * sizeof(*v->levels));
+	v->range = zalloc(num_channels * sizeof(*v->range));
+
+	uint64_t scale = 1, n = rows;
+	for (int l = 0; l < v->num_levels; l++) {
+		scale *= LOGVIEW_LOD_FACTOR;
+		n = (n + LOGVIEW_LOD_FACTOR - 1) / LOGVIEW_LOD_FACTOR;
+		v->level_scale[l] = scale;
+		v->level_rows[l] = n;
+		v->levels[l] = zalloc((n ? n : 1) * num_channels * sizeof(struct log_row));
+	}
+
+	for (int c = 0; c < num_channels; c++) {
+		struct log_row *out = v->levels[0] + c * v->level_rows[0];
+		for (uint64_t first = 0; first < rows; first += chunk) {
+			int got = log_read(&v->log, c, first, chunk, in);
+			logview_reduce(in, (uint64_t) got, out + first / LOGVIEW_LOD_FACTOR);
+		}
+		for (int l = 1; l < v->num_levels; l++)
+			logview_reduce(v->levels[l - 1] + c * v->level_rows[l - 1],
+					v->level_rows[l - 1], v->levels[l] + c * v->level_rows[l]);
+
+		struct log_row *top = v->levels[v->num_levels - 1]
+				+ c * v->level_rows[v->num_levels - 1];
+		v->range[c][0] = rows ? top->min : -1;
+		v->range[c][1] = rows ? top->max : 1;
+		if (!(v->range[c][1] > v->range[c][0])) {
+			v->range[c][0] -= 1e-3f;
+			v->range[c][1] += 1e-3f;
+		}
+	}
+	free(in);
+}
+
+
+// Finest level with at most one of its rows per pixel, -1 for the rows
+// of the file.
+int logview_level(const struct logview *v) {
+	int level = -1;
+	for (int l = 0; l < v->num_levels; l++) {
+		if ((double) v->level_scale[l] > v->rows_per_pixel)
+			break;
+		level = l;
+	}
+	return level;
+}
+
+
+void logview_clamp(struct logview *v, int width) {
+	double max_rpp = (double) v->log.rows / (width > 0 ? width : 1);
+	if (v->rows_per_pixel > max_rpp)
+		v->rows_per_pixel = max_rpp;
+	if (v->rows_per_pixel < LOGVIEW_MIN_ROWS_PER_PIXEL)
+		v->rows_per_pixel = LOGVIEW_MIN_ROWS_PER_PIXEL;
+	double max_first = (double) v->log.rows - width * v->rows_per_pixel;
+	if (v->first > max_first)
+		v->first = max_first;
+	if (v->first < 0)
+		v->first = 0;
+}
+
+
+void logview_draw_axis(struct logview *v, cairo_t *cr, int width, int y) {
+	char label[64];
+
+	cairo_set_source_rgb(cr, .5, .5, .5);
+	cairo_set_line_width(cr, 1);
+	cairo_move_to(cr, 0, y + .5);
+	cairo_line_to(cr, width, y + .5);
+	cairo_stroke(cr);
+
+	for (int x = 0; x < width; x += 160) {
+		uint64_t row = (uint64_t) (v->first + x * v->rows_per_pixel);
+		int64_t t = log_row_time(&v->log, row < v->log.rows ? row
+				: v->log.rows - 1);
+		GDateTime *dt = g_date_time_new_from_unix_local(t / 1000000000);
+		gchar *hms = g_date_time_format(dt, "%H:%M:%S");
+		snprintf(label, sizeof(label), "%s.%03d", hms,
+				(int) (t / 1000000 % 1000));
+		g_free(hms);
+		g_date_time_unref(dt);
+
+		cairo_move_to(cr, x + .5, y);
+		cairo_line_to(cr, x + .5, y + 4);
+		cairo_stroke(cr);
+		cairo_move_to(cr, x + 2, y + LOGVIEW_AXIS_HEIGHT - 5);
+		cairo_show_text(cr, label);
+	}
+}
+
+
+// One lane per channel: a min-max bar for every pixel column with the
+// mean drawn over it.
+gboolean logview_on_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+	const double colors[][3] = {
+		{1,1,0},{0,.5,1},{1,0,0},{0,1,0},{0,0,1},{1,0,1},{0,1,1},{1,.5,0},
+	};
+	struct logview *v = data;
+	int width = gtk_widget_get_allocated_width(widget);
+	int height = gtk_widget_get_allocated_height(widget);
+	int num_channels = (int) v->log.header.num_channels;
+	double lane = (double) (height - LOGVIEW_AXIS_HEIGHT) / num_channels;
+
+	logview_clamp(v, width);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+	if (v->log.rows == 0)
+		return TRUE;
+
+	int level = logview_level(v);
+	uint64_t scale = level < 0 ? 1 : v->level_scale[level];
+	uint64_t count = level < 0 ? v->log.rows : v->level_rows[level];
+	uint64_t e0 = (uint64_t) (v->first / scale);
+	uint64_t e1 = (uint64_t) ceil((v->first + width * v->rows_per_pixel)
+			/ scale) + 1;
+	if (e1 > count)
+		e1 = count;
+
+	for (int c = 0; c < num_channels; c++) {
+		const struct log_row *rows;
+		if (level < 0) {
+			if (v->buffer_size < e1 - e0) {
+				v->buffer_size = e1 - e0;
+				v->buffer = notnull(realloc(v->buffer,
+						v->buffer_size * sizeof(*v->buffer)));
+			}
+			e1 = e0 + (uint64_t) log_read(&v->log, c, e0, e1 - e0, v->buffer);
+			rows = v->buffer - e0;
+		} else {
+			rows = v->levels[level] + c * v->level_rows[level];
+		}
+
+		double top = c * lane;
+		double lo = v->range[c][0], span = v->range[c][1] - v->range[c][0];
+		const double *color = colors[c % 8];
+
+		cairo_set_line_width(cr, 1);
+		cairo_set_source_rgba(cr, color[0], color[1], color[2], .4);
+		for (int x = 0; x < width; x++) {
+			uint64_t i0 = (uint64_t) ((v->first + x * v->rows_per_pixel)
+					/ scale);
+			uint64_t i1 = (uint64_t) ((v->first + (x + 1) * v->rows_per_pixel)
+					/ scale);
+			if (i1 <= i0)
+				i1 = i0 + 1;
+			if (i0 < e0 || i0 >= e1)
+				continue;
+			if (i1 > e1)
+				i1 = e1;
+
+			struct logview_acc a;
+			struct log_row r;
+			logview_acc_reset(&a);
+			for (uint64_t i = i0; i < i1; i++)
+				logview_acc_add(&a, &rows[i]);
+			logview_acc_get(&a, &r);
+
+			cairo_move_to(cr, x + .5, top + lane * (1 - (r.max - lo) / span));
+			cairo_line_to(cr, x + .5, top + lane * (1 - (r.min - lo) / span)
+					+ 1);
+			cairo_stroke(cr);
+		}
+
+		cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+		for (int x = 0; x < width; x++) {
+			uint64_t i = (uint64_t) ((v->first + (x + .5) * v->rows_per_pixel)
+					/ scale);
+			if (i < e0 || i >= e1)
+				continue;
+			cairo_line_to(cr, x + .5, top + lane * (1 - (rows[i].mean - lo)
+					/ span));
+		}
+		cairo_stroke(cr);
+	}
+
+	logview_draw_axis(v, cr, width, height - LOGVIEW_AXIS_HEIGHT);
+	return TRUE;
+}
+
+
+// Zooms around the row under the pointer.
+gboolean logview_on_scroll(GtkWidget *widget, GdkEventScroll *event,
+		gpointer data) {
+	struct logview *v = data;
+	double row = v->first + event->x * v->rows_per_pixel;
+
+	if (event->direction == GDK_SCROLL_UP)
+		v->rows_per_pixel /= 1.25;
+	else if (event->direction == GDK_SCROLL_DOWN)
+		v->rows_per_pixel *= 1.25;
+	else
+		return FALSE;
+	logview_clamp(v, gtk_widget_get_allocated_width(widget));
+	v->first = row - event->x * v->rows_per_pixel;
+	gtk_widget_queue_draw(widget);
+	return TRUE;
+}
+
+
+gboolean logview_on_button(GtkWidget *widget, GdkEventButton *event,
+		gpointer data) {
+	UNUSED(widget);
+	struct logview *v = data;
+	if (event->button != 1)
+		return FALSE;
+	v->dragging = event->type == GDK_BUTTON_PRESS;
+	v->drag_x = event->x;
+	v->drag_first = v->first;
+	return TRUE;
+}
+
+
+gboolean logview_on_motion(GtkWidget *widget, GdkEventMotion *event,
+		gpointer data) {
+	struct logview *v = data;
+	if (!v->dragging)
+		return FALSE;
+	v->first = v->drag_first - (event->x - v->drag_x) * v->rows_per_pixel;
+	gtk_widget_queue_draw(widget);
+	return TRUE;
+}
+
+
+void logview_on_destroy(GtkWidget *widget, gpointer data) {
+	UNUSED(widget);
+	struct logview *v = data;
+	for (int l = 0; l < v->num_levels; l++)
+		free(v->levels[l]);
+	free(v->levels);
+	free(v->level_scale);
+	free(v->level_rows);
+	free(v->range);
+	free(v->buffer);
+	log_close(&v->log);
+	free(v);
+}
+
+
+GtkWindow *logview_create(GtkApplication *application, const char *path) {
+	struct logview *v = zalloc(sizeof(*v));
+	if (!log_open(&v->log, path))
+		exit(1);
+	logview_build(v);
+	v->rows_per_pixel = INFINITY;
+	printf("Log %s: %u channels, %lu rows of %lu samples at %lu Hz\n", path,
+			v->log.header.num_channels, v->log.rows, v->log.header.interval,
+			v->log.header.sample_rate);
+
+	GtkWidget *window = gtk_application_window_new(application);
+	gchar *title = g_path_get_basename(path);
+	gtk_window_set_title(GTK_WINDOW(window), title);
+	g_free(title);
+	gtk_window_set_default_size(GTK_WINDOW(window), 1024, 480);
+
+	GtkWidget *area = gtk_drawing_area_new();
+	gtk_widget_add_events(area, GDK_SCROLL_MASK | GDK_BUTTON_PRESS_MASK
+			| GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK);
+	g_signal_connect(area, "draw", G_CALLBACK(logview_on_draw), v);
+	g_signal_connect(area, "scroll-event", G_CALLBACK(logview_on_scroll), v);
+	g_signal_connect(area, "button-press-event",
+			G_CALLBACK(logview_on_button), v);
+	g_signal_connect(area, "button-release-event",
+			G_CALLBACK(logview_on_button), v);
+	g_signal_connect(area, "motion-notify-event",
+			G_CALLBACK(logview_on_motion), v);
+	g_signal_connect(window, "destroy", G_CALLBACK(logview_on_destroy), v);
+
+	gtk_container_add(GTK_CONTAINER(window), area);
+	gtk_widget_show_all(window);
+	return GTK_WINDOW(window);
+}
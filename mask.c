@@ -0,0 +1,161 @@
+#include "mask.h"
+
+
+void mask_alloc(struct mask *m, int num_channels, int channel,
+		int num_samples) {
+	mask_free(m);
+	m->channel = channel;
+	m->num_samples = num_samples;
+	m->num_channels = num_channels;
+	m->lower = zalloc(num_samples * sizeof(sample_t));
+	m->upper = zalloc(num_samples * sizeof(sample_t));
+	m->num_segments = MASK_SEGMENTS;
+	m->segments = zalloc((size_t) m->num_segments * num_channels
+			* num_samples * sizeof(sample_t));
+	m->segment_frames = zalloc(m->num_segments * sizeof(uint64_t));
+	mask_reset(m);
+}
+
+
+// Mask file: one "lower upper" pair per line, one line per sample position.
+int mask_load(struct mask *m, int num_channels, int channel,
+		const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	int capacity = 1024;
+	int count = 0;
+	sample_t *bounds = notnull(malloc(2 * capacity * sizeof(sample_t)));
+	float lo, hi;
+	while (fscanf(f, "%f %f", &lo, &hi) == 2) {
+		if (count == capacity) {
+			capacity *= 2;
+			bounds = notnull(realloc(bounds, 2 * capacity * sizeof(sample_t)));
+		}
+		bounds[2 * count] = lo;
+		bounds[2 * count + 1] = hi;
+		count++;
+	}
+	fclose(f);
+
+	if (count == 0) {
+		fprintf(stderr, "Mask %s is empty\n", path);
+		free(bounds);
+		return 0;
+	}
+
+	mask_alloc(m, num_channels, channel, count);
+	for (int i = 0; i < count; i++) {
+		m->lower[i] = bounds[2 * i];
+		m->upper[i] = bounds[2 * i + 1];
+	}
+	free(bounds);
+	return 1;
+}
+
+
+void mask_from_golden(struct mask *m, int num_channels, int channel,
+		const sample_t *golden, int num_samples, sample_t tolerance) {
+	mask_alloc(m, num_channels, channel, num_samples);
+	for (int i = 0; i < num_samples; i++) {
+		m->lower[i] = golden[i] - tolerance;
+		m->upper[i] = golden[i] + tolerance;
+	}
+}
+
+
+// Branchless so the compiler can turn it into packed compares.
+int mask_count_violations(const sample_t *samples, const sample_t *lower,
+		const sample_t *upper, int num_samples) {
+	int violations = 0;
+	for (int i = 0; i < num_samples; i++)
+		violations += (samples[i] < lower[i]) | (samples[i] > upper[i]);
+	return violations;
+}
+
+
+// Tests one frame, given as per-channel pointers to the trigger point and
+// the number of samples available after it. Positions past the end of a
+// short frame count as violations. Returns the number of violations.
+int mask_test(struct mask *m, sample_t **frame, int count, uint64_t frame_idx) {
+	if (!m->enabled || m->num_samples == 0)
+		return 0;
+
+	int n = count < m->num_samples ? count : m->num_samples;
+	if (n < 0)
+		n = 0;
+	int violations = mask_count_violations(frame[m->channel], m->lower,
+			m->upper, n);
+	violations += m->num_samples - n;
+
+	m->tested++;
+	if (violations == 0)
+		return 0;
+
+	m->failed++;
+	m->violations += violations;
+
+	size_t seg_size = (size_t) m->num_channels * m->num_samples;
+	sample_t *seg = m->segments + m->next_segment * seg_size;
+	memset(seg, 0, seg_size * sizeof(sample_t));
+	for (int c = 0; c < m->num_channels; c++)
+		memcpy(seg + c * m->num_samples, frame[c], n * sizeof(sample_t));
+	m->segment_frames[m->next_segment] = frame_idx;
+	m->next_segment = (m->next_segment + 1) % m->num_segments;
+	return violations;
+}
+
+
+void mask_reset(struct mask *m) {
+	m->tested = 0;
+	m->failed = 0;
+	m->violations = 0;
+	m->next_segment = 0;
+}
+
+
+// Writes failure capture number idx (0 is the most recent) as text, one
+// line per sample position with one column per channel.
+int mask_save_segment(const struct mask *m, int idx, const char *path) {
+	uint64_t stored = m->failed < (uint64_t) m->num_segments
+			? m->failed : (uint64_t) m->num_segments;
+	if (idx < 0 || (uint64_t) idx >= stored) {
+		fprintf(stderr, "No failure capture %d\n", idx);
+		return 0;
+	}
+
+	int seg_idx = (m->next_segment - 1 - idx + 2 * m->num_segments)
+			% m->num_segments;
+	const sample_t *seg = m->segments
+			+ seg_idx * (size_t) m->num_channels * m->num_samples;
+
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return 0;
+	}
+	fprintf(f, "# frame %lu\n", m->segment_frames[seg_idx]);
+	for (int i = 0; i < m->num_samples; i++) {
+		for (int c = 0; c < m->num_channels; c++)
+			fprintf(f, c == 0 ? "%g" : " %g", seg[c * m->num_samples + i]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 1;
+}
+
+
+void mask_free(struct mask *m) {
+	free(m->lower);
+	free(m->upper);
+	free(m->segments);
+	free(m->segment_frames);
+	m->lower = NULL;
+	m->upper = NULL;
+	m->segments = NULL;
+	m->segment_frames = NULL;
+	m->num_samples = 0;
+}
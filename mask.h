@@ -0,0 +1,37 @@
+#ifndef MASK_H
+#define MASK_H
+
+#include <stdint.h>
+#include "gloscope.h"
+
+#define MASK_SEGMENTS 64
+
+// Pass/fail envelope for one channel, tested against every triggered frame.
+// Failing frames (all channels) are kept in a ring of MASK_SEGMENTS segments.
+struct mask {
+	int enabled;
+	int channel;
+	int num_samples;
+	sample_t *lower;
+	sample_t *upper;
+	uint64_t tested;
+	uint64_t failed;
+	uint64_t violations;
+	int num_channels;
+	int num_segments;
+	int next_segment;
+	sample_t *segments;
+	uint64_t *segment_frames;
+};
+
+int mask_load(struct mask *, int num_channels, int channel, const char *);
+void mask_from_golden(struct mask *, int num_channels, int channel,
+		const sample_t *, int, sample_t);
+int mask_count_violations(const sample_t *, const sample_t *,
+		const sample_t *, int);
+int mask_test(struct mask *, sample_t **, int, uint64_t);
+void mask_reset(struct mask *);
+int mask_save_segment(const struct mask *, int, const char *);
+void mask_free(struct mask *);
+
+#endif
@@ -0,0 +1,219 @@
+#include <string.h>
+#include "gloscope.h"
+#include "pool.h"
+
+
+void pool_graph_clear(struct pool_graph *g) {
+	g->num_tasks = 0;
+}
+
+
+void pool_graph_free(struct pool_graph *g) {
+	for (int i = 0; i < g->max_tasks; i++)
+		free(g->tasks[i].dependents);
+	free(g->tasks);
+	memset(g, 0, sizeof(*g));
+}
+
+
+// Returns the index of the new task.
+int pool_graph_add(struct pool_graph *g, void (*run)(struct pool_task *),
+		void *arg, int index) {
+	if (g->num_tasks == g->max_tasks) {
+		int max = g->max_tasks ? 2 * g->max_tasks : 32;
+		g->tasks = notnull(realloc(g->tasks, max * sizeof(*g->tasks)));
+		memset(g->tasks + g->max_tasks, 0,
+				(max - g->max_tasks) * sizeof(*g->tasks));
+		g->max_tasks = max;
+	}
+	struct pool_task *t = &g->tasks[g->num_tasks];
+	t->run = run;
+	t->arg = arg;
+	t->index = index;
+	t->num_deps = 0;
+	t->num_dependents = 0;
+	return g->num_tasks++;
+}
+
+
+// Task runs only once dep has completed.
+void pool_graph_after(struct pool_graph *g, int task, int dep) {
+	struct pool_task *d = &g->tasks[dep];
+	if (d->num_dependents == d->max_dependents) {
+		d->max_dependents = d->max_dependents ? 2 * d->max_dependents : 4;
+		d->dependents = notnull(realloc(d->dependents,
+				d->max_dependents * sizeof(int)));
+	}
+	d->dependents[d->num_dependents++] = task;
+	g->tasks[task].num_deps++;
+}
+
+
+void pool_push(struct pool *p, int w, int task) {
+	struct pool_deque *q = &p->deques[w];
+	g_mutex_lock(&q->lock);
+	q->items[q->bottom++] = task;
+	g_mutex_unlock(&q->lock);
+
+	g_mutex_lock(&p->lock);
+	p->queued++;
+	g_cond_signal(&p->cond);
+	g_mutex_unlock(&p->lock);
+}
+
+
+// The newest task of worker w's own deque, else the oldest of another's.
+int pool_take(struct pool *p, int w) {
+	int task = -1;
+	int stolen = 0;
+
+	for (int i = 0; i < p->num_workers && task < 0; i++) {
+		struct pool_deque *q = &p->deques[(w + i) % p->num_workers];
+		g_mutex_lock(&q->lock);
+		if (q->top < q->bottom) {
+			if (i == 0) {
+				task = q->items[--q->bottom];
+			} else {
+				task = q->items[q->top++];
+				stolen = 1;
+			}
+		}
+		g_mutex_unlock(&q->lock);
+	}
+
+	if (task >= 0) {
+		g_mutex_lock(&p->lock);
+		p->queued--;
+		p->steals += stolen;
+		g_mutex_unlock(&p->lock);
+	}
+	return task;
+}
+
+
+void pool_execute(struct pool *p, int w, int task) {
+	struct pool_graph *g = p->graph;
+	struct pool_task *t = &g->tasks[task];
+
+	t->run(t);
+	for (int i = 0; i < t->num_dependents; i++) {
+		int next = t->dependents[i];
+		if (g_atomic_int_dec_and_test(&g->tasks[next].pending))
+			pool_push(p, w, next);
+	}
+	if (g_atomic_int_dec_and_test(&g->remaining)) {
+		g_mutex_lock(&p->lock);
+		g_cond_broadcast(&p->cond);
+		g_mutex_unlock(&p->lock);
+	}
+}
+
+
+struct pool_worker {
+	struct pool *p;
+	int w;
+};
+
+
+gpointer pool_worker(gpointer data) {
+	struct pool_worker *pw = data;
+	struct pool *p = pw->p;
+	int w = pw->w;
+	free(pw);
+
+	for (;;) {
+		int task = pool_take(p, w);
+		if (task >= 0) {
+			pool_execute(p, w, task);
+			continue;
+		}
+		g_mutex_lock(&p->lock);
+		while (!p->stop && p->queued == 0)
+			g_cond_wait(&p->cond, &p->lock);
+		int stop = p->stop;
+		g_mutex_unlock(&p->lock);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+
+// num_workers counts the calling thread; 0 picks one per processor, up to
+// POOL_MAX_WORKERS.
+void pool_init(struct pool *p, int num_workers) {
+	memset(p, 0, sizeof(*p));
+	if (num_workers <= 0)
+		num_workers = (int) g_get_num_processors();
+	if (num_workers > POOL_MAX_WORKERS)
+		num_workers = POOL_MAX_WORKERS;
+	if (num_workers < 1)
+		num_workers = 1;
+
+	g_mutex_init(&p->lock);
+	g_cond_init(&p->cond);
+	p->num_workers = num_workers;
+	for (int w = 0; w < num_workers; w++)
+		g_mutex_init(&p->deques[w].lock);
+	for (int w = 1; w < num_workers; w++) {
+		struct pool_worker *pw = notnull(malloc(sizeof(*pw)));
+		pw->p = p;
+		pw->w = w;
+		p->threads[w] = g_thread_new("pool", pool_worker, pw);
+	}
+}
+
+
+void pool_free(struct pool *p) {
+	g_mutex_lock(&p->lock);
+	p->stop = 1;
+	g_cond_broadcast(&p->cond);
+	g_mutex_unlock(&p->lock);
+	for (int w = 1; w < p->num_workers; w++)
+		g_thread_join(p->threads[w]);
+	for (int w = 0; w < p->num_workers; w++)
+		free(p->deques[w].items);
+}
+
+
+// Runs every task of the graph, each after its dependencies, and returns
+// when all are done.
+void pool_run(struct pool *p, struct pool_graph *g) {
+	if (g->num_tasks == 0)
+		return;
+
+	for (int w = 0; w < p->num_workers; w++) {
+		struct pool_deque *q = &p->deques[w];
+		g_mutex_lock(&q->lock);
+		if (q->capacity < g->num_tasks) {
+			q->items = notnull(realloc(q->items, g->num_tasks * sizeof(int)));
+			q->capacity = g->num_tasks;
+		}
+		q->top = 0;
+		q->bottom = 0;
+		g_mutex_unlock(&q->lock);
+	}
+	for (int i = 0; i < g->num_tasks; i++)
+		g_atomic_int_set(&g->tasks[i].pending, g->tasks[i].num_deps);
+	g_atomic_int_set(&g->remaining, g->num_tasks);
+	p->graph = g;
+	p->runs++;
+
+	// Roots go in reverse, so the first added is popped first
+	for (int i = g->num_tasks - 1; i >= 0; i--) {
+		if (g->tasks[i].num_deps == 0)
+			pool_push(p, 0, i);
+	}
+
+	while (g_atomic_int_get(&g->remaining) > 0) {
+		int task = pool_take(p, 0);
+		if (task >= 0) {
+			pool_execute(p, 0, task);
+			continue;
+		}
+		g_mutex_lock(&p->lock);
+		while (p->queued == 0 && g_atomic_int_get(&g->remaining) > 0)
+			g_cond_wait(&p->cond, &p->lock);
+		g_mutex_unlock(&p->lock);
+	}
+}
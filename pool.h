@@ -0,0 +1,66 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+#include <glib.h>
+
+#define POOL_MAX_WORKERS 8
+
+struct pool_task {
+	void (*run)(struct pool_task *);
+	void *arg;
+	int index;
+	int num_deps;
+	gint pending;
+	int *dependents;
+	int num_dependents;
+	int max_dependents;
+};
+
+// Tasks and the edges between them, rebuilt for every run: clearing keeps
+// the storage, so a graph of the same shape allocates nothing.
+struct pool_graph {
+	struct pool_task *tasks;
+	int num_tasks;
+	int max_tasks;
+	gint remaining;
+};
+
+// Each worker owns a deque of ready task indices; it pushes and pops at
+// the bottom and, when its own is empty, steals from the top of the
+// others'. A task becomes ready on the deque of the worker that completed
+// its last dependency, so a chain of stages tends to stay on one core.
+struct pool_deque {
+	GMutex lock;
+	int *items;
+	int top;
+	int bottom;
+	int capacity;
+};
+
+// Worker 0 is the thread calling pool_run, which works on the graph too
+// until it is complete.
+struct pool {
+	int num_workers;
+	GThread *threads[POOL_MAX_WORKERS];
+	struct pool_deque deques[POOL_MAX_WORKERS];
+	struct pool_graph *graph;
+	// Protected by lock
+	GMutex lock;
+	GCond cond;
+	int queued;
+	int stop;
+	uint64_t runs;
+	uint64_t steals;
+};
+
+void pool_init(struct pool *, int);
+void pool_free(struct pool *);
+void pool_graph_clear(struct pool_graph *);
+void pool_graph_free(struct pool_graph *);
+int pool_graph_add(struct pool_graph *, void (*)(struct pool_task *), void *,
+		int);
+void pool_graph_after(struct pool_graph *, int, int);
+void pool_run(struct pool *, struct pool_graph *);
+
+#endif
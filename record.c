@@ -0,0 +1,550 @@
+#define _FILE_OFFSET_BITS 64
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include "record.h"
+
+struct rec_writer {
+	uint8_t *out;
+	uint64_t acc;
+	int bits;
+};
+
+struct rec_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	int bits;
+	int over;
+};
+
+
+void rec_put(struct rec_writer *w, uint32_t value, int n) {
+	w->acc = (w->acc << n) | value;
+	w->bits += n;
+	while (w->bits >= 8) {
+		w->bits -= 8;
+		*w->out++ = (uint8_t) (w->acc >> w->bits);
+	}
+}
+
+
+// Rice parameter for a partition: the smallest k with 2^k n >= sum.
+int rec_rice_k(const uint32_t *u, int n) {
+	uint64_t sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += u[i];
+	int k = 0;
+	while (k < 30 && ((uint64_t) n << k) < sum)
+		k++;
+	return k;
+}
+
+
+// Encodes n codes, predicted from first, into out, which must have room
+// for 8 bytes per code; returns the size.
+size_t rec_encode(const int32_t *codes, int n, int32_t first, uint8_t *out) {
+	struct rec_writer w = { out, 0, 0 };
+	uint32_t u[REC_PARTITION];
+	int32_t prev = first;
+
+	for (int from = 0; from < n; from += REC_PARTITION) {
+		int count = n - from < REC_PARTITION ? n - from : REC_PARTITION;
+		for (int i = 0; i < count; i++) {
+			int32_t d = (int32_t) ((uint32_t) codes[from + i]
+					- (uint32_t) prev);
+			prev = codes[from + i];
+			u[i] = ((uint32_t) d << 1) ^ (uint32_t) (d >> 31);
+		}
+
+		int k = rec_rice_k(u, count);
+		rec_put(&w, (uint32_t) k, 5);
+		for (int i = 0; i < count; i++) {
+			uint32_t q = u[i] >> k;
+			if (q >= REC_ESCAPE) {
+				rec_put(&w, (1u << REC_ESCAPE) - 1, REC_ESCAPE);
+				rec_put(&w, u[i], 32);
+			} else {
+				rec_put(&w, ((1u << q) - 1) << 1, (int) q + 1);
+				if (k > 0)
+					rec_put(&w, u[i] & ((1u << k) - 1), k);
+			}
+		}
+	}
+	if (w.bits > 0)
+		rec_put(&w, 0, 8 - w.bits);
+	return (size_t) (w.out - out);
+}
+
+
+// Keeps at least 57 bits in the accumulator; past the end it reads zeros.
+void rec_fill(struct rec_reader *r) {
+	while (r->bits <= 56) {
+		uint64_t byte = 0;
+		if (r->p < r->end)
+			byte = *r->p++;
+		else
+			r->over += 8;
+		r->acc |= byte << (56 - r->bits);
+		r->bits += 8;
+	}
+}
+
+
+uint32_t rec_get(struct rec_reader *r, int n) {
+	if (n == 0)
+		return 0;
+	rec_fill(r);
+	uint32_t v = (uint32_t) (r->acc >> (64 - n));
+	r->acc <<= n;
+	r->bits -= n;
+	return v;
+}
+
+
+// Returns 1 when the n codes were decoded, 0 if the data is damaged.
+int rec_decode(const uint8_t *data, size_t size, int n, int32_t first,
+		int32_t *codes) {
+	struct rec_reader r = { data, data + size, 0, 0, 0 };
+	int32_t prev = first;
+
+	for (int from = 0; from < n; from += REC_PARTITION) {
+		int count = n - from < REC_PARTITION ? n - from : REC_PARTITION;
+		int k = (int) rec_get(&r, 5);
+		if (k > 30)
+			return 0;
+		for (int i = 0; i < count; i++) {
+			rec_fill(&r);
+			uint64_t inverted = ~r.acc;
+			int ones = inverted ? __builtin_clzll(inverted) : 64;
+			uint32_t u;
+			if (ones >= REC_ESCAPE) {
+				r.acc <<= REC_ESCAPE;
+				r.bits -= REC_ESCAPE;
+				u = rec_get(&r, 32);
+			} else {
+				r.acc <<= ones + 1;
+				r.bits -= ones + 1;
+				u = ((uint32_t) ones << k) | rec_get(&r, k);
+			}
+			prev = (int32_t) ((uint32_t) prev + ((u >> 1) ^ -(u & 1)));
+			codes[from + i] = prev;
+		}
+	}
+	// Bits made up past the end must not have been consumed
+	return r.over <= r.bits;
+}
+
+
+void rec_write(FILE *file, const void *data, size_t size) {
+	if (fwrite(data, 1, size, file) != size) {
+		perror("Error writing recording");
+		exit(1);
+	}
+}
+
+
+void rec_encode_job(struct recorder *r, const struct rec_job *job,
+		int32_t *codes, uint8_t *out) {
+	gint64 start = g_get_monotonic_time();
+	float inv = 1.f / r->steps[job->channel];
+	int n = job->num_samples;
+
+	for (int i = 0; i < n; i++) {
+		float q = rintf(job->samples[i] * inv);
+		q = q > 2e9f ? 2e9f : q < -2e9f ? -2e9f : q;
+		codes[i] = (int32_t) q;
+	}
+	struct rec_block block = {
+		REC_BLOCK_MAGIC, (uint16_t) job->channel, (uint16_t) job->flags,
+		(uint32_t) n, 0, job->first_sample, codes[0], 0
+	};
+	block.bytes = (uint32_t) rec_encode(codes, n, codes[0], out);
+	double seconds = (g_get_monotonic_time() - start) / 1e6;
+
+	g_mutex_lock(&r->lock);
+	struct rec_index_entry e = {
+		block.channel, block.flags, block.num_samples, block.first_sample,
+		r->offset
+	};
+	rec_write(r->file, &block, sizeof(block));
+	rec_write(r->file, out, block.bytes);
+	r->offset += sizeof(block) + block.bytes;
+	g_array_append_val(r->index, e);
+	r->samples += (uint64_t) n;
+	r->bytes = r->offset;
+	r->encode_seconds += seconds;
+	g_mutex_unlock(&r->lock);
+}
+
+
+gpointer rec_worker(gpointer data) {
+	struct recorder *r = data;
+	int32_t *codes = notnull(malloc(REC_BLOCK_SAMPLES * sizeof(*codes)));
+	uint8_t *out = notnull(malloc(REC_BLOCK_SAMPLES * 8));
+
+	for (;;) {
+		struct rec_job *job = g_async_queue_pop(r->queue);
+		if (job->num_samples < 0) {
+			free(job);
+			break;
+		}
+		rec_encode_job(r, job, codes, out);
+		free(job);
+	}
+	free(codes);
+	free(out);
+	return NULL;
+}
+
+
+// steps holds the quantization step of each channel, in volts.
+int recorder_start(struct recorder *r, const char *path, int num_channels,
+		const float *steps, uint64_t sample_rate) {
+	recorder_stop(r);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+	if (r->queue == NULL) {
+		g_mutex_init(&r->lock);
+		r->queue = g_async_queue_new();
+	}
+
+	r->file = file;
+	r->num_channels = num_channels;
+	r->steps = notnull(realloc(r->steps, num_channels * sizeof(float)));
+	memcpy(r->steps, steps, num_channels * sizeof(float));
+	memset(&r->header, 0, sizeof(r->header));
+	memcpy(r->header.magic, REC_MAGIC, sizeof(r->header.magic));
+	r->header.num_channels = (uint32_t) num_channels;
+	r->header.block_samples = REC_BLOCK_SAMPLES;
+	r->header.sample_rate = sample_rate;
+	r->header.start_time_ns = g_get_real_time() * 1000;
+	rec_write(file, &r->header, sizeof(r->header));
+	rec_write(file, r->steps, num_channels * sizeof(float));
+
+	r->pending = zalloc(num_channels * sizeof(*r->pending));
+	for (int c = 0; c < num_channels; c++)
+		r->pending[c].data = notnull(malloc(REC_BLOCK_SAMPLES
+				* sizeof(sample_t)));
+	r->offset = (uint64_t) ftello(file);
+	r->index = g_array_new(FALSE, FALSE, sizeof(struct rec_index_entry));
+	r->samples = 0;
+	r->bytes = r->offset;
+	r->dropped = 0;
+	r->encode_seconds = 0;
+
+	r->num_threads = (int) g_get_num_processors();
+	if (r->num_threads > REC_MAX_THREADS)
+		r->num_threads = REC_MAX_THREADS;
+	for (int i = 0; i < r->num_threads; i++)
+		r->threads[i] = g_thread_new("record", rec_worker, r);
+	r->active = 1;
+	return 1;
+}
+
+
+// Past the queue limit the block is dropped, unless forced as at stop.
+void rec_queue_block(struct recorder *r, int c, int force) {
+	struct rec_pending *p = &r->pending[c];
+	if (p->fill == 0)
+		return;
+
+	if (!force && g_async_queue_length(r->queue)
+			>= REC_QUEUE_PER_THREAD * r->num_threads) {
+		g_mutex_lock(&r->lock);
+		r->dropped += (uint64_t) p->fill;
+		g_mutex_unlock(&r->lock);
+	} else {
+		struct rec_job *job = notnull(malloc(sizeof(*job)
+				+ p->fill * sizeof(sample_t)));
+		job->channel = c;
+		job->flags = p->flags;
+		job->first_sample = p->pos;
+		job->num_samples = p->fill;
+		memcpy(job->samples, p->data, p->fill * sizeof(sample_t));
+		g_async_queue_push(r->queue, job);
+		p->flags = 0;
+	}
+	p->pos += (uint64_t) p->fill;
+	p->fill = 0;
+}
+
+
+int rec_entry_cmp(const void *a, const void *b) {
+	const struct rec_index_entry *x = a, *y = b;
+	if (x->channel != y->channel)
+		return x->channel < y->channel ? -1 : 1;
+	return x->first_sample < y->first_sample ? -1
+			: x->first_sample > y->first_sample;
+}
+
+
+void recorder_stop(struct recorder *r) {
+	if (!r->active)
+		return;
+	r->active = 0;
+	for (int c = 0; c < r->num_channels; c++)
+		rec_queue_block(r, c, 1);
+	for (int i = 0; i < r->num_threads; i++) {
+		struct rec_job *job = zalloc(sizeof(*job));
+		job->num_samples = -1;
+		g_async_queue_push(r->queue, job);
+	}
+	for (int i = 0; i < r->num_threads; i++)
+		g_thread_join(r->threads[i]);
+
+	g_array_sort(r->index, rec_entry_cmp);
+	r->header.index_offset = r->offset;
+	r->header.num_blocks = r->index->len;
+	rec_write(r->file, r->index->data,
+			r->index->len * sizeof(struct rec_index_entry));
+	fseeko(r->file, 0, SEEK_SET);
+	rec_write(r->file, &r->header, sizeof(r->header));
+	fclose(r->file);
+	r->file = NULL;
+
+	g_array_free(r->index, TRUE);
+	r->index = NULL;
+	for (int c = 0; c < r->num_channels; c++)
+		free(r->pending[c].data);
+	free(r->pending);
+	r->pending = NULL;
+}
+
+
+// Appends samples of channel c; n == 0 marks a gap, which ends the block
+// in progress.
+void recorder_push(struct recorder *r, int c, const sample_t *samples,
+		int n) {
+	if (!r->active)
+		return;
+	struct rec_pending *p = &r->pending[c];
+	if (n == 0) {
+		rec_queue_block(r, c, 0);
+		p->flags |= REC_GAP;
+		return;
+	}
+	while (n > 0) {
+		int count = REC_BLOCK_SAMPLES - p->fill;
+		count = n < count ? n : count;
+		memcpy(p->data + p->fill, samples, count * sizeof(sample_t));
+		p->fill += count;
+		samples += count;
+		n -= count;
+		if (p->fill == REC_BLOCK_SAMPLES)
+			rec_queue_block(r, c, 0);
+	}
+}
+
+
+int rec_read_at(FILE *file, uint64_t offset, void *data, size_t size) {
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0
+			&& fread(data, 1, size, file) == size;
+}
+
+
+// Walks the blocks of a recording that was not closed properly.
+GArray *rec_scan(struct rec_file *f, uint64_t offset) {
+	GArray *entries = g_array_new(FALSE, FALSE,
+			sizeof(struct rec_index_entry));
+	struct rec_block block;
+	while (rec_read_at(f->file, offset, &block, sizeof(block))
+			&& block.magic == REC_BLOCK_MAGIC
+			&& block.channel < f->header.num_channels
+			&& block.num_samples <= f->header.block_samples) {
+		struct rec_index_entry e = {
+			block.channel, block.flags, block.num_samples,
+			block.first_sample, offset
+		};
+		g_array_append_val(entries, e);
+		offset += sizeof(block) + block.bytes;
+	}
+	// The last block may have been cut short
+	if (entries->len > 0) {
+		fseeko(f->file, 0, SEEK_END);
+		if ((uint64_t) ftello(f->file) < offset)
+			g_array_set_size(entries, entries->len - 1);
+	}
+	g_array_sort(entries, rec_entry_cmp);
+	return entries;
+}
+
+
+int rec_index_valid(const struct rec_file *f, uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		const struct rec_index_entry *e = &f->index[i];
+		if (e->channel >= f->header.num_channels
+				|| e->num_samples > f->header.block_samples)
+			return 0;
+	}
+	return 1;
+}
+
+
+int rec_open(struct rec_file *f, const char *path) {
+	memset(f, 0, sizeof(*f));
+	f->file = fopen(path, "rb");
+	if (f->file == NULL) {
+		perror(path);
+		return 0;
+	}
+	if (!rec_read_at(f->file, 0, &f->header, sizeof(f->header))
+			|| memcmp(f->header.magic, REC_MAGIC, sizeof(f->header.magic))
+			|| f->header.num_channels == 0
+			|| f->header.num_channels > UINT16_MAX
+			|| f->header.block_samples == 0) {
+		fprintf(stderr, "%s: not a rokscope recording\n", path);
+		fclose(f->file);
+		f->file = NULL;
+		return 0;
+	}
+	f->fd = fileno(f->file);
+	f->steps = notnull(malloc(f->header.num_channels * sizeof(float)));
+	if (fread(f->steps, sizeof(float), f->header.num_channels, f->file)
+			!= f->header.num_channels) {
+		fprintf(stderr, "%s: truncated\n", path);
+		rec_close(f);
+		return 0;
+	}
+
+	// An index that does not fit in the file or does not fit the header
+	// is as good as none
+	uint64_t n = f->header.num_blocks;
+	uint64_t offset = f->header.index_offset;
+	fseeko(f->file, 0, SEEK_END);
+	uint64_t size = (uint64_t) ftello(f->file);
+	if (offset != 0 && offset <= size
+			&& n <= (size - offset) / sizeof(*f->index)) {
+		f->index = notnull(malloc((n ? n : 1) * sizeof(*f->index)));
+		if (rec_read_at(f->file, offset, f->index, n * sizeof(*f->index))
+				&& rec_index_valid(f, n)) {
+			f->num_blocks = n;
+			return 1;
+		}
+		free(f->index);
+		f->index = NULL;
+	}
+
+	GArray *entries = rec_scan(f, sizeof(f->header)
+			+ f->header.num_channels * sizeof(float));
+	f->num_blocks = entries->len;
+	f->index = (struct rec_index_entry *) g_array_free(entries, FALSE);
+	return 1;
+}
+
+
+void rec_close(struct rec_file *f) {
+	if (f->file != NULL)
+		fclose(f->file);
+	free(f->steps);
+	g_free(f->index);
+	memset(f, 0, sizeof(*f));
+}
+
+
+// Samples recorded on channel c, dropped ones included.
+uint64_t rec_channel_samples(const struct rec_file *f, int c) {
+	uint64_t end = 0;
+	for (uint64_t i = 0; i < f->num_blocks; i++) {
+		const struct rec_index_entry *e = &f->index[i];
+		if (e->channel == c && e->first_sample + e->num_samples > end)
+			end = e->first_sample + e->num_samples;
+	}
+	return end;
+}
+
+
+struct rec_read_task {
+	struct rec_file *f;
+	const struct rec_index_entry *e;
+	uint64_t first;
+	int count;
+	sample_t *out;
+	int ok;
+};
+
+
+// Decodes the e->num_samples samples of a block into out. Blocks are read
+// with pread, so any number of threads can decode at once. Returns 0 if
+// the block could not be read back.
+int rec_decode_block(struct rec_file *f, const struct rec_index_entry *e,
+		sample_t *out) {
+	struct rec_block block;
+	int n = (int) e->num_samples;
+
+	if (pread(f->fd, &block, sizeof(block), (off_t) e->offset)
+			!= sizeof(block) || block.magic != REC_BLOCK_MAGIC
+			|| block.num_samples != e->num_samples)
+		return 0;
+	uint8_t *data = notnull(malloc(block.bytes + 1));
+	int32_t *codes = notnull(malloc(n * sizeof(*codes)));
+	int ok = pread(f->fd, data, block.bytes,
+			(off_t) (e->offset + sizeof(block))) == (ssize_t) block.bytes
+			&& rec_decode(data, block.bytes, n, block.first_code, codes);
+
+	if (ok) {
+		float step = f->steps[e->channel];
+		for (int i = 0; i < n; i++)
+			out[i] = codes[i] * step;
+	}
+	free(data);
+	free(codes);
+	return ok;
+}
+
+
+// Decodes one block and copies its part of the requested range.
+void rec_read_block(struct pool_task *t) {
+	struct rec_read_task *rt = t->arg;
+	const struct rec_index_entry *e = rt->e;
+	uint64_t n = e->num_samples;
+	sample_t *samples = notnull(malloc(n * sizeof(sample_t)));
+
+	rt->ok = rec_decode_block(rt->f, e, samples);
+	if (rt->ok) {
+		uint64_t from = e->first_sample > rt->first
+				? e->first_sample : rt->first;
+		uint64_t to = e->first_sample + n < rt->first + rt->count
+				? e->first_sample + n : rt->first + rt->count;
+		memcpy(rt->out + (from - rt->first),
+				samples + (from - e->first_sample),
+				(to - from) * sizeof(sample_t));
+	}
+	free(samples);
+}
+
+
+// Reads count samples of channel c from first into out, decoding the
+// blocks involved in parallel on the pool. Samples in no block read as
+// zero. Returns 0 if a block could not be read back.
+int rec_read(struct rec_file *f, struct pool *p, int c, uint64_t first,
+		int count, sample_t *out) {
+	struct pool_graph g;
+	GArray *tasks = g_array_new(FALSE, FALSE, sizeof(struct rec_read_task));
+	int ok = 1;
+
+	memset(out, 0, count * sizeof(sample_t));
+	for (uint64_t i = 0; i < f->num_blocks; i++) {
+		const struct rec_index_entry *e = &f->index[i];
+		if (e->channel != c || e->first_sample >= first + count
+				|| e->first_sample + e->num_samples <= first)
+			continue;
+		struct rec_read_task rt = { f, e, first, count, out, 0 };
+		g_array_append_val(tasks, rt);
+	}
+
+	memset(&g, 0, sizeof(g));
+	for (guint i = 0; i < tasks->len; i++)
+		pool_graph_add(&g, rec_read_block,
+				&g_array_index(tasks, struct rec_read_task, i), (int) i);
+	pool_run(p, &g);
+	for (guint i = 0; i < tasks->len; i++)
+		ok &= g_array_index(tasks, struct rec_read_task, i).ok;
+
+	pool_graph_free(&g);
+	g_array_free(tasks, TRUE);
+	return ok;
+}
@@ -0,0 +1,128 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <glib.h>
+#include "gloscope.h"
+#include "pool.h"
+
+#define REC_MAGIC "ROKREC1"
+#define REC_BLOCK_MAGIC 0x4b4c4252
+#define REC_BLOCK_SAMPLES 65536
+#define REC_PARTITION 256
+#define REC_ESCAPE 24
+#define REC_DEFAULT_BITS 12
+#define REC_MAX_THREADS 8
+#define REC_QUEUE_PER_THREAD 16
+
+// Block flags
+#define REC_GAP 1
+
+// File layout: the header, num_channels float quantization steps, then
+// blocks in the order they were encoded, then the index. index_offset and
+// num_blocks are only filled in by a clean close; without them a reader
+// finds the blocks by walking their headers.
+struct rec_header {
+	char magic[8];
+	uint32_t num_channels;
+	uint32_t block_samples;
+	uint64_t sample_rate;
+	uint64_t start_time_ns;
+	uint64_t index_offset;
+	uint64_t num_blocks;
+};
+
+// One channel of the samples from first_sample, stored as integer codes
+// of the channel's step. The payload has a partition per REC_PARTITION
+// samples: a 5 bit Rice parameter k, then for each sample the zigzagged
+// difference from the previous code, as unary quotient and k bit
+// remainder. A quotient of REC_ESCAPE or more is written as REC_ESCAPE
+// ones followed by the value in 32 bits.
+struct rec_block {
+	uint32_t magic;
+	uint16_t channel;
+	uint16_t flags;
+	uint32_t num_samples;
+	uint32_t bytes;
+	uint64_t first_sample;
+	int32_t first_code;
+	uint32_t reserved;
+};
+
+// Sorted by channel, then first sample.
+struct rec_index_entry {
+	uint16_t channel;
+	uint16_t flags;
+	uint32_t num_samples;
+	uint64_t first_sample;
+	uint64_t offset;
+};
+
+struct rec_job {
+	int channel;
+	int flags;
+	uint64_t first_sample;
+	int num_samples;
+	sample_t samples[];
+};
+
+struct rec_pending {
+	sample_t *data;
+	int fill;
+	uint64_t pos;
+	int flags;
+};
+
+// Records continuous channel streams. Full blocks are queued to encoder
+// threads, which quantize, encode and append them to the file on their
+// own, so blocks are encoded in parallel and land in any order; the index
+// written at close sorts them out. Positions count from the start of the
+// recording; blocks that find the queue full are dropped and read back as
+// zeros, so recording never holds back the capture.
+struct recorder {
+	int active;
+	FILE *file;
+	int num_channels;
+	float *steps;
+	int num_threads;
+	GThread *threads[REC_MAX_THREADS];
+	GAsyncQueue *queue;
+	// Main thread only
+	struct rec_pending *pending;
+	struct rec_header header;
+	// Protected by lock
+	GMutex lock;
+	uint64_t offset;
+	GArray *index;
+	uint64_t samples;
+	uint64_t bytes;
+	uint64_t dropped;
+	double encode_seconds;
+};
+
+struct rec_file {
+	FILE *file;
+	int fd;
+	struct rec_header header;
+	float *steps;
+	struct rec_index_entry *index;
+	uint64_t num_blocks;
+};
+
+int recorder_start(struct recorder *, const char *, int, const float *,
+		uint64_t);
+void recorder_stop(struct recorder *);
+void recorder_push(struct recorder *, int, const sample_t *, int);
+
+size_t rec_encode(const int32_t *, int, int32_t, uint8_t *);
+int rec_decode(const uint8_t *, size_t, int, int32_t, int32_t *);
+int rec_open(struct rec_file *, const char *);
+void rec_close(struct rec_file *);
+uint64_t rec_channel_samples(const struct rec_file *, int);
+int rec_decode_block(struct rec_file *, const struct rec_index_entry *,
+		sample_t *);
+int rec_read(struct rec_file *, struct pool *, int, uint64_t, int,
+		sample_t *);
+
+#endif
@@ -0,0 +1,433 @@
+#include <math.h>
+#include "rokscope.h"
+
+#define RECVIEW_MAX_SAMPLES (1 << 24)
+#define RECVIEW_MAX_ROWS 10000
+#define RECVIEW_AXIS_HEIGHT 20
+
+/*
+ * Viewer for recordings written by the recorder, with event search. The
+ * visible samples are decoded from the file on every draw, so the view
+ * spans at most RECVIEW_MAX_SAMPLES per channel. A search given as
+ * CHANNEL KIND LEVELS... lists its events in the table at the right;
+ * picking a row, or the previous and next buttons, centres the view on
+ * an event.
+ */
+struct recview {
+	struct rec_file rec;
+	struct pool pool;
+	gchar *path;
+	uint64_t length;
+	double first;
+	double samples_per_pixel;
+	sample_t *buffer;
+	gboolean dragging;
+	double drag_x;
+	double drag_first;
+	struct search_params params;
+	struct mask mask;
+	GArray *events;
+	int current;
+	GtkWidget *area;
+	GtkWidget *status;
+	GtkWidget *tree;
+	GtkListStore *store;
+};
+
+
+void recview_clamp(struct recview *v, int width) {
+	width = width > 0 ? width : 1;
+	double max_spp = (double) v->length / width;
+	if (max_spp > (double) RECVIEW_MAX_SAMPLES / width)
+		max_spp = (double) RECVIEW_MAX_SAMPLES / width;
+	if (v->samples_per_pixel > max_spp)
+		v->samples_per_pixel = max_spp;
+	if (v->samples_per_pixel < 1. / 16)
+		v->samples_per_pixel = 1. / 16;
+	double max_first = (double) v->length - width * v->samples_per_pixel;
+	if (v->first > max_first)
+		v->first = max_first;
+	if (v->first < 0)
+		v->first = 0;
+}
+
+
+void recview_draw_axis(struct recview *v, cairo_t *cr, int width, int y) {
+	double rate = (double) v->rec.header.sample_rate;
+	char label[64];
+
+	cairo_set_source_rgb(cr, .5, .5, .5);
+	cairo_set_line_width(cr, 1);
+	cairo_move_to(cr, 0, y + .5);
+	cairo_line_to(cr, width, y + .5);
+	cairo_stroke(cr);
+	for (int x = 0; x < width; x += 160) {
+		double t = (v->first + x * v->samples_per_pixel) / rate;
+		snprintf(label, sizeof(label), "%.6f s", t);
+		cairo_move_to(cr, x + .5, y);
+		cairo_line_to(cr, x + .5, y + 4);
+		cairo_stroke(cr);
+		cairo_move_to(cr, x + 2, y + RECVIEW_AXIS_HEIGHT - 5);
+		cairo_show_text(cr, label);
+	}
+}
+
+
+// Events in view, shaded over the lane of the searched channel; the
+// current one brighter.
+void recview_draw_events(struct recview *v, cairo_t *cr, int width,
+		double lane) {
+	if (v->events == NULL || v->events->len == 0)
+		return;
+	double last = v->first + width * v->samples_per_pixel;
+	// From the last event starting before the view, which may reach into it
+	int i = search_prev(v->events, (uint64_t) v->first);
+	i = i > 0 ? i : 0;
+	double top = v->params.channel * lane;
+
+	for (; i >= 0 && i < (int) v->events->len; i++) {
+		struct search_event *e = &g_array_index(v->events,
+				struct search_event, i);
+		if ((double) e->sample > last)
+			break;
+		double x0 = (e->sample - v->first) / v->samples_per_pixel;
+		double w = e->length / v->samples_per_pixel;
+		cairo_set_source_rgba(cr, 1, .3, .3, i == v->current ? .5 : .25);
+		cairo_rectangle(cr, x0, top, w > 1 ? w : 1, lane);
+		cairo_fill(cr);
+	}
+}
+
+
+// One lane per channel, a min-max bar per pixel column, scaled to the
+// samples in view.
+gboolean recview_on_draw(GtkWidget *widget, cairo_t *cr, gpointer data) {
+	const double colors[][3] = {
+		{1,1,0},{0,.5,1},{1,0,0},{0,1,0},{0,0,1},{1,0,1},{0,1,1},{1,.5,0},
+	};
+	struct recview *v = data;
+	int width = gtk_widget_get_allocated_width(widget);
+	int height = gtk_widget_get_allocated_height(widget);
+	int num_channels = (int) v->rec.header.num_channels;
+	double lane = (double) (height - RECVIEW_AXIS_HEIGHT) / num_channels;
+
+	recview_clamp(v, width);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+	if (v->length == 0)
+		return TRUE;
+
+	uint64_t first = (uint64_t) v->first;
+	uint64_t end = (uint64_t) ceil(v->first + width * v->samples_per_pixel)
+			+ 1;
+	end = end < v->length ? end : v->length;
+	int count = (int) (end - first);
+	recview_draw_events(v, cr, width, lane);
+
+	for (int c = 0; c < num_channels; c++) {
+		rec_read(&v->rec, &v->pool, c, first, count, v->buffer);
+		float lo = INFINITY, hi = -INFINITY;
+		for (int i = 0; i < count; i++) {
+			lo = v->buffer[i] < lo ? v->buffer[i] : lo;
+			hi = v->buffer[i] > hi ? v->buffer[i] : hi;
+		}
+		double span = hi > lo ? hi - lo : 1e-3;
+		double top = c * lane + 2, h = lane - 4;
+		const double *color = colors[c % 8];
+
+		cairo_set_line_width(cr, 1);
+		cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+		for (int x = 0; x < width; x++) {
+			int64_t i0 = (int64_t) (v->first + x * v->samples_per_pixel)
+					- (int64_t) first;
+			int64_t i1 = (int64_t) (v->first + (x + 1) * v->samples_per_pixel)
+					- (int64_t) first + 1;
+			i1 = i1 < count ? i1 : count;
+			if (i0 < 0 || i0 >= i1)
+				continue;
+			float a = v->buffer[i0], b = a;
+			for (int64_t i = i0 + 1; i < i1; i++) {
+				a = v->buffer[i] < a ? v->buffer[i] : a;
+				b = v->buffer[i] > b ? v->buffer[i] : b;
+			}
+			cairo_move_to(cr, x + .5, top + h * (1 - (b - lo) / span));
+			cairo_line_to(cr, x + .5, top + h * (1 - (a - lo) / span) + 1);
+			cairo_stroke(cr);
+		}
+	}
+
+	recview_draw_axis(v, cr, width, height - RECVIEW_AXIS_HEIGHT);
+	return TRUE;
+}
+
+
+// Zooms around the sample under the pointer.
+gboolean recview_on_scroll(GtkWidget *widget, GdkEventScroll *event,
+		gpointer data) {
+	struct recview *v = data;
+	double sample = v->first + event->x * v->samples_per_pixel;
+
+	if (event->direction == GDK_SCROLL_UP)
+		v->samples_per_pixel /= 1.25;
+	else if (event->direction == GDK_SCROLL_DOWN)
+		v->samples_per_pixel *= 1.25;
+	else
+		return FALSE;
+	recview_clamp(v, gtk_widget_get_allocated_width(widget));
+	v->first = sample - event->x * v->samples_per_pixel;
+	gtk_widget_queue_draw(widget);
+	return TRUE;
+}
+
+
+gboolean recview_on_button(GtkWidget *widget, GdkEventButton *event,
+		gpointer data) {
+	UNUSED(widget);
+	struct recview *v = data;
+	if (event->button != 1)
+		return FALSE;
+	v->dragging = event->type == GDK_BUTTON_PRESS;
+	v->drag_x = event->x;
+	v->drag_first = v->first;
+	return TRUE;
+}
+
+
+gboolean recview_on_motion(GtkWidget *widget, GdkEventMotion *event,
+		gpointer data) {
+	struct recview *v = data;
+	if (!v->dragging)
+		return FALSE;
+	v->first = v->drag_first - (event->x - v->drag_x) * v->samples_per_pixel;
+	v->current = -1;
+	gtk_widget_queue_draw(widget);
+	return TRUE;
+}
+
+
+// Centres the view on event i, zoomed so that it takes about a third of
+// the width, and selects its row.
+void recview_jump(struct recview *v, int i) {
+	if (i < 0 || i >= (int) v->events->len)
+		return;
+	struct search_event *e = &g_array_index(v->events, struct search_event, i);
+	int width = gtk_widget_get_allocated_width(v->area);
+	width = width > 0 ? width : 1;
+	double span = e->length > 0 ? 3. * e->length : 64;
+	v->samples_per_pixel = span / width;
+	recview_clamp(v, width);
+	v->first = e->sample + e->length / 2. - width * v->samples_per_pixel / 2;
+	v->current = i;
+
+	if (i < RECVIEW_MAX_ROWS) {
+		GtkTreePath *path = gtk_tree_path_new_from_indices(i, -1);
+		gtk_tree_view_set_cursor(GTK_TREE_VIEW(v->tree), path, NULL, FALSE);
+		gtk_tree_path_free(path);
+	}
+	gtk_widget_queue_draw(v->area);
+}
+
+
+// Where the previous and next events are looked for: the current event,
+// or the centre of the view once it was dragged away.
+uint64_t recview_position(struct recview *v) {
+	if (v->current >= 0)
+		return g_array_index(v->events, struct search_event,
+				v->current).sample;
+	int width = gtk_widget_get_allocated_width(v->area);
+	return (uint64_t) (v->first + width * v->samples_per_pixel / 2);
+}
+
+
+void recview_on_next(GtkWidget *widget, gpointer data) {
+	UNUSED(widget);
+	struct recview *v = data;
+	if (v->events != NULL)
+		recview_jump(v, search_next(v->events, recview_position(v)));
+}
+
+
+void recview_on_prev(GtkWidget *widget, gpointer data) {
+	UNUSED(widget);
+	struct recview *v = data;
+	if (v->events != NULL)
+		recview_jump(v, search_prev(v->events, recview_position(v)));
+}
+
+
+void recview_on_row(GtkTreeView *tree, GtkTreePath *path,
+		GtkTreeViewColumn *column, gpointer data) {
+	UNUSED(tree);
+	UNUSED(column);
+	struct recview *v = data;
+	int *indices = gtk_tree_path_get_indices(path);
+	if (indices != NULL && indices[0] != v->current)
+		recview_jump(v, indices[0]);
+}
+
+
+void recview_fill_table(struct recview *v) {
+	double rate = (double) v->rec.header.sample_rate;
+	char time[32], length[32], kind[32];
+
+	gtk_list_store_clear(v->store);
+	for (guint i = 0; i < v->events->len && i < RECVIEW_MAX_ROWS; i++) {
+		struct search_event *e = &g_array_index(v->events,
+				struct search_event, i);
+		GtkTreeIter iter;
+		snprintf(time, sizeof(time), "%.6f", e->sample / rate);
+		snprintf(length, sizeof(length), "%.3g s", e->length / rate);
+		if (e->kind == SEARCH_MASK)
+			snprintf(kind, sizeof(kind), "mask, %u off", e->violations);
+		else
+			snprintf(kind, sizeof(kind), "%s", search_kind_names[e->kind]);
+		gtk_list_store_append(v->store, &iter);
+		gtk_list_store_set(v->store, &iter, 0, (gint) i,
+				1, time, 2, e->length ? length : "",
+				3, kind, -1);
+	}
+}
+
+
+void recview_on_search(GtkEntry *entry, gpointer data) {
+	struct recview *v = data;
+	gchar **words = g_strsplit_set(gtk_entry_get_text(entry), " \t", -1);
+	int n = 0;
+	char status[128];
+
+	// Drop the empty words between repeated spaces
+	for (int i = 0; words[i] != NULL; i++) {
+		if (words[i][0] != 0)
+			words[n++] = words[i];
+		else
+			g_free(words[i]);
+	}
+	words[n] = NULL;
+
+	if (!search_parse(&v->params, &v->mask, words, n,
+			v->rec.header.num_channels)) {
+		gtk_label_set_text(GTK_LABEL(v->status),
+				"Search: CHANNEL rise|fall|cross LEVEL [HYST],"
+				" pulse LEVEL HYST MIN MAX, runt|window LOW HIGH,"
+				" mask FILE LEVEL [HYST]");
+		g_strfreev(words);
+		return;
+	}
+	g_strfreev(words);
+
+	int cached;
+	gint64 start = g_get_monotonic_time();
+	if (!search_events(v->path, &v->rec, &v->pool, &v->params, &v->mask,
+			v->events, &cached))
+		fprintf(stderr, "%s: damaged block, search stopped\n", v->path);
+	snprintf(status, sizeof(status), "%u events, %.3f s%s", v->events->len,
+			(g_get_monotonic_time() - start) / 1e6,
+			cached ? " from the index" : "");
+	if (v->events->len > RECVIEW_MAX_ROWS)
+		snprintf(status + strlen(status), sizeof(status) - strlen(status),
+				", the table lists the first %d", RECVIEW_MAX_ROWS);
+	gtk_label_set_text(GTK_LABEL(v->status), status);
+	v->current = -1;
+	recview_fill_table(v);
+	recview_jump(v, 0);
+	gtk_widget_queue_draw(v->area);
+}
+
+
+void recview_on_destroy(GtkWidget *widget, gpointer data) {
+	UNUSED(widget);
+	struct recview *v = data;
+	g_array_free(v->events, TRUE);
+	mask_free(&v->mask);
+	g_object_unref(v->store);
+	pool_free(&v->pool);
+	rec_close(&v->rec);
+	free(v->buffer);
+	g_free(v->path);
+	free(v);
+}
+
+
+GtkWidget *recview_button(const char *label, GCallback callback,
+		struct recview *v) {
+	GtkWidget *button = gtk_button_new_with_label(label);
+	g_signal_connect(button, "clicked", callback, v);
+	return button;
+}
+
+
+GtkWindow *recview_create(GtkApplication *application, const char *path) {
+	struct recview *v = zalloc(sizeof(*v));
+	if (!rec_open(&v->rec, path))
+		exit(1);
+	pool_init(&v->pool, 0);
+	v->path = g_strdup(path);
+	for (uint32_t c = 0; c < v->rec.header.num_channels; c++) {
+		uint64_t n = rec_channel_samples(&v->rec, (int) c);
+		v->length = n > v->length ? n : v->length;
+	}
+	v->buffer = notnull(malloc((RECVIEW_MAX_SAMPLES + 2) * sizeof(sample_t)));
+	v->samples_per_pixel = INFINITY;
+	v->events = g_array_new(FALSE, FALSE, sizeof(struct search_event));
+	v->current = -1;
+	printf("Recording %s: %u channels, %lu samples at %lu Hz\n", path,
+			v->rec.header.num_channels, v->length,
+			v->rec.header.sample_rate);
+
+	GtkWidget *window = gtk_application_window_new(application);
+	gchar *title = g_path_get_basename(path);
+	gtk_window_set_title(GTK_WINDOW(window), title);
+	g_free(title);
+	gtk_window_set_default_size(GTK_WINDOW(window), 1280, 600);
+
+	v->area = gtk_drawing_area_new();
+	gtk_widget_set_hexpand(v->area, TRUE);
+	gtk_widget_set_vexpand(v->area, TRUE);
+	gtk_widget_add_events(v->area, GDK_SCROLL_MASK | GDK_BUTTON_PRESS_MASK
+			| GDK_BUTTON_RELEASE_MASK | GDK_POINTER_MOTION_MASK);
+	g_signal_connect(v->area, "draw", G_CALLBACK(recview_on_draw), v);
+	g_signal_connect(v->area, "scroll-event", G_CALLBACK(recview_on_scroll),
+			v);
+	g_signal_connect(v->area, "button-press-event",
+			G_CALLBACK(recview_on_button), v);
+	g_signal_connect(v->area, "button-release-event",
+			G_CALLBACK(recview_on_button), v);
+	g_signal_connect(v->area, "motion-notify-event",
+			G_CALLBACK(recview_on_motion), v);
+
+	GtkWidget *entry = gtk_entry_new();
+	gtk_entry_set_placeholder_text(GTK_ENTRY(entry),
+			"Search, e.g. 0 runt 0.8 2.5");
+	gtk_widget_set_hexpand(entry, TRUE);
+	g_signal_connect(entry, "activate", G_CALLBACK(recview_on_search), v);
+	v->status = gtk_label_new("");
+
+	v->store = gtk_list_store_new(4, G_TYPE_INT, G_TYPE_STRING,
+			G_TYPE_STRING, G_TYPE_STRING);
+	v->tree = gtk_tree_view_new_with_model(GTK_TREE_MODEL(v->store));
+	const char *titles[] = { "#", "Time (s)", "Length", "Event" };
+	for (int i = 0; i < 4; i++)
+		gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(v->tree),
+				-1, titles[i], gtk_cell_renderer_text_new(), "text", i,
+				NULL);
+	g_signal_connect(v->tree, "row-activated", G_CALLBACK(recview_on_row), v);
+	GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+	gtk_widget_set_size_request(scrolled, 320, -1);
+	gtk_widget_set_vexpand(scrolled, TRUE);
+	gtk_container_add(GTK_CONTAINER(scrolled), v->tree);
+
+	GtkWidget *grid = gtk_grid_new();
+	gtk_grid_attach(GTK_GRID(grid), entry, 0, 0, 1, 1);
+	gtk_grid_attach(GTK_GRID(grid), recview_button("Previous",
+			G_CALLBACK(recview_on_prev), v), 1, 0, 1, 1);
+	gtk_grid_attach(GTK_GRID(grid), recview_button("Next",
+			G_CALLBACK(recview_on_next), v), 2, 0, 1, 1);
+	gtk_grid_attach(GTK_GRID(grid), v->status, 0, 1, 3, 1);
+	gtk_grid_attach(GTK_GRID(grid), v->area, 0, 2, 3, 1);
+	gtk_grid_attach(GTK_GRID(grid), scrolled, 3, 0, 1, 3);
+	g_signal_connect(window, "destroy", G_CALLBACK(recview_on_destroy), v);
+
+	gtk_container_add(GTK_CONTAINER(window), grid);
+	gtk_widget_show_all(window);
+	return GTK_WINDOW(window);
+}
@@ -0,0 +1,176 @@
+#include <math.h>
+#include <string.h>
+#include "ref.h"
+
+typedef float ref_vec __attribute__((vector_size(4 * REF_LANES)));
+typedef int32_t ref_ivec __attribute__((vector_size(4 * REF_LANES)));
+
+
+void ref_reset_stats(struct ref *r) {
+	r->frames = 0;
+	r->rms = 0;
+	r->max_deviation = 0;
+	r->correlation = 0;
+	r->worst_rms = 0;
+	r->worst_deviation = 0;
+	r->worst_correlation = 1;
+}
+
+
+void ref_set(struct ref *r, int channel, const sample_t *samples, int n,
+		uint64_t sample_rate) {
+	r->data = notnull(realloc(r->data, (n ? n : 1) * sizeof(sample_t)));
+	memcpy(r->data, samples, n * sizeof(sample_t));
+	r->num_samples = n;
+	r->channel = channel;
+	r->sample_rate = sample_rate;
+	r->active = 1;
+	r->plot_stale = 1;
+	ref_reset_stats(r);
+}
+
+
+void ref_clear(struct ref *r) {
+	r->active = 0;
+}
+
+
+// Where reference slot is stored by default; free with g_free.
+gchar *ref_path(int slot) {
+	gchar *name = g_strdup_printf("ref%d", slot);
+	gchar *path = g_build_filename(g_get_user_data_dir(), REF_DIR, name,
+			NULL);
+	g_free(name);
+	return path;
+}
+
+
+int ref_save(const struct ref *r, const char *path) {
+	struct ref_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, REF_MAGIC, sizeof(h.magic));
+	h.channel = (uint32_t) r->channel;
+	h.num_samples = (uint32_t) r->num_samples;
+	h.sample_rate = r->sample_rate;
+
+	gchar *dir = g_path_get_dirname(path);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return 0;
+	}
+	int ok = fwrite(&h, sizeof(h), 1, f) == 1
+			&& fwrite(r->data, sizeof(sample_t), r->num_samples, f)
+			== (size_t) r->num_samples;
+	if (fclose(f) != 0 || !ok) {
+		perror(path);
+		return 0;
+	}
+	return 1;
+}
+
+
+// Only takes a reference of one of the num_channels channels.
+int ref_load(struct ref *r, const char *path, int num_channels) {
+	struct ref_header h;
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return 0;
+	}
+	if (fread(&h, sizeof(h), 1, f) != 1
+			|| memcmp(h.magic, REF_MAGIC, sizeof(h.magic)) != 0
+			|| h.num_samples == 0 || h.num_samples > INT32_MAX) {
+		fprintf(stderr, "%s: not a reference waveform\n", path);
+		fclose(f);
+		return 0;
+	}
+	if (h.channel >= (uint32_t) num_channels) {
+		fprintf(stderr, "%s: channel %u is not here\n", path, h.channel);
+		fclose(f);
+		return 0;
+	}
+	sample_t *data = notnull(malloc(h.num_samples * sizeof(sample_t)));
+	if (fread(data, sizeof(sample_t), h.num_samples, f) != h.num_samples) {
+		fprintf(stderr, "%s: truncated\n", path);
+		free(data);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	ref_set(r, (int) h.channel, data, (int) h.num_samples, h.sample_rate);
+	free(data);
+	return 1;
+}
+
+
+// One pass over the samples both frames have, REF_LANES at a time in
+// vector registers; plain loops are left scalar by the compiler at -O3.
+// The float sums are folded into doubles every REF_BLOCK samples so that
+// long frames keep their precision.
+void ref_compare(struct ref *r, const sample_t *live, int n) {
+	int m = n < r->num_samples ? n : r->num_samples;
+	if (!r->active || m < 2)
+		return;
+
+	const sample_t *x = r->data;
+	const ref_ivec abs_mask = (ref_ivec) { 0 } + INT32_MAX;
+	double sd2 = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+	float dmax = 0;
+	int i = 0;
+	while (i + REF_LANES <= m) {
+		ref_vec d2 = { 0 }, dm = { 0 }, ax = { 0 }, ay = { 0 };
+		ref_vec axx = { 0 }, ayy = { 0 }, axy = { 0 };
+		int end = i + REF_BLOCK < m ? i + REF_BLOCK : m;
+		for (; i + REF_LANES <= end; i += REF_LANES) {
+			ref_vec a, b;
+			memcpy(&a, x + i, sizeof(a));
+			memcpy(&b, live + i, sizeof(b));
+			ref_vec d = b - a;
+			ref_vec ad = (ref_vec) ((ref_ivec) d & abs_mask);
+			ref_ivec above = ad > dm;
+			dm = (ref_vec) (((ref_ivec) ad & above)
+					| ((ref_ivec) dm & ~above));
+			d2 += d * d;
+			ax += a;
+			ay += b;
+			axx += a * a;
+			ayy += b * b;
+			axy += a * b;
+		}
+		for (int j = 0; j < REF_LANES; j++) {
+			sd2 += d2[j];
+			dmax = dm[j] > dmax ? dm[j] : dmax;
+			sx += ax[j];
+			sy += ay[j];
+			sxx += axx[j];
+			syy += ayy[j];
+			sxy += axy[j];
+		}
+	}
+	for (; i < m; i++) {
+		float a = x[i], b = live[i], d = b - a;
+		sd2 += d * d;
+		dmax = fabsf(d) > dmax ? fabsf(d) : dmax;
+		sx += a;
+		sy += b;
+		sxx += a * a;
+		syy += b * b;
+		sxy += a * b;
+	}
+
+	double vx = sxx - sx * sx / m;
+	double vy = syy - sy * sy / m;
+	double cov = sxy - sx * sy / m;
+	r->rms = sqrt(sd2 / m);
+	r->max_deviation = dmax;
+	r->correlation = vx > 0 && vy > 0 ? cov / sqrt(vx * vy) : 0;
+	r->frames++;
+	r->worst_rms = r->rms > r->worst_rms ? r->rms : r->worst_rms;
+	r->worst_deviation = dmax > r->worst_deviation ? dmax
+			: r->worst_deviation;
+	r->worst_correlation = r->correlation < r->worst_correlation
+			? r->correlation : r->worst_correlation;
+}
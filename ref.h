@@ -0,0 +1,53 @@
+#ifndef REF_H
+#define REF_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "gloscope.h"
+
+#define REF_SLOTS 8
+#define REF_MAGIC "ROKREF1"
+#define REF_DIR "rokscope"
+#define REF_LANES 4
+#define REF_BLOCK 1024
+
+// File layout: the header, then num_samples floats.
+struct ref_header {
+	char magic[8];
+	uint32_t channel;
+	uint32_t num_samples;
+	uint64_t sample_rate;
+};
+
+// Reference waveform compared with the live frames of its channel. The
+// samples stay here for the comparison and, through plot, on the GPU for
+// display; plot is only set again when stale or when the view width
+// changes. Every frame gives the RMS and the largest absolute difference
+// and the correlation coefficient over the samples both have; the worst
+// values are kept since the reference was set.
+struct ref {
+	int active;
+	int channel;
+	int num_samples;
+	uint64_t sample_rate;
+	sample_t *data;
+	struct gloscope_plot *plot;
+	int plot_stale;
+	int plot_columns;
+	uint64_t frames;
+	double rms;
+	double max_deviation;
+	double correlation;
+	double worst_rms;
+	double worst_deviation;
+	double worst_correlation;
+};
+
+void ref_set(struct ref *, int, const sample_t *, int, uint64_t);
+void ref_clear(struct ref *);
+int ref_save(const struct ref *, const char *);
+int ref_load(struct ref *, const char *, int);
+gchar *ref_path(int);
+void ref_compare(struct ref *, const sample_t *, int);
+
+#endif
@@ -0,0 +1,65 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ring.h"
+
+
+void ring_init(struct ring *r, size_t min_capacity) {
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t bytes = (min_capacity * sizeof(sample_t) + page - 1) / page * page;
+	char *base;
+	int fd;
+
+	fd = memfd_create("rokscope-ring", 0);
+	if (fd < 0 || ftruncate(fd, bytes) < 0) {
+		perror("Error creating capture ring");
+		exit(1);
+	}
+
+	base = mmap(NULL, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED
+			|| mmap(base, bytes, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+			|| mmap(base + bytes, bytes, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		perror("Error mapping capture ring");
+		exit(1);
+	}
+	close(fd);
+
+	r->bytes = bytes;
+	r->capacity = bytes / sizeof(sample_t);
+	r->data = (sample_t *) base;
+	r->written = 0;
+}
+
+
+void ring_free(struct ring *r) {
+	if (r->data != NULL)
+		munmap(r->data, 2 * r->bytes);
+	memset(r, 0, sizeof(*r));
+}
+
+
+void ring_write(struct ring *r, const sample_t *samples, size_t count) {
+	if (count > r->capacity) {
+		r->written += count - r->capacity;
+		samples += count - r->capacity;
+		count = r->capacity;
+	}
+	memcpy(r->data + r->written % r->capacity, samples,
+			count * sizeof(sample_t));
+	r->written += count;
+}
+
+
+// Pointer to the sample at absolute position pos, followed by at least
+// capacity - (pos - ring_oldest) readable samples.
+sample_t *ring_at(const struct ring *r, uint64_t pos) {
+	return r->data + pos % r->capacity;
+}
+
+
+uint64_t ring_oldest(const struct ring *r) {
+	return r->written > r->capacity ? r->written - r->capacity : 0;
+}
@@ -0,0 +1,23 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include "gloscope.h"
+
+// Circular sample buffer whose memory is mapped twice back to back, so any
+// window of up to capacity samples is contiguous and can be handed out as
+// a plain pointer into the ring. Positions are absolute sample counts.
+struct ring {
+	size_t capacity;
+	size_t bytes;
+	sample_t *data;
+	uint64_t written;
+};
+
+void ring_init(struct ring *, size_t);
+void ring_free(struct ring *);
+void ring_write(struct ring *, const sample_t *, size_t);
+sample_t *ring_at(const struct ring *, uint64_t);
+uint64_t ring_oldest(const struct ring *);
+
+#endif
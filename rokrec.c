@@ -0,0 +1,205 @@
+#define _FILE_OFFSET_BITS 64
+#include <glib.h>
+#include "record.h"
+#include "search.h"
+
+/*
+ * Reads recordings made with `record start`: prints what a file holds and
+ * how fast it decodes, converts it back to raw float32 frames, every
+ * channel's --samples values in turn, as read by rokscope_render --input,
+ * and searches it for events.
+ */
+
+
+double now_seconds(void) {
+	return g_get_monotonic_time() / 1e6;
+}
+
+
+void print_info(const struct rec_file *f) {
+	printf("%u channels at %lu Sa/s, %lu blocks%s\n", f->header.num_channels,
+			f->header.sample_rate, f->num_blocks,
+			f->header.index_offset ? "" : " (not closed, recovered)");
+	for (uint32_t c = 0; c < f->header.num_channels; c++) {
+		uint64_t samples = rec_channel_samples(f, (int) c);
+		uint64_t stored = 0, blocks = 0, gaps = 0;
+		for (uint64_t i = 0; i < f->num_blocks; i++) {
+			const struct rec_index_entry *e = &f->index[i];
+			if (e->channel != c)
+				continue;
+			blocks++;
+			stored += e->num_samples;
+			gaps += (e->flags & REC_GAP) != 0;
+		}
+		printf("channel %u: step %g V, %lu samples, %lu stored in %lu blocks,"
+				" %lu gaps\n", c, f->steps[c], samples, stored, blocks, gaps);
+	}
+	fseeko(f->file, 0, SEEK_END);
+	printf("%lu bytes\n", (uint64_t) ftello(f->file));
+}
+
+
+// Decodes every channel in chunks of a few blocks through the pool.
+int benchmark(struct rec_file *f, struct pool *p) {
+	int chunk = 16 * REC_BLOCK_SAMPLES;
+	sample_t *data = notnull(malloc(chunk * sizeof(sample_t)));
+	uint64_t total = 0;
+	double start = now_seconds();
+
+	for (uint32_t c = 0; c < f->header.num_channels; c++) {
+		uint64_t samples = rec_channel_samples(f, (int) c);
+		for (uint64_t pos = 0; pos < samples; pos += chunk) {
+			int n = samples - pos < (uint64_t) chunk
+					? (int) (samples - pos) : chunk;
+			if (!rec_read(f, p, (int) c, pos, n, data)) {
+				fprintf(stderr, "Damaged block in channel %u\n", c);
+				free(data);
+				return 0;
+			}
+			total += (uint64_t) n;
+		}
+	}
+	double seconds = now_seconds() - start;
+	printf("decoded %lu samples in %.3f s (%.1f MS/s, %d threads)\n", total,
+			seconds, seconds > 0 ? total / seconds / 1e6 : 0, p->num_workers);
+	free(data);
+	return 1;
+}
+
+
+int convert(struct rec_file *f, struct pool *p, int samples,
+		const char *path) {
+	int num_channels = (int) f->header.num_channels;
+	uint64_t length = 0;
+	for (int c = 0; c < num_channels; c++) {
+		uint64_t n = rec_channel_samples(f, c);
+		length = n > length ? n : length;
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) {
+		perror(path);
+		return 0;
+	}
+	sample_t *data = notnull(malloc((size_t) samples * sizeof(sample_t)));
+	int ok = 1;
+	uint64_t frames = 0;
+	for (uint64_t pos = 0; pos + samples <= length && ok; pos += samples) {
+		for (int c = 0; c < num_channels && ok; c++) {
+			ok = rec_read(f, p, c, pos, samples, data);
+			if (!ok)
+				fprintf(stderr, "Damaged block in channel %d\n", c);
+			else if (fwrite(data, sizeof(sample_t), samples, out)
+					!= (size_t) samples) {
+				perror(path);
+				ok = 0;
+			}
+		}
+		frames++;
+	}
+	if (ok)
+		printf("%lu frames of %d channels x %d samples written\n", frames,
+				num_channels, samples);
+	free(data);
+	fclose(out);
+	return ok;
+}
+
+
+// The search is CHANNEL KIND LEVELS..., as in the viewer.
+int search(struct rec_file *f, struct pool *p, const char *path,
+		const char *spec) {
+	double rate = (double) f->header.sample_rate;
+	struct search_params params;
+	struct mask mask;
+	gchar **words;
+	int n, cached;
+
+	memset(&mask, 0, sizeof(mask));
+
+	int valid = g_shell_parse_argv(spec, &n, &words, NULL);
+	if (valid) {
+		valid = search_parse(&params, &mask, words, n,
+				f->header.num_channels);
+		g_strfreev(words);
+	}
+	if (!valid) {
+		fprintf(stderr, "Invalid search: CHANNEL rise|fall|cross LEVEL"
+				" [HYST], pulse LEVEL HYST MIN MAX, runt|window LOW HIGH,"
+				" mask FILE LEVEL [HYST]\n");
+		mask_free(&mask);
+		return 0;
+	}
+
+	GArray *events = g_array_new(FALSE, FALSE, sizeof(struct search_event));
+	double start = now_seconds();
+	int ok = search_events(path, f, p, &params, &mask, events, &cached);
+	double seconds = now_seconds() - start;
+	for (guint i = 0; i < events->len; i++) {
+		struct search_event *e = &g_array_index(events, struct search_event,
+				i);
+		printf("%.9f %s %.9g", e->sample / rate, search_kind_names[e->kind],
+				e->length / rate);
+		if (e->kind == SEARCH_MASK)
+			printf(" %u", e->violations);
+		printf("\n");
+	}
+	uint64_t samples = rec_channel_samples(f, params.channel);
+	fprintf(stderr, "%u events in %.3f s%s (%.1f MS/s)\n", events->len,
+			seconds, cached ? ", from the index" : "",
+			seconds > 0 ? samples / seconds / 1e6 : 0);
+	g_array_free(events, TRUE);
+	mask_free(&mask);
+	return ok;
+}
+
+
+int main(int argc, char **argv) {
+	gint samples = 4096;
+	gchar *output = NULL;
+	gchar *spec = NULL;
+	GError *error = NULL;
+	const GOptionEntry entries[] = {
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+				"Write raw float32 frames to FILE", "FILE" },
+		{ "samples", 'n', 0, G_OPTION_ARG_INT, &samples,
+				"Samples per channel and frame", "N" },
+		{ "search", 's', 0, G_OPTION_ARG_STRING, &spec,
+				"Print the events found, e.g. \"0 runt 0.8 2.5\"", "SEARCH" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	GOptionContext *options = g_option_context_new(
+			"RECORDING - inspect or convert a rokscope recording");
+	g_option_context_add_main_entries(options, entries, NULL);
+	if (!g_option_context_parse(options, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(options);
+	if (argc != 2 || samples < 2) {
+		fprintf(stderr, "Usage: %s [--output FILE | --search SEARCH]"
+				" RECORDING\n", argv[0]);
+		return 1;
+	}
+
+	struct rec_file f;
+	if (!rec_open(&f, argv[1]))
+		return 1;
+	struct pool p;
+	pool_init(&p, 0);
+
+	int ok;
+	if (output != NULL) {
+		ok = convert(&f, &p, samples, output);
+	} else if (spec != NULL) {
+		ok = search(&f, &p, argv[1], spec);
+	} else {
+		print_info(&f);
+		ok = benchmark(&f, &p);
+	}
+
+	pool_free(&p);
+	rec_close(&f);
+	return ok ? 0 : 1;
+}
@@ -1,3 +1,4 @@
+#include <time.h>
 #include "rokscope.h"
 
 
@@ -37,13 +38,18 @@ const char *configkey_tostring(int option) {
 }
 
 
-void enumerate_device_options(const char *name, struct sr_dev_driver *driver,
+// Prints every option with its value and list, refreshing the cached lists.
+// Each driver call holds config_lock, so settings can change in between.
+void enumerate_device_options(struct caps *caps, GMutex *config_lock,
+		const char *name, struct sr_dev_driver *driver,
 		struct sr_dev_inst *dev, struct sr_channel_group *chgroup) {
 	GVariant *gvar;
 	int res;
 	GArray *options_list;
 
+	g_mutex_lock(config_lock);
 	options_list= sr_dev_options(driver, dev, chgroup);
+	g_mutex_unlock(config_lock);
 	if (options_list == NULL) {
 		fprintf(stderr, "Error getting options list from %s!\n", name);
 		exit(1);
@@ -60,7 +66,9 @@ void enumerate_device_options(const char *name, struct sr_dev_driver *driver,
 			printf("%s option %u available: %s", name, option, option_name);
 		}
 
+		g_mutex_lock(config_lock);
 		res = sr_config_get(driver, dev, chgroup, option, &gvar);
+		g_mutex_unlock(config_lock);
 		if (res == SR_OK) {
 			gchar *value = g_variant_print(gvar, TRUE);
 			printf(" = %s", value);
@@ -70,12 +78,16 @@ void enumerate_device_options(const char *name, struct sr_dev_driver *driver,
 		printf("\n");
 
 
+		g_mutex_lock(config_lock);
 		res = sr_config_list(driver, dev, chgroup, option, &gvar);
+		g_mutex_unlock(config_lock);
 		if (res == SR_OK) {
 			gchar *value = g_variant_print(gvar, TRUE);
 			printf("  %s\n", value);
 			free(value);
 		}
+		caps_store(caps, driver, dev, chgroup, option,
+				res == SR_OK ? gvar : NULL);
 	}
 	g_array_free(options_list, TRUE);
 }
@@ -117,14 +129,18 @@ struct sr_channel** get_device_channels(struct sr_dev_inst *dev, int *num) {
 		perror("malloc");
 		exit(1);
 	}
-	for (guint i = 0; i < ch_count && ch_list != NULL; ch_list = ch_list->next) {
+	// Only analog channels are captured, the others are disabled
+	guint n = 0;
+	for (; ch_list != NULL; ch_list = ch_list->next) {
 		struct sr_channel *channel;
 		channel = ch_list->data;
-		channels[i++] = channel;
-		assert_sr(sr_dev_channel_enable(channel, TRUE), "enabling channel");
+		gboolean analog = channel->type == SR_CHANNEL_ANALOG;
+		if (analog)
+			channels[n++] = channel;
+		assert_sr(sr_dev_channel_enable(channel, analog), "enabling channel");
 	}
-	channels[ch_count] = NULL;
-	num[0] = ch_count;
+	channels[n] = NULL;
+	num[0] = n;
 	return channels;
 }
 
@@ -159,19 +175,14 @@ struct sr_dev_driver *get_driver(const char *driver_name,
 }
 
 
-struct sr_dev_inst *get_device(struct sr_dev_driver *driver) {
+GSList *get_devices(struct sr_dev_driver *driver) {
 	GSList* dev_list = sr_driver_scan(driver, NULL);
 	if (dev_list == NULL) {
-		fprintf(stderr, "No devices found\n");
+		fprintf(stderr, "No %s devices found\n", driver->name);
 		exit(1);
 		return NULL;
 	}
-
-	struct sr_dev_inst *dev;
-	dev = dev_list->data;
-
-	g_slist_free(dev_list);
-	return dev;
+	return dev_list;
 }
 
 
@@ -180,7 +191,7 @@ int find_rising_edge(float level, float *samples, int num_samples) {
 		if (samples[i] < level && samples[i+1] > level)
 			return i;
 	}
-	return 0;
+	return -1;
 }
 
 
@@ -189,141 +200,569 @@ int find_falling_edge(float level, float *samples, int num_samples) {
 		if (samples[i] > level && samples[i+1] < level)
 			return i;
 	}
+	return -1;
+}
+
+
+float channel_vdiv(struct state *s, int c) {
+	for (int g = 0; g < s->num_channel_groups; g++) {
+		GSList *l = s->chgroups[g]->channels;
+		for (; l != NULL; l = l->next) {
+			struct sr_channel *ch = l->data;
+			if (ch == s->channels[c] && s->volts_per_div[g][1] != 0)
+				return (float) s->volts_per_div[g][0] / s->volts_per_div[g][1];
+		}
+	}
 	return 0;
 }
 
 
-void push_buffers(struct state *s) {
-	if (s->gloscope == NULL || !s->gloscope->ready)
-		return;
+void export_frame(struct state *s, int length, int trigger) {
+	struct rokshm_frame f;
+	struct timespec ts;
 
-	int maxpos = 0;
-	int skip = s->skip;
+	memset(&f, 0, sizeof(f));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	f.num_channels = s->num_channels;
+	if (f.num_channels > ROKSHM_MAX_CHANNELS)
+		f.num_channels = ROKSHM_MAX_CHANNELS;
+	for (uint32_t c = 0; c < f.num_channels; c++) {
+		f.data[c] = s->frame[c];
+		f.vdiv[c] = channel_vdiv(s, c);
+	}
+
+	f.num_samples = length;
+	f.trigger = trigger < 0 ? UINT32_MAX : (uint32_t) trigger;
+	f.timestamp_ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	f.samplerate = s->sample_rate;
+	rokshm_publish(s->shm, &f);
+}
+
+
+int get_trigger_channel(struct state *s) {
 	int trigger_channel = s->trigger_channel;
 	if (trigger_channel < 0 || trigger_channel >= s->num_channels)
 		trigger_channel = 0;
-	float *trigger_buff = s->buffers[trigger_channel] + skip;
-	int trigchan_pos = s->positions[trigger_channel] - skip;
+	return trigger_channel;
+}
+
+
+// Runs on every triggered frame, whether or not it ends up being displayed.
+void analyze_frame(struct state *s, int length, int trigger) {
+	if (trigger < 0)
+		return;
 
-	int trig = 0;
-	if (s->trigger_mode == TRIGGER_RISING) {
-		trig = find_rising_edge(s->trigger_level, trigger_buff, trigchan_pos);
-	} else if (s->trigger_mode == TRIGGER_FALLING) {
-		trig = find_falling_edge(s->trigger_level, trigger_buff, trigchan_pos);
+	sample_t *at_trigger[s->num_channels];
+	int count = length - trigger;
+	for (int c = 0; c < s->num_channels; c++)
+		at_trigger[c] = s->frame[c] + trigger;
+
+	if (s->mask_golden_pending && count > 0) {
+		mask_from_golden(&s->mask, s->num_channels, s->mask.channel,
+				at_trigger[s->mask.channel], count, s->mask_golden_tolerance);
+		s->mask.enabled = 1;
+		s->mask_golden_pending = 0;
 	}
-	skip += trig;
+	mask_test(&s->mask, at_trigger, count, s->frame_count);
+
+	if (s->trigger_mode != TRIGGER_NONE)
+		ets_accumulate(&s->ets, s->frame, length, get_trigger_channel(s),
+				trigger, s->trigger_level);
+}
+
+
+void frame_copy_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	struct device *d = channel_device(s, t->index);
+	device_copy_channel(d, t->index - d->first_channel, d->frame_start,
+			s->pending_length, s->frame[t->index]);
+}
+
+
+void frame_export_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	export_frame(s, s->pending_length, s->pending_trigger);
+}
 
-	for (int c = 0; c < s->num_channels; c++) {
-		struct gloscope_plot *plot = s->gloscope->plots[c];
-		int plot_size = plot->num_samples;
-		int end = s->positions[c];
-		int count = end - skip;
-		int size = plot_size > count ? count : plot_size;
-		if (size > 0)
-			memcpy(plot->vert_data, s->buffers[c] + skip, size * sizeof(sample_t));
-		if (maxpos < count)
-			maxpos = count;
-		s->positions[c] = 0;
+
+void frame_analyze_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	analyze_frame(s, s->pending_length, s->pending_trigger);
+}
+
+
+void frame_xcorr_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	xcorr_push(&s->xcorr, s->frame[s->xcorr.channel_a],
+			s->frame[s->xcorr.channel_b], s->pending_length, s->sample_rate);
+}
+
+
+void frame_plot_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	int c = t->index;
+	struct gloscope_plot *plot = s->gloscope->plots[c];
+	if (s->ets.factor >= 2) {
+		sample_t bins[ETS_BINS];
+		ets_render(&s->ets, c, bins, ETS_BINS);
+		gloscope_plot_set(s->gloscope, plot, bins, ETS_BINS);
+	} else {
+		gloscope_plot_set(s->gloscope, plot, s->frame[c], s->pending_length);
 	}
+}
 
-	s->gloscope->start_idx = 0;
-	s->gloscope->stop_idx = maxpos - 1;
 
+void frame_ref_task(struct pool_task *t) {
+	struct state *s = t->arg;
+	struct ref *r = &s->refs[t->index];
+	ref_compare(r, s->frame[r->channel], s->pending_length);
 }
 
 
-void on_session_stopped(void *data) {
-	struct state *s = data;
-	s->buff_idx++;
-	if (s->running)
-		assert_sr(sr_session_start(s->session), "starting session");
-	push_buffers(s);
+// Reference plots follow the view width, the frame length and the zoom;
+// otherwise they stay as uploaded. Inactive ones are left out.
+void update_ref_plots(struct state *s, int length) {
+	struct gloscope_context *ctx = s->gloscope;
+	for (int i = 0; i < REF_SLOTS; i++) {
+		struct ref *r = &s->refs[i];
+		s->ref_plots[i] = NULL;
+		if (!r->active || r->channel >= s->num_channels)
+			continue;
+		int n = r->num_samples < length ? r->num_samples : length;
+		if (r->plot == NULL)
+			r->plot = gloscope_plot_alloc(2 * ctx->columns);
+		if (r->plot_stale || r->plot->frame_samples != n
+				|| r->plot_columns != ctx->columns) {
+			gloscope_plot_set(ctx, r->plot, r->data, n);
+			r->plot_columns = ctx->columns;
+			r->plot_stale = 0;
+		}
+		struct gloscope_plot *live = ctx->plots[r->channel];
+		r->plot->color = live->color;
+		r->plot->color.a = .4f;
+		memcpy(r->plot->tform, live->tform, sizeof(live->tform));
+		s->ref_plots[i] = r->plot;
+	}
+	ctx->refs = s->ref_plots;
+	ctx->num_refs = REF_SLOTS;
 }
 
 
-int get_datafeed_analog_channel(const struct sr_datafeed_analog *payload) {
-	GSList *channels;
-	struct sr_channel *channel;
+// Runs on every frame once the position of each device in it is known.
+// trigger is the index of the trigger point in the frame, or -1 for a
+// frame shown only because no trigger came in time. The per-channel copy
+// out of the rings and everything that follows from it run as a task
+// graph on the worker pool: a channel's plot is decimated as soon as the
+// channel is copied, while the others are still being copied, and the
+// stages needing every channel wait for all the copies only.
+void push_frame(struct state *s, int length, int trigger) {
+	struct pool_graph *g = &s->frame_graph;
+	int copy[s->num_channels];
+	int analyze, t;
+	gboolean plots = s->gloscope != NULL && s->gloscope->ready
+			&& !s->xy_active;
+
+	s->pending_length = length;
+	s->pending_trigger = trigger;
+	// Plots decimate for the zoom too
+	if (plots)
+		s->gloscope->zoom = s->zoom_active ? s->zoom : NULL;
+	pool_graph_clear(g);
+	for (int c = 0; c < s->num_channels; c++)
+		copy[c] = pool_graph_add(g, frame_copy_task, s, c);
+	if (s->shm != NULL) {
+		t = pool_graph_add(g, frame_export_task, s, 0);
+		for (int c = 0; c < s->num_channels; c++)
+			pool_graph_after(g, t, copy[c]);
+	}
+	analyze = pool_graph_add(g, frame_analyze_task, s, 0);
+	for (int c = 0; c < s->num_channels; c++)
+		pool_graph_after(g, analyze, copy[c]);
+	if (s->xcorr.active) {
+		t = pool_graph_add(g, frame_xcorr_task, s, 0);
+		pool_graph_after(g, t, copy[s->xcorr.channel_a]);
+		pool_graph_after(g, t, copy[s->xcorr.channel_b]);
+	}
+	for (int i = 0; i < REF_SLOTS; i++) {
+		if (!s->refs[i].active || s->refs[i].channel >= s->num_channels)
+			continue;
+		t = pool_graph_add(g, frame_ref_task, s, i);
+		pool_graph_after(g, t, copy[s->refs[i].channel]);
+	}
+	for (int c = 0; plots && c < s->num_channels; c++) {
+		t = pool_graph_add(g, frame_plot_task, s, c);
+		pool_graph_after(g, t, copy[c]);
+		if (s->ets.factor >= 2)
+			pool_graph_after(g, t, analyze);
+	}
+	pool_run(&s->pool, g);
+	s->frame_count++;
+
+	if (s->decode.active && s->decode_overlay != NULL) {
+		s->decode_frame_start =
+				channel_device(s, s->decode.inputs[0])->frame_start;
+		s->decode_frame_length = length;
+		gtk_widget_queue_draw(s->decode_overlay);
+	}
 
-	channels = payload->meaning->channels;
-	if (channels == NULL) {
-		fprintf(stderr, "Channels is null?\n");
-		exit(1);
+	if (s->gloscope == NULL || !s->gloscope->ready)
+		return;
+
+	struct gloscope_image *image = NULL;
+	if (s->eye.active) {
+		eye_render(&s->eye);
+		image = s->eye.image;
+	} else if (s->spectrogram.active) {
+		image = s->spectrogram.image;
 	}
-	if (channels->next != NULL) {
-		fprintf(stderr, "Channels is > 1?\n");
-		exit(1);
+	s->gloscope->image = image;
+	s->gloscope->hide_plots = image != NULL;
+	s->gloscope->sinc = s->sinc;
+
+	// XY mode plots the raw frame, every frame
+	s->gloscope->histogram = s->histogram_active ? s->histogram : NULL;
+	s->gloscope->xy = s->xy_active ? s->xy : NULL;
+	if (s->xy_active) {
+		gloscope_xy_push(s->xy, s->frame[s->xy_channel_x],
+				s->frame[s->xy_channel_y], length);
+		return;
 	}
-	channel = channels->data;
-	int c = channel->index;
-	return c;
+
+	for (int c = 0; s->histogram_active && c < s->num_channels; c++)
+		gloscope_histogram_push(s->histogram, c, s->frame[c], length);
+	update_ref_plots(s, length);
 }
 
 
-void on_session_datafeed(const struct sr_dev_inst *dev,
-		const struct sr_datafeed_packet *packet, void *data) {
-	UNUSED(data);
-	UNUSED(dev);
-	uint16_t type = packet->type;
-	struct state *s = data;
+struct device *channel_device(struct state *s, int c) {
+	for (int i = s->num_devices - 1; i > 0; i--) {
+		if (c >= s->devices[i]->first_channel)
+			return s->devices[i];
+	}
+	return s->devices[0];
+}
 
-	switch (type) {
 
-		case SR_DF_HEADER: {
-			const struct sr_datafeed_header *payload;
-			payload = packet->payload;
-			UNUSED(payload);
-		} break;
+// Sizes the capture rings for the current settings and rearms the trigger
+// on the device of the trigger channel. Continuous acquisitions have no
+// samples limit, so the rings also hold a fixed time at the sample rate.
+void capture_reset(struct state *s) {
+	size_t length = s->pretrigger + s->posttrigger;
+	size_t span = (size_t) (s->sample_rate * CAPTURE_RING_SECONDS);
+	if (span > CAPTURE_RING_MAX)
+		span = CAPTURE_RING_MAX;
+	if (span < 2 * s->samples_limit)
+		span = 2 * s->samples_limit;
+	size_t needed = span + 4 * length;
+	uint64_t written, oldest, header_pos;
+
+	for (int i = 0; i < s->num_devices; i++)
+		device_reserve(s->devices[i], needed);
+
+	s->frame_data = notnull(realloc(s->frame_data,
+			(s->num_channels * length + 1) * sizeof(sample_t)));
+	for (int c = 0; c < s->num_channels; c++)
+		s->frame[c] = s->frame_data + c * length;
+
+	s->trigger_device = channel_device(s, get_trigger_channel(s));
+	device_positions(s->trigger_device, &written, &oldest, &header_pos);
+	s->trigger_pos = -1;
+	s->trigger_scan = written;
+	s->frame_end = written;
+	s->frame_pending = FALSE;
+}
+
+
+// Assembles the pending frame: the trigger device's samples from
+// pending_start, every other device's samples taken at the same time
+// according to its own time base. The frame stays pending until all the
+// devices have caught up, unless force is set; the channels of a device
+// that is behind are then left at zero.
+gboolean capture_merge(struct state *s, gboolean force) {
+	struct device *ref = s->trigger_device;
+	int length = s->pending_length;
+	int64_t start[s->num_devices];
+	gint64 t = device_time_at(ref, (int64_t) s->pending_start);
+
+	for (int i = 0; i < s->num_devices; i++) {
+		struct device *d = s->devices[i];
+		uint64_t written, oldest, header_pos;
+		start[i] = d == ref ? (int64_t) s->pending_start
+				: device_position_at(d, t);
+		device_positions(d, &written, &oldest, &header_pos);
+		if (start[i] + length > (int64_t) written && !force)
+			return FALSE;
+	}
+
+	for (int i = 0; i < s->num_devices; i++)
+		s->devices[i]->frame_start = start[i];
+	s->frame_pending = FALSE;
+	push_frame(s, length, s->pending_trigger);
+	return TRUE;
+}
+
+
+gboolean capture_frame(struct state *s, uint64_t start, int length,
+		int trigger) {
+	s->frame_pending = TRUE;
+	s->pending_start = start;
+	s->pending_length = length;
+	s->pending_trigger = trigger;
+	return capture_merge(s, FALSE);
+}
 
-		case SR_DF_ANALOG: {
-			const struct sr_datafeed_analog *payload;
-			float *payload_data;
-			sample_t *dest;
 
-			payload = packet->payload;
-			payload_data = payload->data;
+// Whether the frame of length samples from start has the restart of the
+// acquisition at header_pos in it, joining samples of two acquisitions.
+gboolean capture_spans_restart(uint64_t start, uint64_t length,
+		uint64_t header_pos) {
+	return start < header_pos && header_pos < start + length;
+}
 
-			int c = get_datafeed_analog_channel(payload);
-			int buff_pos = s->positions[c];
 
-			int payload_count = payload->num_samples;
-			int plot_count = (int) s->samples_limit;
-			int plot_free = plot_count - buff_pos;
-			int copy_count = payload_count > plot_free ? plot_free : payload_count;
-			size_t copy_size = copy_count * sizeof(sample_t);
+// Looks for trigger edges in the new samples of the trigger channel and
+// pushes every frame whose post-trigger samples have arrived on all
+// channels. Without a trigger for half the ring, the latest samples are
+// shown anyway. No frame is taken across an acquisition restart.
+void capture_update(struct state *s) {
+	if (s->trigger_device != channel_device(s, get_trigger_channel(s)))
+		capture_reset(s);
+	struct device *ref = s->trigger_device;
+	uint64_t length = s->pretrigger + s->posttrigger;
+	struct ring *tring = &ref->rings[get_trigger_channel(s)
+			- ref->first_channel];
+	uint64_t written, oldest, header_pos;
+
+	device_positions(ref, &written, &oldest, &header_pos);
+	if (written < length)
+		return;
 
-			dest = s->buffers[c];
-			memcpy(&dest[buff_pos], payload_data, copy_size);
-			s->positions[c] = buff_pos + copy_count;
-		} break;
+	if (s->frame_pending) {
+		gboolean force = written - s->pending_start > tring->capacity / 2;
+		if (!capture_merge(s, force))
+			return;
+	}
 
-		case SR_DF_LOGIC: break; // Skip this, we only want analog
-		case SR_DF_END: break;
+	// Edges are searched from where the pre-trigger samples all come
+	// from the current acquisition
+	if (s->trigger_scan < header_pos + s->pretrigger)
+		s->trigger_scan = header_pos + s->pretrigger;
+
+	for (;;) {
+		if (s->trigger_pos < 0 && s->trigger_mode == TRIGGER_NONE) {
+			if (s->frame_end < oldest)
+				s->frame_end = written - length;
+			if (capture_spans_restart(s->frame_end, length, header_pos))
+				s->frame_end = header_pos;
+			if (written < s->frame_end + length)
+				return;
+			uint64_t start = s->frame_end;
+			s->frame_end += length;
+			if (!capture_frame(s, start, (int) length, s->pretrigger))
+				return;
+			continue;
+		}
 
-		default:
-			printf("unknown datafeed type %d\n", type);
+		if (s->trigger_pos < 0) {
+			uint64_t from = s->trigger_scan;
+			if (from < oldest + s->pretrigger)
+				from = oldest + s->pretrigger;
+			if (written < from + 2)
+				return;
+
+			int n = (int) (written - from);
+			float *samples = ring_at(tring, from);
+			int idx = -1;
+			if (s->trigger_mode == TRIGGER_RISING)
+				idx = find_rising_edge(s->trigger_level, samples, n);
+			else if (s->trigger_mode == TRIGGER_FALLING)
+				idx = find_falling_edge(s->trigger_level, samples, n);
+
+			if (idx < 0) {
+				s->trigger_scan = written - 1;
+				if (written - s->frame_end > tring->capacity / 2
+						&& !capture_spans_restart(written - length, length,
+						header_pos)) {
+					s->frame_end = written;
+					capture_frame(s, written - length, (int) length, -1);
+				}
+				return;
+			}
+			s->trigger_pos = (int64_t) (from + idx);
+		}
 
+		// A trigger armed before a restart is dropped; the search goes
+		// on past the restart
+		uint64_t trigger_pos = (uint64_t) s->trigger_pos;
+		if (trigger_pos < oldest + s->pretrigger
+				|| capture_spans_restart(trigger_pos - s->pretrigger, length,
+				header_pos)) {
+			s->trigger_pos = -1;
+			continue;
+		}
+		if (written < trigger_pos + s->posttrigger)
+			return;
+		s->frame_end = trigger_pos + s->posttrigger;
+		s->trigger_scan = s->frame_end;
+		s->trigger_pos = -1;
+		if (!capture_frame(s, trigger_pos - s->pretrigger, (int) length,
+				s->pretrigger))
+			return;
 	}
 }
 
 
-void stdin_data(struct state *s, const char *stdin_buff, size_t bytes_read) {
-	char *cmdend = memchr(stdin_buff, '\n', bytes_read);
+// Start position shared by every channel of the device of channel c, for
+// consumers that line channels up sample by sample.
+uint64_t capture_device_start(struct state *s, int c) {
+	uint64_t written, oldest, header_pos;
+	device_positions(channel_device(s, c), &written, &oldest, &header_pos);
+	return written;
+}
 
-	if (cmdend != NULL) {
-		cmdend[0] = 0;
-		char *str = malloc(STDIN_BUFF_SIZE);
-		memcpy(str, stdin_buff, STDIN_BUFF_SIZE);
-		parse_command(s, str);
-		free(str);
+
+uint64_t capture_stream_start(struct state *s, int c) {
+	struct device *d = channel_device(s, c);
+	uint64_t written, oldest, header_pos;
+	device_channel_positions(d, c - d->first_channel, &written, &oldest,
+			&header_pos);
+	return written;
+}
+
+
+// Feeds the samples of channel c received since *pos to a continuous
+// stream consumer; n == 0 marks a gap, at every acquisition restart and
+// when samples were lost. Samples is NULL only for lost samples, so
+// consumers can tell the two apart.
+void capture_stream(struct state *s, int c, uint64_t *pos,
+		void (*push)(struct state *, int, const sample_t *, int)) {
+	struct device *d = channel_device(s, c);
+	struct ring *r = &d->rings[c - d->first_channel];
+	uint64_t written, oldest, header_pos;
+
+	device_channel_positions(d, c - d->first_channel, &written, &oldest,
+			&header_pos);
+	if (*pos < oldest || *pos > written) {
+		push(s, c, NULL, 0);
+		*pos = oldest;
+	}
+	if (*pos < header_pos && header_pos <= written) {
+		push(s, c, ring_at(r, *pos), (int) (header_pos - *pos));
+		push(s, c, ring_at(r, header_pos), 0);
+		*pos = header_pos;
 	}
+	if (*pos < written)
+		push(s, c, ring_at(r, *pos), (int) (written - *pos));
+	*pos = written;
+}
+
+
+void stream_eye(struct state *s, int c, const sample_t *samples, int n) {
+	UNUSED(c);
+	eye_push(&s->eye, samples, n);
+}
+
+
+void stream_spectrogram(struct state *s, int c, const sample_t *samples,
+		int n) {
+	UNUSED(c);
+	if (n == 0)
+		spectrogram_gap(&s->spectrogram);
+	else
+		spectrogram_push(&s->spectrogram, samples, n);
+}
+
+
+void stream_log(struct state *s, int c, const sample_t *samples, int n) {
+	logger_push(&s->logger, c, samples, n);
+}
+
+
+void stream_record(struct state *s, int c, const sample_t *samples, int n) {
+	recorder_push(&s->recorder, c, samples, n);
+}
+
+
+void stream_decode_push(struct state *s, struct device *d, uint64_t from,
+		uint64_t to) {
+	struct decode *dc = &s->decode;
+	const sample_t *x[DECODE_MAX_CHANNELS];
+	for (int i = 0; i < dc->num_inputs; i++)
+		x[i] = ring_at(&d->rings[dc->inputs[i] - d->first_channel], from);
+	decode_push(dc, from, x, (int) (to - from), s->sample_rate);
+}
+
+
+// Like capture_stream, for all the decoder inputs at once; they are on
+// the same device, so a position is the same sample time on all of them.
+void stream_decode(struct state *s) {
+	struct decode *dc = &s->decode;
+	struct device *d = channel_device(s, dc->inputs[0]);
+	uint64_t written = UINT64_MAX, oldest = 0, header_pos = 0;
+
+	for (int i = 0; i < dc->num_inputs; i++) {
+		uint64_t w, o;
+		device_channel_positions(d, dc->inputs[i] - d->first_channel, &w, &o,
+				&header_pos);
+		written = w < written ? w : written;
+		oldest = o > oldest ? o : oldest;
+	}
+	if (dc->pos < oldest || dc->pos > written) {
+		decode_gap(dc);
+		dc->pos = oldest;
+	}
+	if (dc->pos < header_pos && header_pos <= written) {
+		stream_decode_push(s, d, dc->pos, header_pos);
+		decode_gap(dc);
+		dc->pos = header_pos;
+	}
+	if (dc->pos < written)
+		stream_decode_push(s, d, dc->pos, written);
+	dc->pos = written;
+}
+
+
+// Scheduled on the main thread by the device threads when new samples
+// arrive; one update handles everything received since the last one.
+gboolean on_capture_update(gpointer data) {
+	struct state *s = data;
+	g_atomic_int_set(&s->update_pending, 0);
+
+	capture_update(s);
+	if (s->autoset.step > 0)
+		autoset_update(s);
+	if (s->eye.active)
+		capture_stream(s, s->eye.channel, &s->eye_pos, stream_eye);
+	if (s->spectrogram.active)
+		capture_stream(s, s->spectrogram.channel, &s->spectrogram_pos,
+				stream_spectrogram);
+	if (s->logger.active) {
+		for (int c = 0; c < s->num_channels; c++)
+			capture_stream(s, c, &s->log_pos[c], stream_log);
+	}
+	if (s->recorder.active) {
+		for (int c = 0; c < s->num_channels; c++)
+			capture_stream(s, c, &s->rec_pos[c], stream_record);
+	}
+	if (s->decode.active)
+		stream_decode(s);
+	return G_SOURCE_REMOVE;
+}
+
+
+void stdin_data(struct state *s, const char *stdin_buff, size_t bytes_read) {
+	g_byte_array_append(s->stdin_pending, (const guint8 *) stdin_buff,
+			(guint) bytes_read);
+	size_t used = process_commands(s, s->stdin_pending->data,
+			s->stdin_pending->len, NULL);
+	g_byte_array_remove_range(s->stdin_pending, 0, (guint) used);
 }
 
 
 void on_stdin_read(GObject *src, GAsyncResult *res, void *data) {
 	struct state *s = data;
 	GInputStream *input = (GInputStream *) src;
-	GError *error;
+	GError *error = NULL;
 	gssize bytes_read;
 	bytes_read = g_input_stream_read_finish(input, res, &error);
 	if (bytes_read == -1) {
@@ -341,48 +780,116 @@ void on_stdin_read(GObject *src, GAsyncResult *res, void *data) {
 }
 
 
-void application_startup(GApplication *application, gpointer user_data) {
-	UNUSED(application);
-	struct state *s = user_data;
-	int ret;
+void add_device(struct state *s, struct sr_dev_driver *driver,
+		struct sr_dev_inst *sdi) {
+	struct device *d = zalloc(sizeof(*d));
+	d->driver = driver;
+	d->sdi = sdi;
 
-	s->context = NULL;
-	assert_sr(sr_init(&s->context), "initializing libsigrok");
+	assert_sr(sr_dev_open(sdi), "opening device");
+
+	d->num_channel_groups = get_device_channel_groups(sdi, &d->chgroups);
+	d->channels = get_device_channels(sdi, &d->num_channels);
+	if (d->num_channels == 0) {
+		fprintf(stderr, "%s device has no analog channels\n", driver->name);
+		exit(1);
+	}
+
+	d->first_channel = s->num_channels;
+	s->num_channels += d->num_channels;
+	s->channels = notnull(realloc(s->channels,
+			s->num_channels * sizeof(*s->channels)));
+	memcpy(s->channels + d->first_channel, d->channels,
+			d->num_channels * sizeof(*s->channels));
+
+	int first_group = s->num_channel_groups;
+	s->num_channel_groups += d->num_channel_groups;
+	s->chgroups = notnull(realloc(s->chgroups,
+			s->num_channel_groups * sizeof(*s->chgroups)));
+	s->chgroup_devices = notnull(realloc(s->chgroup_devices,
+			s->num_channel_groups * sizeof(*s->chgroup_devices)));
+	for (int i = 0; i < d->num_channel_groups; i++) {
+		s->chgroups[first_group + i] = d->chgroups[i];
+		s->chgroup_devices[first_group + i] = d;
+	}
+
+	s->devices = notnull(realloc(s->devices,
+			(s->num_devices + 1) * sizeof(*s->devices)));
+	s->devices[s->num_devices++] = d;
 
-	s->driver = get_driver("hantek-6xxx", s->context);
-	//s.driver = get_driver("demo", s.context);
-	enumerate_device_options("Driver", s->driver, NULL, NULL);
+	device_init(d, s);
+	printf("Device %d: %s, channels %d to %d\n", s->num_devices - 1,
+			driver->name, d->first_channel, s->num_channels - 1);
+}
 
-	s->device = get_device(s->driver);
-	enumerate_device_options("Device", s->driver, s->device, NULL);
-	assert_sr(sr_dev_open(s->device), "opening device");
 
-	s->num_channel_groups = get_device_channel_groups(s->device, &s->chgroups);
-	for (int i = 0; i < s->num_channel_groups; i++)
-		enumerate_device_options("Channel group", s->driver, s->device, s->chgroups[i]);
-	s->channels = get_device_channels(s->device, &s->num_channels);
-	s->positions = zalloc(s->num_channels * sizeof(int));
-	s->buffers = zalloc(s->num_channels * sizeof(*s->buffers));
+// Opens every device found by each driver. A driver may be named more
+// than once: each name triggers a new scan, which is how the demo driver
+// provides several devices.
+void open_devices(struct state *s, const gchar *const *driver_names) {
+	int num_drivers = g_strv_length((gchar **) driver_names);
+	struct sr_dev_driver *drivers[num_drivers];
+
+	for (int i = 0; i < num_drivers; i++) {
+		drivers[i] = NULL;
+		for (int j = 0; j < i; j++) {
+			if (0 == strcmp(driver_names[i], driver_names[j]))
+				drivers[i] = drivers[j];
+		}
+		if (drivers[i] == NULL)
+			drivers[i] = get_driver(driver_names[i], s->context);
+
+		GSList *dev_list = get_devices(drivers[i]);
+		for (GSList *l = dev_list; l != NULL; l = l->next)
+			add_device(s, drivers[i], l->data);
+		g_slist_free(dev_list);
+	}
+
+	s->frame = zalloc(s->num_channels * sizeof(*s->frame));
+	ets_init(&s->ets, s->num_channels);
+	counter_init(&s->counter);
+	pool_init(&s->pool, 0);
+	s->volts_per_div = zalloc(s->num_channel_groups * sizeof(*s->volts_per_div));
+	s->log_pos = zalloc(s->num_channels * sizeof(*s->log_pos));
+	s->rec_pos = zalloc(s->num_channels * sizeof(*s->rec_pos));
 
 	cmd_set_samplerate(s, 100000);
+	cmd_set_pretrigger(s, 256);
+	cmd_set_posttrigger(s, 768);
 	cmd_set_sampleslimit(s, 4096);
-	cmd_set_skip(s, 512);
 
 	cmd_set_triggerlevel(s, .1f);
 	cmd_set_triggermode(s, TRIGGER_RISING);
-	cmd_set_voltsperdiv(s, 0, 100, 1000);
-	cmd_set_voltsperdiv(s, 1, 100, 1000);
+	for (int g = 0; g < s->num_channel_groups; g++)
+		cmd_set_voltsperdiv(s, g, 100, 1000);
+}
 
-	s->session = NULL;
-	assert_sr(sr_session_new(s->context, &s->session), "creating session");
-	assert_sr(sr_session_dev_add(s->session, s->device),
-			"adding device to session");
 
-	ret = sr_session_datafeed_callback_add(s->session, on_session_datafeed, s);
-	assert_sr(ret, "adding callback for session datafeed");
+// Dumps the options of a device, refreshing the cached lists from it. Runs
+// on the device thread at low priority, between the datafeed callbacks,
+// so neither the main loop nor the acquisition waits for the queries.
+gboolean refresh_device_options(gpointer data) {
+	struct device *d = data;
+	struct caps *caps = &d->s->caps;
 
-	ret = sr_session_stopped_callback_set(s->session, on_session_stopped, s);
-	assert_sr(ret, "setting callback for session stopped");
+	GMutex *lock = &d->config_lock;
+
+	enumerate_device_options(caps, lock, "Driver", d->driver, NULL, NULL);
+	enumerate_device_options(caps, lock, "Device", d->driver, d->sdi, NULL);
+	for (int i = 0; i < d->num_channel_groups; i++)
+		enumerate_device_options(caps, lock, "Channel group", d->driver,
+				d->sdi, d->chgroups[i]);
+	caps_save(caps);
+	return G_SOURCE_REMOVE;
+}
+
+
+void application_startup(GApplication *application, gpointer user_data) {
+	UNUSED(application);
+	struct state *s = user_data;
+
+	s->context = NULL;
+	assert_sr(sr_init(&s->context), "initializing libsigrok");
 }
 
 
@@ -390,14 +897,55 @@ gint application_command_line(GtkApplication *application,
 		GApplicationCommandLine *cmdline, gpointer user_data) {
 	UNUSED(application);
 	struct state *s = user_data;
+	GVariantDict *options = g_application_command_line_get_options_dict(cmdline);
+	const gchar *control_path;
+	const gchar *shm_name;
+	const gchar **driver_names;
+	const gchar *default_drivers[] = { "hantek-6xxx", NULL };
+	const gchar *log_path;
+	const gchar *recording_path;
+
+	// Viewing a log or a recording needs no device
+	if (g_variant_dict_lookup(options, "view-log", "^&ay", &log_path)) {
+		s->gui = logview_create(s->application, log_path);
+		return 0;
+	}
+	if (g_variant_dict_lookup(options, "view-recording", "^&ay",
+			&recording_path)) {
+		s->gui = recview_create(s->application, recording_path);
+		return 0;
+	}
+
+	if (g_variant_dict_lookup(options, "driver", "^a&s", &driver_names)) {
+		open_devices(s, driver_names);
+		g_free(driver_names);
+	} else {
+		open_devices(s, default_drivers);
+	}
 
-	s->running = TRUE;
 	s->gui = gui_create(s);
-	assert_sr(sr_session_start(s->session), "starting session");
+	cmd_set_running(s, TRUE);
+	for (int i = 0; i < s->num_devices; i++)
+		g_main_context_invoke_full(s->devices[i]->context, G_PRIORITY_LOW,
+				refresh_device_options, s->devices[i], NULL);
+
+	if (g_variant_dict_lookup(options, "control", "^&ay", &control_path))
+		control_listen(s, control_path);
+
+	if (g_variant_dict_lookup(options, "shm", "&s", &shm_name)) {
+		s->shm = zalloc(sizeof(*s->shm));
+		if (rokshm_create(s->shm, shm_name, ROKSHM_MAX_CHANNELS,
+				ROKSHM_DEFAULT_SAMPLES, ROKSHM_DEFAULT_SLOTS) < 0) {
+			perror("Error creating shared memory");
+			exit(1);
+		}
+		printf("Exporting frames to shared memory %s\n", shm_name);
+	}
 
+	s->stdin_pending = g_byte_array_new();
 	GInputStream *input = g_application_command_line_get_stdin(cmdline);
-	g_input_stream_read_async(input, s->stdin_buff, 80, G_PRIORITY_DEFAULT,
-			NULL, on_stdin_read, s);
+	g_input_stream_read_async(input, s->stdin_buff, STDIN_BUFF_SIZE,
+			G_PRIORITY_DEFAULT, NULL, on_stdin_read, s);
 
 	//g_application_hold(G_APPLICATION(application));
 
@@ -409,10 +957,20 @@ void application_shutdown(GApplication *application, gpointer user_data) {
 	UNUSED(application);
 	struct state *s = user_data;
 
-	assert_sr(sr_session_stop(s->session), "stopping session");
-	assert_sr(sr_session_run(s->session), "running session");
-	assert_sr(sr_session_destroy(s->session), "destroying session");
-	assert_sr(sr_dev_close(s->device), "closing device");
+	control_close(s);
+	eye_stop(&s->eye);
+	logger_stop(&s->logger);
+	recorder_stop(&s->recorder);
+	xcorr_stop(&s->xcorr);
+	decode_stop(&s->decode);
+	pool_free(&s->pool);
+	pool_graph_free(&s->frame_graph);
+	if (s->shm != NULL)
+		rokshm_destroy(s->shm);
+	for (int i = 0; i < s->num_devices; i++)
+		device_close(s->devices[i]);
+	caps_save(&s->caps);
+	caps_free(&s->caps);
 	assert_sr(sr_exit(s->context), "shutting down libsigrok");
 }
 
@@ -420,9 +978,29 @@ void application_shutdown(GApplication *application, gpointer user_data) {
 int main(int argc, char **argv) {
 	struct state *s = zalloc(sizeof(struct state));
 	memset(s, 0, sizeof(*s));
+	caps_init(&s->caps);
 	s->application = gtk_application_new(NULL,
 			G_APPLICATION_HANDLES_COMMAND_LINE);
 
+	g_application_add_main_option(G_APPLICATION(s->application), "driver",
+			'd', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING_ARRAY,
+			"Open every device found by a sigrok driver, may be repeated"
+			" (default hantek-6xxx)", "NAME");
+	g_application_add_main_option(G_APPLICATION(s->application), "control",
+			'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+			"Accept commands on a Unix socket", "PATH");
+	g_application_add_main_option(G_APPLICATION(s->application), "shm",
+			0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+			"Publish triggered frames to POSIX shared memory", "NAME");
+	g_application_add_main_option(G_APPLICATION(s->application), "view-log",
+			0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+			"Browse a log written by the log command instead of capturing",
+			"FILE");
+	g_application_add_main_option(G_APPLICATION(s->application),
+			"view-recording", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+			"Browse and search a recording made by the record command",
+			"FILE");
+
 	g_signal_connect(s->application, "startup",
 			(GCallback) application_startup, s);
 	g_signal_connect(s->application, "command-line",
@@ -6,38 +6,144 @@
 #include <libsigrok/libsigrok.h>
 #include <gio/gunixinputstream.h>
 #include "gloscope.h"
+#include "rokshm.h"
+#include "mask.h"
+#include "ets.h"
+#include "eye.h"
+#include "spectrogram.h"
+#include "ring.h"
+#include "device.h"
+#include "caps.h"
+#include "logger.h"
+#include "autoset.h"
+#include "counter.h"
+#include "xcorr.h"
+#include "decode.h"
+#include "pool.h"
+#include "record.h"
+#include "search.h"
+#include "ref.h"
 
-#define STDIN_BUFF_SIZE 80
+#define STDIN_BUFF_SIZE 4096
+#define CONTROL_BUFF_SIZE 4096
 
 #define TRIGGER_NONE 0
 #define TRIGGER_RISING 1
 #define TRIGGER_FALLING 2
 
+// The rings hold at least this much time, up to CAPTURE_RING_MAX samples
+#define CAPTURE_RING_SECONDS 0.25
+#define CAPTURE_RING_MAX ((size_t) 1 << 26)
+
+#define COMMAND_FRAME_MAGIC 0xA5
+
+#define COMMAND_OP_SAMPLERATE 1
+#define COMMAND_OP_SAMPLESLIMIT 2
+#define COMMAND_OP_RUNNING 3
+#define COMMAND_OP_TRIGGERMODE 4
+#define COMMAND_OP_TRIGGERLEVEL 5
+#define COMMAND_OP_PRETRIGGER 6
+#define COMMAND_OP_VDIVS 7
+#define COMMAND_OP_VOLTSPERDIV 8
+#define COMMAND_OP_COUPLING 9
+#define COMMAND_OP_POSTTRIGGER 10
+
+// Binary command, 24 bytes in host byte order. The magic byte can never
+// start a text command, so both framings can share one stream.
+struct command_frame {
+	uint8_t magic;
+	uint8_t opcode;
+	uint16_t tag;
+	uint32_t channel;
+	union {
+		uint64_t u;
+		double f;
+	} arg;
+	uint64_t arg2;
+};
+
+struct command_reply {
+	uint8_t magic;
+	uint8_t opcode;
+	uint16_t tag;
+	int32_t status;
+};
+
 struct state {
 	GtkApplication *application;
 	GtkWindow *gui;
 	char stdin_buff[STDIN_BUFF_SIZE];
+	GByteArray *stdin_pending;
 	uint32_t buff_idx;
+	GSocketService *control;
 	GThread *rthread;
 	struct sr_context *context;
-	struct sr_dev_driver *driver;
-	struct sr_dev_inst *device;
-	struct sr_session *session;
-	int *positions;
-	float **buffers;
+	struct device **devices;
+	int num_devices;
+	sample_t **frame;
+	sample_t *frame_data;
+	uint64_t frame_count;
 	struct sr_channel **channels;
 	int num_channels;
 	struct sr_channel_group **chgroups;
+	struct device **chgroup_devices;
 	int num_channel_groups;
+	gint update_pending;
+	struct caps caps;
 	struct gloscope_context *gloscope;
+	struct rokshm *shm;
+	struct mask mask;
+	int mask_golden_pending;
+	sample_t mask_golden_tolerance;
+	struct ets ets;
+	struct eye eye;
+	struct spectrogram spectrogram;
+	uint64_t eye_pos;
+	uint64_t spectrogram_pos;
+	struct logger logger;
+	struct autoset autoset;
+	struct counter counter;
+	struct xcorr xcorr;
+	struct gloscope_xy *xy;
+	gboolean xy_active;
+	int xy_channel_x;
+	int xy_channel_y;
+	struct gloscope_histogram *histogram;
+	gboolean histogram_active;
+	gboolean sinc;
+	struct gloscope_zoom *zoom;
+	gboolean zoom_active;
+	struct ref refs[REF_SLOTS];
+	struct gloscope_plot *ref_plots[REF_SLOTS];
+	struct decode decode;
+	struct pool pool;
+	struct pool_graph frame_graph;
+	struct recorder recorder;
+	GtkWidget *decode_overlay;
+	int64_t decode_frame_start;
+	int decode_frame_length;
+	uint64_t *log_pos;
+	uint64_t *rec_pos;
+	GString *reply;
 	uint64_t samples_limit;
 	uint64_t sample_rate;
-	uint64_t volts_per_div[2];
+	uint64_t (*volts_per_div)[2];
 	uint64_t num_vdivs;
 	int trigger_mode;
 	sample_t trigger_level;
-	int skip;
+	int pretrigger;
+	int posttrigger;
+	struct device *trigger_device;
+	int64_t trigger_pos;
+	uint64_t trigger_scan;
+	uint64_t frame_end;
+	gboolean frame_pending;
+	uint64_t pending_start;
+	int pending_length;
+	int pending_trigger;
 	gboolean running;
+	gboolean in_batch;
+	gboolean batch_running;
 	const char *coupling;
 	int trigger_channel;
 };
@@ -45,14 +151,72 @@ struct state {
 typedef struct state state_t;
 
 void assert_sr(int, const char *);
-void parse_command(state_t *, char *);
+gboolean parse_command(state_t *, char *);
+gboolean execute_frame(state_t *, const struct command_frame *);
+size_t process_commands(state_t *, const guint8 *, size_t, GString *);
 GtkWindow *gui_create(state_t *);
+GtkWindow *logview_create(GtkApplication *, const char *);
+GtkWindow *recview_create(GtkApplication *, const char *);
+void control_listen(state_t *, const char *);
+void control_close(state_t *);
 
 void cmd_set_samplerate(state_t *, uint64_t);
 void cmd_set_sampleslimit(state_t *, uint64_t);
 void cmd_set_running(state_t *, gboolean);
 void cmd_set_voltsperdiv(state_t *, uint64_t, uint64_t, uint64_t);
 void cmd_set_vdiv(state_t *, uint64_t, uint64_t, uint64_t);
-void cmd_set_skip(state_t *, int);
+void cmd_set_pretrigger(state_t *, int);
+void cmd_set_posttrigger(state_t *, int);
+void capture_reset(state_t *);
+float channel_vdiv(state_t *, int);
+gboolean on_capture_update(gpointer);
+uint64_t capture_stream_start(state_t *, int);
+uint64_t capture_device_start(state_t *, int);
+struct device *channel_device(state_t *, int);
 void cmd_set_triggermode(state_t *, int);
 void cmd_set_triggerlevel(state_t *, sample_t);
+void cmd_set_ets(state_t *, int);
+void cmd_set_interpolation(state_t *, gboolean);
+void cmd_reply(state_t *, const char *, ...);
+void cmd_batch_begin(state_t *);
+void cmd_batch_end(state_t *);
+gboolean cmd_mask_load(state_t *, int, const char *);
+void cmd_mask_golden(state_t *, int, sample_t);
+void cmd_mask_enable(state_t *, gboolean);
+void cmd_mask_reset(state_t *);
+void cmd_mask_stats(state_t *);
+gboolean cmd_mask_save(state_t *, int, const char *);
+void cmd_eye_start(state_t *, int, double, sample_t);
+void cmd_eye_stop(state_t *);
+void cmd_eye_reset(state_t *);
+void cmd_eye_stats(state_t *);
+void cmd_spectrogram_start(state_t *, int);
+void cmd_spectrogram_stop(state_t *);
+gboolean cmd_log_start(state_t *, double, const char *);
+void cmd_log_stop(state_t *);
+void cmd_log_stats(state_t *);
+gboolean cmd_record_start(state_t *, const char *, int);
+void cmd_record_stop(state_t *);
+void cmd_record_stats(state_t *);
+void cmd_autoset(state_t *);
+void cmd_autoset_stats(state_t *);
+void cmd_counter_start(state_t *, int, double, sample_t, sample_t);
+void cmd_counter_stop(state_t *);
+void cmd_counter_stats(state_t *);
+void cmd_xcorr_start(state_t *, int, int);
+void cmd_xcorr_stop(state_t *);
+void cmd_xcorr_stats(state_t *);
+gboolean cmd_decode_start(state_t *, const char *, float, float, char **, int);
+void cmd_decode_stop(state_t *);
+void cmd_decode_stats(state_t *);
+void cmd_xy_start(state_t *, int, int, double);
+void cmd_xy_stop(state_t *);
+void cmd_histogram_start(state_t *, int);
+void cmd_histogram_stop(state_t *);
+void cmd_histogram_clear(state_t *);
+void cmd_zoom_start(state_t *, int, int);
+void cmd_zoom_stop(state_t *);
+gboolean cmd_ref_save(state_t *, int, int, const char *);
+gboolean cmd_ref_load(state_t *, int, const char *);
+void cmd_ref_clear(state_t *, int);
+void cmd_ref_stats(state_t *);
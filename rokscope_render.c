@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "gloscope.h"
+
+/*
+ * Headless renderer: runs gloscope on an offscreen framebuffer through an
+ * EGL surfaceless context (Mesa llvmpipe on machines without a GPU),
+ * replays frames and reports the time taken by every frame.
+ *
+ * Frames come from a raw file of float32 samples, --channels arrays of
+ * --samples values per frame, channel after channel; without a file a
+ * synthetic signal is rendered. Rendered frames can be written as PNG
+ * files and appended to a raw RGBA dump, both top row first.
+ */
+
+
+struct options {
+	gint width;
+	gint height;
+	gint channels;
+	gint samples;
+	gint frames;
+	gchar *input;
+	gchar *png;
+	gchar *raw;
+	gdouble xy;
+	gint histogram;
+	gboolean sinc;
+	gint zoom_start;
+	gint zoom_stop;
+};
+
+
+double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+void egl_init(void) {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLConfig config;
+	EGLContext context;
+	EGLint num_configs;
+
+	get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+			eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display != NULL)
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+				EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY)
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		fprintf(stderr, "Error initializing EGL: 0x%x\n", eglGetError());
+		exit(1);
+	}
+
+	// No surface is ever created, any surface type will do
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	if (!eglBindAPI(EGL_OPENGL_API)
+			|| !eglChooseConfig(display, config_attribs, &config, 1,
+					&num_configs) || num_configs < 1) {
+		fprintf(stderr, "No EGL config for desktop OpenGL: 0x%x\n",
+				eglGetError());
+		exit(1);
+	}
+
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+			context_attribs);
+	if (context == EGL_NO_CONTEXT
+			|| !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+					context)) {
+		fprintf(stderr, "Error creating a surfaceless OpenGL 4.4 context:"
+				" 0x%x\n", eglGetError());
+		exit(1);
+	}
+}
+
+
+void framebuffer_init(int width, int height) {
+	GLuint fbo, rbo;
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenRenderbuffers(1, &rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, rbo);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Offscreen framebuffer incomplete\n");
+		exit(1);
+	}
+	glViewport(0, 0, width, height);
+}
+
+
+// Reads the next frame of the input file, or synthesizes one: a sine
+// per channel, drifting from frame to frame, with some noise.
+int next_frame(FILE *input, const struct options *o, int idx, float *data) {
+	size_t count = (size_t) o->channels * o->samples;
+
+	if (input != NULL)
+		return fread(data, sizeof(float), count, input) == count;
+
+	for (int c = 0; c < o->channels; c++) {
+		for (int i = 0; i < o->samples; i++) {
+			float t = (float) i / o->samples;
+			float noise = (rand() / (float) RAND_MAX - .5f) * .05f;
+			data[(size_t) c * o->samples + i] = .8f * sinf(2 * (float) M_PI
+					* ((c + 1) * 4 * t + idx * .01f)) + noise;
+		}
+	}
+	return 1;
+}
+
+
+// glReadPixels returns the bottom row first
+void read_pixels(int width, int height, guchar *pixels) {
+	size_t stride = (size_t) width * 4;
+	guchar *row = notnull(malloc(stride));
+
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	for (int y = 0; y < height / 2; y++) {
+		guchar *a = pixels + y * stride;
+		guchar *b = pixels + (height - 1 - y) * stride;
+		memcpy(row, a, stride);
+		memcpy(a, b, stride);
+		memcpy(b, row, stride);
+	}
+	free(row);
+}
+
+
+void write_png(const char *pattern, int idx, int width, int height,
+		guchar *pixels) {
+	GError *error = NULL;
+	gchar *path = g_strdup_printf(pattern, idx);
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(pixels, GDK_COLORSPACE_RGB,
+			TRUE, 8, width, height, width * 4, NULL, NULL);
+
+	if (!gdk_pixbuf_save(pixbuf, path, "png", &error, NULL)) {
+		fprintf(stderr, "Error writing %s: %s\n", path, error->message);
+		exit(1);
+	}
+	g_object_unref(pixbuf);
+	g_free(path);
+}
+
+
+int main(int argc, char **argv) {
+	struct options o = { 1920, 1080, 2, 4096, 100, NULL, NULL, NULL, -1, 0, FALSE, 0, 0 };
+	GError *error = NULL;
+	const GOptionEntry entries[] = {
+		{ "width", 'W', 0, G_OPTION_ARG_INT, &o.width,
+				"Framebuffer width", "PIXELS" },
+		{ "height", 'H', 0, G_OPTION_ARG_INT, &o.height,
+				"Framebuffer height", "PIXELS" },
+		{ "channels", 'c', 0, G_OPTION_ARG_INT, &o.channels,
+				"Channels per frame", "N" },
+		{ "samples", 'n', 0, G_OPTION_ARG_INT, &o.samples,
+				"Samples per channel and frame", "N" },
+		{ "frames", 'f', 0, G_OPTION_ARG_INT, &o.frames,
+				"Frames to render, 0 for the whole input file", "N" },
+		{ "input", 'i', 0, G_OPTION_ARG_FILENAME, &o.input,
+				"Raw float32 frames to replay", "FILE" },
+		{ "png", 'p', 0, G_OPTION_ARG_FILENAME, &o.png,
+				"Write every frame as PNG, %d is the frame number",
+				"PATTERN" },
+		{ "raw", 'r', 0, G_OPTION_ARG_FILENAME, &o.raw,
+				"Append every frame to a raw RGBA dump", "FILE" },
+		{ "xy", 'x', 0, G_OPTION_ARG_DOUBLE, &o.xy,
+				"Plot channel 1 against channel 0, with this persistence"
+				" in seconds (0 for none)", "SECONDS" },
+		{ "histogram", 'g', 0, G_OPTION_ARG_INT, &o.histogram,
+				"Show the amplitude histogram with this many bins", "BINS" },
+		{ "sinc", 's', 0, G_OPTION_ARG_NONE, &o.sinc,
+				"Interpolate sparse plots with a windowed sinc", NULL },
+		{ "zoom-start", 0, 0, G_OPTION_ARG_INT, &o.zoom_start,
+				"First sample of the zoom view", "N" },
+		{ "zoom-stop", 0, 0, G_OPTION_ARG_INT, &o.zoom_stop,
+				"End of the zoom view, after its last sample", "N" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	GOptionContext *options = g_option_context_new(
+			"- render oscilloscope frames offscreen");
+	g_option_context_add_main_entries(options, entries, NULL);
+	if (!g_option_context_parse(options, &argc, &argv, &error)) {
+		fprintf(stderr, "%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(options);
+	if (o.width < 2 || o.height < 1 || o.channels < 1 || o.samples < 2) {
+		fprintf(stderr, "Invalid frame or framebuffer size\n");
+		return 1;
+	}
+	if (o.xy >= 0 && o.channels < 2) {
+		fprintf(stderr, "--xy needs two channels\n");
+		return 1;
+	}
+	if (o.histogram < 0 || o.histogram > GLOSCOPE_HISTOGRAM_MAX_BINS) {
+		fprintf(stderr, "--histogram takes up to %d bins\n",
+				GLOSCOPE_HISTOGRAM_MAX_BINS);
+		return 1;
+	}
+	if (o.input == NULL && o.frames <= 0) {
+		fprintf(stderr, "--frames is needed without --input\n");
+		return 1;
+	}
+
+	FILE *input = NULL;
+	FILE *raw = NULL;
+	if (o.input != NULL && (input = fopen(o.input, "rb")) == NULL) {
+		perror(o.input);
+		return 1;
+	}
+	if (o.raw != NULL && (raw = fopen(o.raw, "wb")) == NULL) {
+		perror(o.raw);
+		return 1;
+	}
+
+	egl_init();
+	struct gloscope_context ctx;
+	gloscope_init(&ctx, o.channels, o.width);
+	framebuffer_init(o.width, o.height);
+	if (o.xy >= 0) {
+		ctx.xy = gloscope_xy_alloc();
+		ctx.xy->persistence = (float) o.xy;
+	}
+	ctx.sinc = o.sinc;
+	if (o.histogram > 0)
+		ctx.histogram = gloscope_histogram_alloc(o.histogram);
+	if (o.zoom_stop > o.zoom_start)
+		ctx.zoom = gloscope_zoom_alloc(o.zoom_start, o.zoom_stop);
+	printf("Renderer: %s, %dx%d, %d channels of %d samples\n",
+			glGetString(GL_RENDERER), o.width, o.height, o.channels,
+			o.samples);
+
+	float *data = notnull(malloc((size_t) o.channels * o.samples
+			* sizeof(float)));
+	guchar *pixels = notnull(malloc((size_t) o.width * o.height * 4));
+	double total = 0, min = INFINITY, max = 0;
+	int frame;
+
+	for (frame = 0; o.frames <= 0 || frame < o.frames; frame++) {
+		if (!next_frame(input, &o, frame, data))
+			break;
+
+		// Same path as a live frame: decimation, upload and draw
+		double start = now_ms();
+		if (ctx.xy != NULL) {
+			gloscope_xy_push(ctx.xy, data, data + o.samples, o.samples);
+		} else {
+			for (int c = 0; c < o.channels; c++)
+				gloscope_plot_set(&ctx, ctx.plots[c],
+						data + (size_t) c * o.samples, o.samples);
+		}
+		for (int c = 0; ctx.histogram != NULL && c < o.channels; c++)
+			gloscope_histogram_push(ctx.histogram, c,
+					data + (size_t) c * o.samples, o.samples);
+		gloscope_render(&ctx);
+		glFinish();
+		double rendered = now_ms();
+
+		if (o.png != NULL || raw != NULL) {
+			read_pixels(o.width, o.height, pixels);
+			if (o.png != NULL)
+				write_png(o.png, frame, o.width, o.height, pixels);
+			if (raw != NULL)
+				fwrite(pixels, 4, (size_t) o.width * o.height, raw);
+		}
+
+		double ms = rendered - start;
+		printf("frame %d render %.3f ms output %.3f ms\n", frame, ms,
+				now_ms() - rendered);
+		total += ms;
+		min = ms < min ? ms : min;
+		max = ms > max ? ms : max;
+	}
+
+	if (frame > 0)
+		printf("%d frames, render min %.3f ms mean %.3f ms max %.3f ms"
+				" (%.1f frames/s)\n", frame, min, total / frame, max,
+				1e3 * frame / total);
+
+	if (input != NULL)
+		fclose(input);
+	if (raw != NULL)
+		fclose(raw);
+	free(data);
+	free(pixels);
+	return 0;
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rokshm.h"
+
+#define ALIGN_UP(x) (((x) + ROKSHM_ALIGN - 1) & ~(size_t) (ROKSHM_ALIGN - 1))
+
+
+static struct rokshm_slot *rokshm_slot_get(const struct rokshm_header *h,
+		uint64_t frame) {
+	char *base = (char *) h + ALIGN_UP(sizeof(*h));
+	return (struct rokshm_slot *) (base + (frame % h->num_slots) * h->slot_stride);
+}
+
+
+static float *rokshm_slot_data(const struct rokshm_header *h,
+		const struct rokshm_slot *slot, uint32_t channel) {
+	char *base = (char *) slot + ALIGN_UP(sizeof(*slot));
+	return (float *) base + (size_t) channel * h->slot_samples;
+}
+
+
+int rokshm_create(struct rokshm *shm, const char *name, uint32_t max_channels,
+		uint32_t slot_samples, uint32_t num_slots) {
+	struct rokshm_header *h;
+	size_t stride;
+
+	if (max_channels > ROKSHM_MAX_CHANNELS || num_slots == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	stride = ALIGN_UP(sizeof(struct rokshm_slot))
+			+ ALIGN_UP((size_t) max_channels * slot_samples * sizeof(float));
+	memset(shm, 0, sizeof(*shm));
+	shm->size = ALIGN_UP(sizeof(*h)) + num_slots * stride;
+
+	shm->fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (shm->fd < 0)
+		return -1;
+	if (ftruncate(shm->fd, 0) < 0 || ftruncate(shm->fd, shm->size) < 0) {
+		close(shm->fd);
+		return -1;
+	}
+
+	h = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+	if (h == MAP_FAILED) {
+		close(shm->fd);
+		return -1;
+	}
+
+	h->version = ROKSHM_VERSION;
+	h->num_slots = num_slots;
+	h->max_channels = max_channels;
+	h->slot_samples = slot_samples;
+	h->slot_stride = (uint32_t) stride;
+	h->head = 0;
+	__atomic_store_n(&h->magic, ROKSHM_MAGIC, __ATOMIC_RELEASE);
+
+	shm->header = h;
+	shm->name = strdup(name);
+	return 0;
+}
+
+
+// Copies one frame into the next slot. Never waits for readers: a reader
+// still looking at the slot will notice the sequence change and retry.
+void rokshm_publish(struct rokshm *shm, const struct rokshm_frame *f) {
+	struct rokshm_header *h = shm->header;
+	uint64_t frame = h->head;
+	struct rokshm_slot *slot = rokshm_slot_get(h, frame);
+	uint32_t seq = slot->seq + 1;
+
+	__atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	uint32_t num_channels = f->num_channels;
+	if (num_channels > h->max_channels)
+		num_channels = h->max_channels;
+	uint32_t num_samples = f->num_samples;
+	if (num_samples > h->slot_samples)
+		num_samples = h->slot_samples;
+
+	slot->num_channels = num_channels;
+	slot->num_samples = num_samples;
+	slot->trigger = f->trigger;
+	slot->frame = frame;
+	slot->timestamp_ns = f->timestamp_ns;
+	slot->samplerate = f->samplerate;
+	for (uint32_t c = 0; c < num_channels; c++) {
+		slot->vdiv[c] = f->vdiv[c];
+		memcpy(rokshm_slot_data(h, slot, c), f->data[c],
+				num_samples * sizeof(float));
+	}
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->head, frame + 1, __ATOMIC_RELEASE);
+}
+
+
+void rokshm_destroy(struct rokshm *shm) {
+	munmap(shm->header, shm->size);
+	close(shm->fd);
+	shm_unlink(shm->name);
+	free(shm->name);
+	memset(shm, 0, sizeof(*shm));
+}
+
+
+int rokshm_open(struct rokshm *shm, const char *name) {
+	struct rokshm_header *h;
+	struct stat st;
+
+	memset(shm, 0, sizeof(*shm));
+	shm->fd = shm_open(name, O_RDONLY, 0);
+	if (shm->fd < 0)
+		return -1;
+	if (fstat(shm->fd, &st) < 0 || (size_t) st.st_size < sizeof(*h)) {
+		close(shm->fd);
+		errno = EINVAL;
+		return -1;
+	}
+	shm->size = st.st_size;
+
+	h = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, shm->fd, 0);
+	if (h == MAP_FAILED) {
+		close(shm->fd);
+		return -1;
+	}
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != ROKSHM_MAGIC
+			|| h->version != ROKSHM_VERSION
+			|| ALIGN_UP(sizeof(*h)) + (size_t) h->num_slots * h->slot_stride
+					> shm->size) {
+		munmap(h, shm->size);
+		close(shm->fd);
+		errno = EPROTO;
+		return -1;
+	}
+
+	shm->header = h;
+	shm->name = strdup(name);
+	return 0;
+}
+
+
+void rokshm_close(struct rokshm *shm) {
+	munmap(shm->header, shm->size);
+	close(shm->fd);
+	free(shm->name);
+	memset(shm, 0, sizeof(*shm));
+}
+
+
+uint64_t rokshm_head(const struct rokshm *shm) {
+	return __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+}
+
+
+// Fills f with the metadata of the given frame and pointers to its samples
+// inside the shared memory. Returns -1 if the frame is being written or has
+// already been overwritten. The samples stay valid only as long as
+// rokshm_frame_valid() returns 1 after reading them.
+int rokshm_frame_begin(const struct rokshm *shm, uint64_t frame,
+		struct rokshm_frame *f) {
+	const struct rokshm_header *h = shm->header;
+	const struct rokshm_slot *slot = rokshm_slot_get(h, frame);
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	if (seq & 1)
+		return -1;
+
+	f->seq = seq;
+	f->slot = slot;
+	f->num_channels = slot->num_channels;
+	f->num_samples = slot->num_samples;
+	f->trigger = slot->trigger;
+	f->frame = slot->frame;
+	f->timestamp_ns = slot->timestamp_ns;
+	f->samplerate = slot->samplerate;
+	memcpy(f->vdiv, slot->vdiv, sizeof(f->vdiv));
+
+	if (!rokshm_frame_valid(shm, f) || f->frame != frame
+			|| f->num_channels > h->max_channels)
+		return -1;
+
+	for (uint32_t c = 0; c < f->num_channels; c++)
+		f->data[c] = rokshm_slot_data(h, slot, c);
+	return 0;
+}
+
+
+int rokshm_frame_valid(const struct rokshm *shm, const struct rokshm_frame *f) {
+	(void) shm;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&f->slot->seq, __ATOMIC_RELAXED) == f->seq;
+}
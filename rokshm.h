@@ -0,0 +1,87 @@
+#ifndef ROKSHM_H
+#define ROKSHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Triggered frames published by rokscope into a POSIX shared memory ring.
+ *
+ * The object starts with a struct rokshm_header, followed by num_slots slots
+ * of slot_stride bytes each. A slot starts with a struct rokshm_slot and is
+ * followed by max_channels arrays of slot_samples floats (the channel data).
+ * The header and the slot header are both padded to ROKSHM_ALIGN bytes.
+ * Frame n lives in slot n % num_slots, head is the number of frames published.
+ *
+ * trigger is the index of the trigger point in the frame, UINT32_MAX when the
+ * frame was published without a trigger.
+ *
+ * Every slot is protected by a seqlock: seq is odd while the writer is
+ * updating it. Readers never block the writer; they read the slot in place
+ * and check afterwards that seq did not change.
+ */
+
+#define ROKSHM_MAGIC 0x534b4f52
+#define ROKSHM_VERSION 1
+#define ROKSHM_MAX_CHANNELS 8
+#define ROKSHM_DEFAULT_NAME "/rokscope"
+#define ROKSHM_DEFAULT_SLOTS 16
+#define ROKSHM_DEFAULT_SAMPLES 65536
+#define ROKSHM_ALIGN 64
+
+struct rokshm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	uint32_t max_channels;
+	uint32_t slot_samples;
+	uint32_t slot_stride;
+	uint64_t head;
+};
+
+struct rokshm_slot {
+	uint32_t seq;
+	uint32_t num_channels;
+	uint32_t num_samples;
+	uint32_t trigger;
+	uint64_t frame;
+	uint64_t timestamp_ns;
+	uint64_t samplerate;
+	float vdiv[ROKSHM_MAX_CHANNELS];
+};
+
+struct rokshm_frame {
+	uint32_t seq;
+	uint32_t num_channels;
+	uint32_t num_samples;
+	uint32_t trigger;
+	uint64_t frame;
+	uint64_t timestamp_ns;
+	uint64_t samplerate;
+	float vdiv[ROKSHM_MAX_CHANNELS];
+	const float *data[ROKSHM_MAX_CHANNELS];
+	const struct rokshm_slot *slot;
+};
+
+struct rokshm {
+	int fd;
+	size_t size;
+	struct rokshm_header *header;
+	char *name;
+};
+
+// Writer side, used by rokscope
+int rokshm_create(struct rokshm *, const char *name, uint32_t max_channels,
+		uint32_t slot_samples, uint32_t num_slots);
+void rokshm_publish(struct rokshm *, const struct rokshm_frame *);
+void rokshm_destroy(struct rokshm *);
+
+// Reader side
+int rokshm_open(struct rokshm *, const char *name);
+void rokshm_close(struct rokshm *);
+uint64_t rokshm_head(const struct rokshm *);
+int rokshm_frame_begin(const struct rokshm *, uint64_t frame,
+		struct rokshm_frame *);
+int rokshm_frame_valid(const struct rokshm *, const struct rokshm_frame *);
+
+#endif
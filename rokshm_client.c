@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "rokshm.h"
+
+/*
+ * Example reader: follows the frames published by rokscope --shm and prints
+ * statistics for each of them, computed directly on the shared memory.
+ */
+
+
+int main(int argc, char **argv) {
+	const char *name = argc > 1 ? argv[1] : ROKSHM_DEFAULT_NAME;
+	struct rokshm shm;
+	uint64_t next, dropped = 0, torn = 0;
+
+	if (rokshm_open(&shm, name) < 0) {
+		perror(name);
+		return 1;
+	}
+	printf("Opened %s: %u slots, %u channels, %u samples\n", name,
+			shm.header->num_slots, shm.header->max_channels,
+			shm.header->slot_samples);
+
+	next = rokshm_head(&shm);
+	for (;;) {
+		struct rokshm_frame f;
+		uint64_t head = rokshm_head(&shm);
+
+		if (head == next) {
+			usleep(1000);
+			continue;
+		}
+		if (head - next > shm.header->num_slots - 1) {
+			dropped += head - next - 1;
+			next = head - 1;
+		}
+
+		if (rokshm_frame_begin(&shm, next, &f) < 0) {
+			torn++;
+			next++;
+			continue;
+		}
+
+		float min[ROKSHM_MAX_CHANNELS], max[ROKSHM_MAX_CHANNELS];
+		double sum[ROKSHM_MAX_CHANNELS];
+		for (uint32_t c = 0; c < f.num_channels; c++) {
+			min[c] = max[c] = f.num_samples ? f.data[c][0] : 0;
+			sum[c] = 0;
+			for (uint32_t i = 0; i < f.num_samples; i++) {
+				float v = f.data[c][i];
+				min[c] = v < min[c] ? v : min[c];
+				max[c] = v > max[c] ? v : max[c];
+				sum[c] += v;
+			}
+		}
+
+		if (!rokshm_frame_valid(&shm, &f)) {
+			torn++;
+			next++;
+			continue;
+		}
+
+		printf("frame %lu t=%lu.%09lu rate=%lu n=%u trig=%u", f.frame,
+				f.timestamp_ns / 1000000000, f.timestamp_ns % 1000000000,
+				f.samplerate, f.num_samples, f.trigger);
+		for (uint32_t c = 0; c < f.num_channels; c++) {
+			printf(" | ch%u vdiv=%g min=%g max=%g mean=%g", c, f.vdiv[c],
+					min[c], max[c],
+					f.num_samples ? sum[c] / f.num_samples : 0);
+		}
+		printf(" | dropped=%lu torn=%lu\n", dropped, torn);
+		next++;
+	}
+
+	rokshm_close(&shm);
+	return 0;
+}
@@ -0,0 +1,463 @@
+#define _FILE_OFFSET_BITS 64
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "search.h"
+
+#define SEARCH_SPAN 64
+
+const char *search_kind_names[SEARCH_KINDS] = {
+	"rise", "fall", "cross", "pulse", "runt", "window", "mask",
+};
+
+
+int search_parse_float(const char *word, double *out) {
+	char *end;
+	*out = strtod(word, &end);
+	return end != word && *end == 0 && isfinite(*out);
+}
+
+
+// Only the envelope of the mask is used; it keys the index by its hash.
+int search_load_mask(struct search_params *p, struct mask *mask,
+		const char *path) {
+	if (!mask_load(mask, 1, 0, path))
+		return 0;
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < mask->num_samples; i++) {
+		float bounds[2] = { mask->lower[i], mask->upper[i] };
+		const uint8_t *bytes = (const uint8_t *) bounds;
+		for (size_t j = 0; j < sizeof(bounds); j++)
+			hash = (hash ^ bytes[j]) * 16777619u;
+	}
+	p->mask_samples = (uint32_t) mask->num_samples;
+	p->mask_hash = hash;
+	return 1;
+}
+
+
+// Parses CHANNEL KIND followed by the levels of the kind:
+//   rise|fall|cross LEVEL [HYSTERESIS]
+//   pulse LEVEL HYSTERESIS MIN_SECONDS MAX_SECONDS
+//   runt|window LOW HIGH
+//   mask FILE LEVEL [HYSTERESIS]
+// A mask search loads FILE into mask.
+int search_parse(struct search_params *p, struct mask *mask, char **words,
+		int n, uint32_t num_channels) {
+	double v[4] = { 0, 0, 0, INFINITY };
+	char *end;
+
+	memset(p, 0, sizeof(*p));
+	if (n < 3)
+		return 0;
+	long channel = strtol(words[0], &end, 10);
+	if (end == words[0] || *end != 0 || channel < 0
+			|| channel >= (long) num_channels)
+		return 0;
+	p->channel = (int32_t) channel;
+	p->kind = -1;
+	for (int k = 0; k < SEARCH_KINDS; k++) {
+		if (strcmp(words[1], search_kind_names[k]) == 0)
+			p->kind = k;
+	}
+	// Words of the levels
+	int first = p->kind == SEARCH_MASK ? 3 : 2;
+	int count = n - first;
+	if (p->kind < 0 || count < 1 || count > 4)
+		return 0;
+	for (int i = 0; i < count; i++) {
+		if (!search_parse_float(words[first + i], &v[i]))
+			return 0;
+	}
+
+	switch (p->kind) {
+	case SEARCH_RISE:
+	case SEARCH_FALL:
+	case SEARCH_CROSS:
+	case SEARCH_PULSE:
+	case SEARCH_MASK:
+		if (v[1] < 0 || (p->kind == SEARCH_PULSE ? count != 4 : count > 2))
+			return 0;
+		p->lo = (float) (v[0] - v[1] / 2);
+		p->hi = (float) (v[0] + v[1] / 2);
+		p->min_width = v[2];
+		p->max_width = v[3];
+		if (p->kind == SEARCH_MASK)
+			return search_load_mask(p, mask, words[2]);
+		return p->min_width <= p->max_width;
+	default:
+		p->lo = (float) v[0];
+		p->hi = (float) v[1];
+		return count == 2 && p->lo < p->hi;
+	}
+}
+
+
+// Zones of every sample, then the positions where they change. Both loops
+// are written for the vectorizer; the second only looks closer at spans
+// where something changed.
+void search_block_task(struct pool_task *t) {
+	struct search_block *b = t->arg;
+	int n = (int) b->e->num_samples;
+	sample_t *samples = notnull(malloc(n * sizeof(sample_t)));
+	uint8_t *zones = notnull(malloc(n));
+
+	b->ok = rec_decode_block(b->f, b->e, samples);
+	if (!b->ok || n == 0) {
+		free(samples);
+		free(zones);
+		return;
+	}
+	float lo = b->params->lo, hi = b->params->hi;
+	for (int i = 0; i < n; i++)
+		zones[i] = (uint8_t) ((samples[i] >= lo) + (samples[i] >= hi));
+
+	b->first_zone = zones[0];
+	for (int from = 1; from < n; from += SEARCH_SPAN) {
+		int to = from + SEARCH_SPAN < n ? from + SEARCH_SPAN : n;
+		uint8_t any = 0;
+		for (int i = from; i < to; i++)
+			any |= zones[i] ^ zones[i - 1];
+		if (!any)
+			continue;
+		for (int i = from; i < to; i++) {
+			if (zones[i] != zones[i - 1]) {
+				struct search_change c = { b->e->first_sample + i, zones[i] };
+				g_array_append_val(b->changes, c);
+			}
+		}
+	}
+	free(samples);
+	free(zones);
+}
+
+
+void search_emit(GArray *events, const struct search_params *p,
+		uint32_t kind, uint64_t sample, uint64_t length) {
+	if ((int) kind != p->kind
+			&& !(p->kind == SEARCH_CROSS && kind <= SEARCH_FALL))
+		return;
+	struct search_event e = { sample, length, kind, 0 };
+	g_array_append_val(events, e);
+}
+
+
+// Forgets everything, as at the start and after a gap.
+void search_reset(struct search_state *st) {
+	st->zone = -1;
+	st->high = -1;
+	st->runt_from = -1;
+	st->outside = -1;
+}
+
+
+void search_start(struct search_state *st, int zone) {
+	search_reset(st);
+	st->zone = zone;
+	st->high = zone == 2 ? 2 : zone == 0 ? 0 : -1;
+	st->outside = zone != 1 ? -1 : 0;
+}
+
+
+void search_change(struct search_state *st, const struct search_params *p,
+		uint64_t min, uint64_t max, uint64_t sample, int zone,
+		GArray *events) {
+	int prev = st->zone;
+	st->zone = zone;
+
+	if (zone == 2 && st->high <= 0) {
+		if (st->high == 0)
+			search_emit(events, p, SEARCH_RISE, sample, 0);
+		st->high_start = sample;
+		st->high = st->high == 0 ? 1 : 2;
+	} else if (zone == 0 && st->high != 0) {
+		if (st->high >= 1)
+			search_emit(events, p, SEARCH_FALL, sample, 0);
+		uint64_t width = sample - st->high_start;
+		if (st->high == 1 && width >= min && width <= max)
+			search_emit(events, p, SEARCH_PULSE, st->high_start, width);
+		st->high = 0;
+	}
+
+	if (zone == 1) {
+		st->runt_from = prev;
+		st->runt_start = sample;
+	} else if (prev == 1) {
+		if (zone == st->runt_from)
+			search_emit(events, p, SEARCH_RUNT, st->runt_start,
+					sample - st->runt_start);
+		st->runt_from = -1;
+	} else {
+		st->runt_from = -1;
+	}
+
+	if (zone != 1 && st->outside == 0) {
+		st->outside = 1;
+		st->outside_start = sample;
+	} else if (zone == 1) {
+		if (st->outside == 1)
+			search_emit(events, p, SEARCH_WINDOW, st->outside_start,
+					sample - st->outside_start);
+		st->outside = 0;
+	}
+}
+
+
+// Scans the channel of a recording into level events, in order.
+int search_scan(struct rec_file *f, struct pool *pool,
+		const struct search_params *p, GArray *events) {
+	double rate = (double) f->header.sample_rate;
+	uint64_t min = (uint64_t) ceil(p->min_width * rate);
+	uint64_t max = isinf(p->max_width) ? UINT64_MAX
+			: (uint64_t) floor(p->max_width * rate);
+	struct search_block blocks[SEARCH_BATCH_BLOCKS];
+	struct pool_graph g;
+	struct search_state st;
+	uint64_t end = 0;
+	int ok = 1;
+
+	memset(&g, 0, sizeof(g));
+	memset(blocks, 0, sizeof(blocks));
+	for (int i = 0; i < SEARCH_BATCH_BLOCKS; i++)
+		blocks[i].changes = g_array_new(FALSE, FALSE,
+				sizeof(struct search_change));
+	search_reset(&st);
+
+	uint64_t i = 0;
+	while (i < f->num_blocks && ok) {
+		int n = 0;
+		pool_graph_clear(&g);
+		for (; i < f->num_blocks && n < SEARCH_BATCH_BLOCKS; i++) {
+			if (f->index[i].channel != p->channel)
+				continue;
+			struct search_block *b = &blocks[n];
+			b->e = &f->index[i];
+			b->params = p;
+			b->f = f;
+			g_array_set_size(b->changes, 0);
+			pool_graph_add(&g, search_block_task, b, n++);
+		}
+		pool_run(pool, &g);
+
+		for (int j = 0; j < n && ok; j++) {
+			struct search_block *b = &blocks[j];
+			ok = b->ok;
+			if (b->e->num_samples == 0)
+				continue;
+			if ((b->e->flags & REC_GAP) || b->e->first_sample != end)
+				search_start(&st, b->first_zone);
+			else if (b->first_zone != st.zone)
+				search_change(&st, p, min, max, b->e->first_sample,
+						b->first_zone, events);
+			for (guint k = 0; k < b->changes->len; k++) {
+				struct search_change *c = &g_array_index(b->changes,
+						struct search_change, k);
+				search_change(&st, p, min, max, c->sample, c->zone, events);
+			}
+			end = b->e->first_sample + b->e->num_samples;
+		}
+	}
+
+	for (int j = 0; j < SEARCH_BATCH_BLOCKS; j++)
+		g_array_free(blocks[j].changes, TRUE);
+	pool_graph_free(&g);
+	return ok;
+}
+
+
+// Tests the windows of the edges that overlap one block.
+void search_mask_task(struct pool_task *t) {
+	struct search_mask_block *b = t->arg;
+	int n = (int) b->e->num_samples;
+	sample_t *samples = notnull(malloc(n * sizeof(sample_t)));
+
+	b->ok = rec_decode_block(b->f, b->e, samples);
+	uint64_t first = b->e->first_sample, end = first + n;
+	uint64_t length = (uint64_t) b->mask->num_samples;
+	int k = first >= length ? search_next(b->edges, first - length) : 0;
+	for (; b->ok && k >= 0 && (guint) k < b->edges->len; k++) {
+		uint64_t edge = g_array_index(b->edges, struct search_event, k).sample;
+		if (edge >= end)
+			break;
+		uint64_t from = edge > first ? edge : first;
+		uint64_t to = edge + length < end ? edge + length : end;
+		int v = mask_count_violations(samples + (from - first),
+				b->mask->lower + (from - edge),
+				b->mask->upper + (from - edge), (int) (to - from));
+		g_atomic_int_add(&b->violations[k], v);
+		g_atomic_int_add(&b->covered[k], (gint) (to - from));
+	}
+	free(samples);
+}
+
+
+// Failing mask windows. Edges retrigger only past the window, as the
+// trigger does, and windows running past the recording are left out.
+int search_mask(struct rec_file *f, struct pool *pool,
+		const struct search_params *p, const struct mask *mask,
+		GArray *events) {
+	struct search_params rise = *p;
+	GArray *edges = g_array_new(FALSE, FALSE, sizeof(struct search_event));
+	GArray *blocks = g_array_new(FALSE, FALSE,
+			sizeof(struct search_mask_block));
+	struct pool_graph g;
+
+	rise.kind = SEARCH_RISE;
+	int ok = search_scan(f, pool, &rise, edges);
+	uint64_t length = (uint64_t) mask->num_samples;
+	uint64_t end = rec_channel_samples(f, p->channel), next = 0;
+	guint kept = 0;
+	for (guint i = 0; i < edges->len; i++) {
+		struct search_event e = g_array_index(edges, struct search_event, i);
+		if (e.sample < next || e.sample + length > end)
+			continue;
+		g_array_index(edges, struct search_event, kept++) = e;
+		next = e.sample + length;
+	}
+	g_array_set_size(edges, kept);
+
+	gint *violations = zalloc((kept + 1) * sizeof(gint));
+	gint *covered = zalloc((kept + 1) * sizeof(gint));
+	for (uint64_t i = 0; ok && kept > 0 && i < f->num_blocks; i++) {
+		if (f->index[i].channel != p->channel || f->index[i].num_samples == 0)
+			continue;
+		struct search_mask_block b = {
+			&f->index[i], f, mask, edges, violations, covered, 0
+		};
+		g_array_append_val(blocks, b);
+	}
+	memset(&g, 0, sizeof(g));
+	for (guint i = 0; i < blocks->len; i++)
+		pool_graph_add(&g, search_mask_task,
+				&g_array_index(blocks, struct search_mask_block, i), (int) i);
+	pool_run(pool, &g);
+	for (guint i = 0; i < blocks->len; i++)
+		ok &= g_array_index(blocks, struct search_mask_block, i).ok;
+
+	for (guint k = 0; ok && k < kept; k++) {
+		uint32_t v = (uint32_t) violations[k]
+				+ (uint32_t) (length - (uint64_t) covered[k]);
+		if (v == 0)
+			continue;
+		struct search_event e = {
+			g_array_index(edges, struct search_event, k).sample, length,
+			SEARCH_MASK, v
+		};
+		g_array_append_val(events, e);
+	}
+
+	pool_graph_free(&g);
+	free(violations);
+	free(covered);
+	g_array_free(blocks, TRUE);
+	g_array_free(edges, TRUE);
+	return ok;
+}
+
+
+// Scans the channel of a recording into events, in order.
+int search_run(struct rec_file *f, struct pool *pool,
+		const struct search_params *p, const struct mask *mask,
+		GArray *events) {
+	if (p->kind == SEARCH_MASK)
+		return search_mask(f, pool, p, mask, events);
+	return search_scan(f, pool, p, events);
+}
+
+
+int search_load(const char *path, const struct search_index_header *want,
+		GArray *events) {
+	struct search_index_header h;
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return 0;
+	int ok = fread(&h, sizeof(h), 1, file) == 1
+			&& memcmp(h.magic, want->magic, sizeof(h.magic)) == 0
+			&& memcmp(&h.params, &want->params, sizeof(h.params)) == 0
+			&& h.recording_size == want->recording_size
+			&& h.recording_mtime == want->recording_mtime;
+	if (ok) {
+		g_array_set_size(events, (guint) h.num_events);
+		ok = fread(events->data, sizeof(struct search_event), h.num_events,
+				file) == h.num_events;
+	}
+	fclose(file);
+	if (!ok)
+		g_array_set_size(events, 0);
+	return ok;
+}
+
+
+void search_save(const char *path, const struct search_index_header *h,
+		GArray *events) {
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		return;
+	}
+	if (fwrite(h, sizeof(*h), 1, file) != 1
+			|| fwrite(events->data, sizeof(struct search_event), events->len,
+			file) != events->len)
+		perror(path);
+	fclose(file);
+}
+
+
+// Events of a search on the recording at path, opened as f: from its
+// index file when that has them, else by scanning, and then saved there.
+// cached tells which. Returns 0 if the recording could not be read.
+int search_events(const char *path, struct rec_file *f, struct pool *pool,
+		const struct search_params *p, const struct mask *mask,
+		GArray *events, int *cached) {
+	struct search_index_header h;
+	struct stat st;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SEARCH_MAGIC, sizeof(h.magic));
+	h.params = *p;
+	if (fstat(f->fd, &st) == 0) {
+		h.recording_size = (uint64_t) st.st_size;
+		h.recording_mtime = (int64_t) st.st_mtime;
+	}
+	gchar *index_path = g_strconcat(path, ".events", NULL);
+
+	g_array_set_size(events, 0);
+	*cached = search_load(index_path, &h, events);
+	int ok = 1;
+	if (!*cached) {
+		ok = search_run(f, pool, p, mask, events);
+		h.num_events = events->len;
+		if (ok)
+			search_save(index_path, &h, events);
+	}
+	g_free(index_path);
+	return ok;
+}
+
+
+// Index of the first event after sample, or -1.
+int search_next(GArray *events, uint64_t sample) {
+	guint lo = 0, hi = events->len;
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		if (g_array_index(events, struct search_event, mid).sample <= sample)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < events->len ? (int) lo : -1;
+}
+
+
+// Index of the last event before sample, or -1.
+int search_prev(GArray *events, uint64_t sample) {
+	guint lo = 0, hi = events->len;
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+		if (g_array_index(events, struct search_event, mid).sample < sample)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (int) lo - 1;
+}
@@ -0,0 +1,126 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "record.h"
+#include "pool.h"
+#include "mask.h"
+
+/*
+ * Event search over recordings. Every block of the searched channel is
+ * classified on the pool, independently of the others: each sample falls
+ * in a zone, below lo, between lo and hi, or at or above hi, and only the
+ * positions where the zone changes are kept. The events are then found in
+ * order from those changes, which are few next to the samples, so the
+ * state carried from block to block costs nothing to serialize.
+ *
+ * Mask searches test the envelope of a mask file from every rising edge
+ * of the level, as the live mask test does from every trigger, and return
+ * the failing edges. The edges are found as above, then every block tests
+ * the windows that overlap it, so each window costs one pass however the
+ * blocks cut it.
+ *
+ * Results are kept in FILE.events next to the recording, with the search
+ * that produced them and the size and time of the recording; the same
+ * search on an unchanged recording reads them back instead of scanning.
+ */
+
+#define SEARCH_MAGIC "ROKEVT2"
+#define SEARCH_BATCH_BLOCKS 256
+
+// Kinds of search, and of the events they return
+#define SEARCH_RISE 0
+#define SEARCH_FALL 1
+#define SEARCH_CROSS 2
+#define SEARCH_PULSE 3
+#define SEARCH_RUNT 4
+#define SEARCH_WINDOW 5
+#define SEARCH_MASK 6
+#define SEARCH_KINDS 7
+
+// Rise, fall, cross and pulse switch at hi going up and at lo going down.
+// Pulses are high times of min_width to max_width seconds; runts go past
+// one threshold and back without reaching the other; window events are
+// spans spent outside [lo, hi]. Mask searches trigger like rise; the
+// mask is told apart by its length and a hash of its bounds.
+struct search_params {
+	int32_t channel;
+	int32_t kind;
+	float lo;
+	float hi;
+	double min_width;
+	double max_width;
+	uint32_t mask_samples;
+	uint32_t mask_hash;
+};
+
+// Rise, fall and cross events have a length of 0. Mask events span the
+// mask and count the positions outside it, missing samples included.
+struct search_event {
+	uint64_t sample;
+	uint64_t length;
+	uint32_t kind;
+	uint32_t violations;
+};
+
+struct search_index_header {
+	char magic[8];
+	struct search_params params;
+	uint64_t recording_size;
+	int64_t recording_mtime;
+	uint64_t num_events;
+};
+
+struct search_change {
+	uint64_t sample;
+	int zone;
+};
+
+// Results of one block
+struct search_block {
+	const struct rec_index_entry *e;
+	const struct search_params *params;
+	struct rec_file *f;
+	int ok;
+	int first_zone;
+	GArray *changes;
+};
+
+// Mask windows overlapping one block; violations and covered are per
+// edge, added to by every block the window spans.
+struct search_mask_block {
+	const struct rec_index_entry *e;
+	struct rec_file *f;
+	const struct mask *mask;
+	GArray *edges;
+	gint *violations;
+	gint *covered;
+	int ok;
+};
+
+// The event state machine, carried across blocks. high is -1 when
+// unknown, 1 when high since high_start and 2 when high since before the
+// first sample seen; runt_from and outside are -1 when unknown.
+struct search_state {
+	int zone;
+	int high;
+	uint64_t high_start;
+	int runt_from;
+	uint64_t runt_start;
+	int outside;
+	uint64_t outside_start;
+};
+
+extern const char *search_kind_names[SEARCH_KINDS];
+
+int search_parse(struct search_params *, struct mask *, char **, int,
+		uint32_t);
+int search_run(struct rec_file *, struct pool *, const struct search_params *,
+		const struct mask *, GArray *);
+int search_events(const char *, struct rec_file *, struct pool *,
+		const struct search_params *, const struct mask *, GArray *, int *);
+int search_next(GArray *, uint64_t);
+int search_prev(GArray *, uint64_t);
+
+#endif
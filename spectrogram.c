@@ -0,0 +1,88 @@
+#include <math.h>
+#include "spectrogram.h"
+
+
+void spectrogram_start(struct spectrogram *sp, int channel) {
+	int n = SPECTROGRAM_FFT_SIZE;
+	if (sp->image == NULL) {
+		fft_init(&sp->fft, n);
+		sp->window = zalloc(n * sizeof(float));
+		sp->block = zalloc(n * sizeof(float));
+		sp->re = zalloc(n * sizeof(float));
+		sp->im = zalloc(n * sizeof(float));
+		sp->row = zalloc((n / 2) * sizeof(float));
+		fft_hann(sp->window, n);
+		sp->image = gloscope_image_alloc(n / 2, SPECTROGRAM_ROWS);
+		sp->image->ring = 1;
+	}
+	sp->channel = channel;
+	sp->fill = 0;
+	sp->peak_db = -INFINITY;
+	sp->active = 1;
+}
+
+
+void spectrogram_stop(struct spectrogram *sp) {
+	sp->active = 0;
+}
+
+
+// Power spectrum of the current block in dB, scaled to [0, 1] over the
+// SPECTROGRAM_RANGE_DB below a slowly decaying peak.
+void spectrogram_row(struct spectrogram *sp) {
+	int n = SPECTROGRAM_FFT_SIZE;
+	float row_peak = -INFINITY;
+
+	for (int i = 0; i < n; i++) {
+		sp->re[i] = sp->block[i] * sp->window[i];
+		sp->im[i] = 0;
+	}
+	fft_forward(&sp->fft, sp->re, sp->im);
+
+	// Hann window coherent gain is 1/2
+	float norm = 2.f / (n * .5f);
+	for (int i = 0; i < n / 2; i++) {
+		float mag2 = (sp->re[i] * sp->re[i] + sp->im[i] * sp->im[i])
+				* norm * norm;
+		float db = 10.f * log10f(mag2 + 1e-20f);
+		sp->row[i] = db;
+		row_peak = db > row_peak ? db : row_peak;
+	}
+
+	sp->peak_db -= .05f;
+	if (row_peak > sp->peak_db)
+		sp->peak_db = row_peak;
+	float floor_db = sp->peak_db - SPECTROGRAM_RANGE_DB;
+	for (int i = 0; i < n / 2; i++)
+		sp->row[i] = (sp->row[i] - floor_db) / SPECTROGRAM_RANGE_DB;
+
+	gloscope_image_push_row(sp->image, sp->row);
+}
+
+
+void spectrogram_push(struct spectrogram *sp, const sample_t *samples,
+		int count) {
+	if (!sp->active)
+		return;
+
+	while (count > 0) {
+		int n = SPECTROGRAM_FFT_SIZE - sp->fill;
+		if (n > count)
+			n = count;
+		memcpy(sp->block + sp->fill, samples, n * sizeof(sample_t));
+		sp->fill += n;
+		samples += n;
+		count -= n;
+
+		if (sp->fill == SPECTROGRAM_FFT_SIZE) {
+			spectrogram_row(sp);
+			sp->fill = 0;
+		}
+	}
+}
+
+
+// Drops a partial block when the stream is interrupted.
+void spectrogram_gap(struct spectrogram *sp) {
+	sp->fill = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include "fft.h"
+#include "gloscope.h"
+
+#define SPECTROGRAM_FFT_SIZE 1024
+#define SPECTROGRAM_ROWS 512
+#define SPECTROGRAM_RANGE_DB 80.f
+
+// Waterfall of one channel: every SPECTROGRAM_FFT_SIZE consecutive samples
+// of the capture stream become one row of a ring image.
+struct spectrogram {
+	int active;
+	int channel;
+	int fill;
+	float peak_db;
+	struct fft fft;
+	float *window;
+	float *block;
+	float *re;
+	float *im;
+	float *row;
+	struct gloscope_image *image;
+};
+
+void spectrogram_start(struct spectrogram *, int);
+void spectrogram_stop(struct spectrogram *);
+void spectrogram_push(struct spectrogram *, const sample_t *, int);
+void spectrogram_gap(struct spectrogram *);
+
+#endif
@@ -0,0 +1,191 @@
+#include <math.h>
+#include <string.h>
+#include "xcorr.h"
+
+
+// Sizes the transform for frames of n samples and restarts the averages.
+void xcorr_resize(struct xcorr *x, int n) {
+	int m = 2;
+	while (m < 2 * n)
+		m <<= 1;
+	if (x->fft.n == m)
+		return;
+
+	fft_free(&x->fft);
+	fft_init(&x->fft, m);
+	x->re = notnull(realloc(x->re, m * sizeof(float)));
+	x->im = notnull(realloc(x->im, m * sizeof(float)));
+	x->sab_re = notnull(realloc(x->sab_re, (m / 2 + 1) * sizeof(float)));
+	x->sab_im = notnull(realloc(x->sab_im, (m / 2 + 1) * sizeof(float)));
+	x->saa = notnull(realloc(x->saa, (m / 2 + 1) * sizeof(float)));
+	x->sbb = notnull(realloc(x->sbb, (m / 2 + 1) * sizeof(float)));
+	x->averaged = 0;
+}
+
+
+void xcorr_process(struct xcorr *x, const struct xcorr_job *job) {
+	int n = job->num_samples;
+	const sample_t *a = job->samples;
+	const sample_t *b = job->samples + n;
+	double mean_a = 0, mean_b = 0, energy_a = 0, energy_b = 0;
+
+	xcorr_resize(x, n);
+	int m = x->fft.n;
+
+	for (int i = 0; i < n; i++) {
+		mean_a += a[i];
+		mean_b += b[i];
+	}
+	mean_a /= n;
+	mean_b /= n;
+	for (int i = 0; i < n; i++) {
+		x->re[i] = (float) (a[i] - mean_a);
+		x->im[i] = (float) (b[i] - mean_b);
+		energy_a += (double) x->re[i] * x->re[i];
+		energy_b += (double) x->im[i] * x->im[i];
+	}
+	memset(x->re + n, 0, (m - n) * sizeof(float));
+	memset(x->im + n, 0, (m - n) * sizeof(float));
+
+	fft_forward(&x->fft, x->re, x->im);
+
+	// Z = A + iB with A, B hermitian: A[k] = (Z[k] + conj Z[m-k]) / 2,
+	// B[k] = (Z[k] - conj Z[m-k]) / 2i. The cross spectrum A conj(B) is
+	// hermitian too, so bins 0 to m/2 are computed and mirrored in place.
+	float alpha = x->averaged ? XCORR_AVERAGE : 1.f;
+	int peak_bin = 1;
+	float peak_mag = -1;
+	for (int k = 0; k <= m / 2; k++) {
+		int j = (m - k) & (m - 1);
+		float zr = x->re[k], zi = x->im[k];
+		float wr = x->re[j], wi = x->im[j];
+		float ar = (zr + wr) * .5f, ai = (zi - wi) * .5f;
+		float br = (zi + wi) * .5f, bi = (wr - zr) * .5f;
+		float cr = ar * br + ai * bi;
+		float ci = ai * br - ar * bi;
+
+		x->sab_re[k] += alpha * (cr - x->sab_re[k]);
+		x->sab_im[k] += alpha * (ci - x->sab_im[k]);
+		x->saa[k] += alpha * (ar * ar + ai * ai - x->saa[k]);
+		x->sbb[k] += alpha * (br * br + bi * bi - x->sbb[k]);
+		float mag = cr * cr + ci * ci;
+		if (k > 0 && mag > peak_mag) {
+			peak_mag = mag;
+			peak_bin = k;
+		}
+
+		x->re[k] = cr;
+		x->im[k] = ci;
+		x->re[j] = cr;
+		x->im[j] = -ci;
+	}
+	x->averaged = 1;
+
+	fft_inverse(&x->fft, x->re, x->im);
+
+	// re[k] = sum a[t + k] b[t]: a peak at k > 0 means a lags b
+	int best = 0;
+	for (int k = -(n - 1); k < n; k++) {
+		if (x->re[k & (m - 1)] > x->re[best & (m - 1)])
+			best = k;
+	}
+	float y0 = x->re[(best - 1) & (m - 1)];
+	float y1 = x->re[best & (m - 1)];
+	float y2 = x->re[(best + 1) & (m - 1)];
+	float denom = y0 - 2 * y1 + y2;
+	double offset = denom < 0 ? .5 * (y0 - y2) / denom : 0;
+
+	double rate = (double) job->sample_rate;
+	int k = peak_bin;
+	g_mutex_lock(&x->lock);
+	x->frames++;
+	x->delay = (best + offset) / rate;
+	x->phase = atan2(x->sab_im[k], x->sab_re[k]) * 180 / M_PI;
+	x->frequency = k * rate / m;
+	x->coherence = x->saa[k] > 0 && x->sbb[k] > 0
+			? (x->sab_re[k] * x->sab_re[k] + x->sab_im[k] * x->sab_im[k])
+					/ ((double) x->saa[k] * x->sbb[k]) : 0;
+	x->correlation = energy_a > 0 && energy_b > 0
+			? y1 / sqrt(energy_a * energy_b) : 0;
+	g_mutex_unlock(&x->lock);
+}
+
+
+gpointer xcorr_worker(gpointer data) {
+	struct xcorr *x = data;
+
+	for (;;) {
+		struct xcorr_job *job = g_async_queue_pop(x->queue);
+		struct xcorr_job *next;
+
+		// Only the latest frame matters
+		while (job->num_samples >= 0
+				&& (next = g_async_queue_try_pop(x->queue)) != NULL) {
+			free(job);
+			job = next;
+			g_mutex_lock(&x->lock);
+			x->dropped++;
+			g_mutex_unlock(&x->lock);
+		}
+		if (job->num_samples < 0) {
+			free(job);
+			break;
+		}
+		if (job->num_samples > 1 && job->sample_rate > 0)
+			xcorr_process(x, job);
+		free(job);
+	}
+	return NULL;
+}
+
+
+void xcorr_start(struct xcorr *x, int channel_a, int channel_b) {
+	xcorr_stop(x);
+	if (x->queue == NULL) {
+		g_mutex_init(&x->lock);
+		x->queue = g_async_queue_new();
+	}
+
+	x->channel_a = channel_a;
+	x->channel_b = channel_b;
+	x->averaged = 0;
+	g_mutex_lock(&x->lock);
+	x->frames = 0;
+	x->dropped = 0;
+	x->delay = 0;
+	x->phase = 0;
+	x->frequency = 0;
+	x->coherence = 0;
+	x->correlation = 0;
+	g_mutex_unlock(&x->lock);
+
+	x->thread = g_thread_new("xcorr", xcorr_worker, x);
+	x->active = 1;
+}
+
+
+void xcorr_stop(struct xcorr *x) {
+	if (!x->active)
+		return;
+	x->active = 0;
+	struct xcorr_job *job = zalloc(sizeof(*job));
+	job->num_samples = -1;
+	g_async_queue_push(x->queue, job);
+	g_thread_join(x->thread);
+	x->thread = NULL;
+}
+
+
+// Queues a copy of both channels of a frame.
+void xcorr_push(struct xcorr *x, const sample_t *a, const sample_t *b, int n,
+		uint64_t sample_rate) {
+	if (!x->active)
+		return;
+	struct xcorr_job *job = notnull(malloc(sizeof(*job)
+			+ 2 * n * sizeof(sample_t)));
+	job->num_samples = n;
+	job->sample_rate = sample_rate;
+	memcpy(job->samples, a, n * sizeof(sample_t));
+	memcpy(job->samples + n, b, n * sizeof(sample_t));
+	g_async_queue_push(x->queue, job);
+}
@@ -0,0 +1,56 @@
+#ifndef XCORR_H
+#define XCORR_H
+
+#include <stdint.h>
+#include <glib.h>
+#include "fft.h"
+#include "gloscope.h"
+
+#define XCORR_AVERAGE 0.1f
+
+struct xcorr_job {
+	int num_samples;
+	uint64_t sample_rate;
+	sample_t samples[];
+};
+
+// Delay and phase of channel a against channel b, frame by frame. Frames
+// are queued to a worker thread, which only processes the latest one when
+// it falls behind. Both channels go through a single complex FFT (a in the
+// real part, b in the imaginary part), zero-padded to twice the frame so
+// the correlation is linear; the inverse transform of A conj(B) gives the
+// cross-correlation, whose peak is refined with a parabola through its
+// neighbours. Phase and coherence are taken at the strongest bin of the
+// cross spectrum, coherence from spectra averaged over frames.
+struct xcorr {
+	int active;
+	int channel_a;
+	int channel_b;
+	GThread *thread;
+	GAsyncQueue *queue;
+	// Worker only
+	struct fft fft;
+	float *re;
+	float *im;
+	float *sab_re;
+	float *sab_im;
+	float *saa;
+	float *sbb;
+	int averaged;
+	// Protected by lock
+	GMutex lock;
+	uint64_t frames;
+	uint64_t dropped;
+	double delay;
+	double phase;
+	double frequency;
+	double coherence;
+	double correlation;
+};
+
+void xcorr_start(struct xcorr *, int, int);
+void xcorr_stop(struct xcorr *);
+void xcorr_push(struct xcorr *, const sample_t *, const sample_t *, int,
+		uint64_t);
+
+#endif